@@ -0,0 +1,480 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "batch.h"
+#include "bitboard.h"
+#include "policy.h"
+#include "position.h"
+
+using namespace Policy;
+
+namespace {
+
+  // Vec holds one bitboard per lane of a PositionBatch group and wraps the
+  // few vector instructions the generator needs. Without AVX2 a group is a
+  // single position and Vec a plain bitboard.
+
+#if defined(USE_AVX512)
+
+  struct Vec {
+    static Vec load(const Bitboard* p) { return { _mm512_loadu_si512(p) }; }
+    static Vec set(Bitboard b) { return { _mm512_set1_epi64(int64_t(b)) }; }
+    void store(Bitboard* p) const { _mm512_storeu_si512(p, v); }
+    __m512i v;
+  };
+
+  inline Vec operator&(Vec a, Vec b) { return { _mm512_and_si512(a.v, b.v) }; }
+  inline Vec operator|(Vec a, Vec b) { return { _mm512_or_si512(a.v, b.v) }; }
+
+  // The zero-masked forms compile to the same instructions, but unlike the
+  // plain ones they do not trip -Wmaybe-uninitialized in the gcc 12 headers.
+  inline Vec andnot(Vec a, Vec b) { return { _mm512_maskz_andnot_epi64(0xFF, a.v, b.v) }; } // ~a & b
+  inline Vec shl(Vec a, int n) { return { _mm512_maskz_sll_epi64(0xFF, a.v, _mm_cvtsi32_si128(n)) }; }
+  inline Vec shr(Vec a, int n) { return { _mm512_maskz_srl_epi64(0xFF, a.v, _mm_cvtsi32_si128(n)) }; }
+
+  // nonzero() is all ones in the lanes where 'a' is not empty, zero elsewhere
+  inline Vec nonzero(Vec a) {
+    return { _mm512_maskz_set1_epi64(_mm512_test_epi64_mask(a.v, a.v), -1) };
+  }
+
+#elif defined(USE_AVX2)
+
+  struct Vec {
+    static Vec load(const Bitboard* p) { return { _mm256_loadu_si256((const __m256i*)p) }; }
+    static Vec set(Bitboard b) { return { _mm256_set1_epi64x(int64_t(b)) }; }
+    void store(Bitboard* p) const { _mm256_storeu_si256((__m256i*)p, v); }
+    __m256i v;
+  };
+
+  inline Vec operator&(Vec a, Vec b) { return { _mm256_and_si256(a.v, b.v) }; }
+  inline Vec operator|(Vec a, Vec b) { return { _mm256_or_si256(a.v, b.v) }; }
+  inline Vec andnot(Vec a, Vec b) { return { _mm256_andnot_si256(a.v, b.v) }; }
+  inline Vec shl(Vec a, int n) { return { _mm256_sll_epi64(a.v, _mm_cvtsi32_si128(n)) }; }
+  inline Vec shr(Vec a, int n) { return { _mm256_srl_epi64(a.v, _mm_cvtsi32_si128(n)) }; }
+
+  inline Vec nonzero(Vec a) {
+    __m256i zero = _mm256_setzero_si256();
+    return { _mm256_xor_si256(_mm256_cmpeq_epi64(a.v, zero), _mm256_cmpeq_epi64(zero, zero)) };
+  }
+
+#else
+
+  struct Vec {
+    static Vec load(const Bitboard* p) { return { *p }; }
+    static Vec set(Bitboard b) { return { b }; }
+    void store(Bitboard* p) const { *p = v; }
+    Bitboard v;
+  };
+
+  inline Vec operator&(Vec a, Vec b) { return { a.v & b.v }; }
+  inline Vec operator|(Vec a, Vec b) { return { a.v | b.v }; }
+  inline Vec andnot(Vec a, Vec b) { return { ~a.v & b.v }; }
+  inline Vec shl(Vec a, int n) { return { a.v << n }; }
+  inline Vec shr(Vec a, int n) { return { a.v >> n }; }
+  inline Vec nonzero(Vec a) { return { a.v ? ~0ULL : 0 }; }
+
+#endif
+
+  inline Vec& operator|=(Vec& a, Vec b) { return a = a | b; }
+  inline Vec operator~(Vec a) { return andnot(a, Vec::set(~0ULL)); }
+
+  // sh() shifts by 8 * dy + dx bits, whatever the sign
+  inline Vec sh(Vec b, int s) { return s > 0 ? shl(b, s) : shr(b, -s); }
+
+  // shift() moves every bit one step of (Dx, Dy), dropping the bits that
+  // would wrap around the board edge. unshift() takes back 'n' such steps
+  // of squares that were reached by real steps, so nothing can wrap.
+  template<int Dx, int Dy>
+  inline Vec shift(Vec b) {
+    const Bitboard keep =  Dx ==  2 ? ~(FileGBB | FileHBB) : Dx ==  1 ? ~FileHBB
+                         : Dx == -2 ? ~(FileABB | FileBBB) : Dx == -1 ? ~FileABB : ~0ULL;
+    return sh(Dx ? b & Vec::set(keep) : b, 8 * Dy + Dx);
+  }
+
+  template<int Dx, int Dy>
+  inline Vec unshift(Vec b, int n) { return sh(b, -n * (8 * Dy + Dx)); }
+
+  // ray() returns the squares reached from 'b' sliding along (Dx, Dy) through
+  // the 'empty' squares, the first occupied square included. It is a Kogge-
+  // Stone occluded fill: three doubling steps instead of six single ones.
+  template<int Dx, int Dy>
+  inline Vec ray(Vec b, Vec empty) {
+    const int s = 8 * Dy + Dx;
+    empty = Dx ? empty & Vec::set(Dx > 0 ? ~FileABB : ~FileHBB) : empty;
+    b = b | (empty & sh(b, s)), empty = empty & sh(empty, s);
+    b = b | (empty & sh(b, 2 * s)), empty = empty & sh(empty, 2 * s);
+    b = b | (empty & sh(b, 4 * s));
+    return shift<Dx, Dy>(b);
+  }
+
+  // FlipPlane[] maps a plane to the one of the vertically mirrored move.
+  // Underpromotion planes keep the rank delta of a white pawn, so they map
+  // to themselves.
+  struct FlipTable {
+    FlipTable() {
+      for (int p = 0; p < PlaneNb; ++p)
+          plane[p] = p < 64 ? Policy::plane(plane_dx(p), -plane_dy(p), NO_PIECE_TYPE) : p;
+    }
+    int plane[PlaneNb];
+  };
+
+  const FlipTable FlipPlane;
+
+
+  // Generator computes the legal moves of a group of positions, all with
+  // 'us' playing north, directly as policy planes: the plane of a move
+  // depends only on its vector, so the origin squares of all the moves of a
+  // plane form a bitboard, which is a policy mask word. Each plane is thus a
+  // shift of a target set, set-wise over all the pieces of all the lanes.
+  // Pins and checks are found the same way, sliding from our king. Castling
+  // and en passant are left to the scalar fix-ups of legal_bits().
+
+  struct Generator {
+
+    Generator(const Bitboard* g) {
+
+      for (int i = 0; i < 10; ++i)
+          piece[i] = Vec::load(g + i * PositionBatch::Lanes); // In PositionBatch::Field order
+
+      us    = piece[0] | piece[1] | piece[2] | piece[3] | piece[4];
+      them  = piece[5] | piece[6] | piece[7] | piece[8] | piece[9];
+      empty = ~(us | them);
+      attacked = checkMask = checked = doubleChecked = Vec::set(0);
+
+      for (Vec& p : pinned)
+          p = Vec::set(0);
+
+      for (Vec& p : planes)
+          p = Vec::set(0);
+    }
+
+    Vec& usPawns()   { return piece[0]; }
+    Vec& usKnights() { return piece[1]; }
+    Vec& usKing()    { return piece[4]; }
+    Vec& themPawns() { return piece[5]; }
+    Vec& themKnights() { return piece[6]; }
+    Vec& themKing()  { return piece[9]; }
+    Vec& usSliders(int d)   { return piece[d & 1 ? 2 : 3]; }
+    Vec& themSliders(int d) { return piece[d & 1 ? 7 : 8]; }
+
+    // Pieces free to move along orientation 'o': not pinned, or pinned along
+    // that same line. Orientations are direction indices modulo 4.
+    Vec movable(int o) const {
+      return andnot(pinned[0] | pinned[1] | pinned[2] | pinned[3], Vec::set(~0ULL)) | pinned[o];
+    }
+
+    void add(int p, Vec from) { planes[p] |= from; }
+
+    template<int D> void scan();
+    template<int D> void slide();
+    template<int I> void knight_scan();
+    template<int I> void knight();
+    void pawns();
+    void generate();
+
+    Vec piece[10];
+    Vec us, them, empty;
+    Vec attacked, checkMask, checked, doubleChecked, filter, target;
+    Vec pinned[4];
+    Vec planes[PlaneNb];
+  };
+
+
+  // scan() handles direction D from both sides: it adds to 'attacked' the
+  // enemy slider attacks, with our king not blocking them so that it cannot
+  // step back along a checking line, and looks from our king for checkers
+  // and for our pieces pinned against it.
+  template<int D>
+  void Generator::scan() {
+
+    const int Dx = DirDx[D], Dy = DirDy[D];
+    Vec sliders = themSliders(D);
+
+    attacked |= ray<Dx, Dy>(sliders, empty | usKing());
+
+    Vec r = ray<Dx, Dy>(usKing(), empty);
+    Vec hit = nonzero(r & sliders);
+
+    doubleChecked |= checked & hit;
+    checked |= hit;
+    checkMask |= r & hit;
+
+    Vec blocker = r & us;
+    pinned[D & 3] |= blocker & nonzero(ray<Dx, Dy>(blocker, empty) & sliders);
+  }
+
+
+  // slide() adds the bishop, rook and queen moves of direction D, one plane
+  // per distance, and the king step in that direction.
+  template<int D>
+  void Generator::slide() {
+
+    const int Dx = DirDx[D], Dy = DirDy[D];
+    Vec b = usSliders(D) & movable(D & 3);
+
+    for (int k = 1; k <= 7; ++k)
+    {
+        b = shift<Dx, Dy>(b);
+        add(7 * D + k - 1, unshift<Dx, Dy>(b & target, k));
+        b = b & empty;
+    }
+
+    add(7 * D, unshift<Dx, Dy>(shift<Dx, Dy>(usKing()) & andnot(attacked | us, Vec::set(~0ULL)), 1));
+  }
+
+
+  // knight_scan() adds the attacks of the enemy knights along knight vector
+  // I and any of them checking our king. knight() adds our knight moves.
+  template<int I>
+  void Generator::knight_scan() {
+
+    const int Dx = KnightDx[I], Dy = KnightDy[I];
+
+    attacked |= shift<Dx, Dy>(themKnights());
+    checkMask |= shift<Dx, Dy>(usKing()) & themKnights();
+  }
+
+  template<int I>
+  void Generator::knight() {
+
+    const int Dx = KnightDx[I], Dy = KnightDy[I];
+
+    add(56 + I, unshift<Dx, Dy>(shift<Dx, Dy>(usKnights() & movable(0) & movable(1)) & target, 1));
+  }
+
+
+  // pawns() adds pushes and captures. Moves to the last rank go to the queen
+  // plane of their vector and to the three underpromotion planes.
+  void Generator::pawns() {
+
+    const Vec lastRank = Vec::set(Rank8BB);
+
+    Vec push = shift<0, 1>(usPawns() & movable(0)) & empty;
+    Vec push2 = shift<0, 1>(push & Vec::set(Rank3BB)) & empty & filter;
+    Vec east = shift<1, 1>(usPawns() & movable(1)) & them & filter;
+    Vec west = shift<-1, 1>(usPawns() & movable(3)) & them & filter;
+
+    push = push & filter;
+
+    add(0, unshift<0, 1>(push, 1));
+    add(1, unshift<0, 1>(push2, 2));
+    add(7, unshift<1, 1>(east, 1));
+    add(49, unshift<-1, 1>(west, 1));
+
+    for (int k = 0; k < 3; ++k)
+    {
+        add(64 + 3 * k + 0, unshift<-1, 1>(west & lastRank, 1));
+        add(64 + 3 * k + 1, unshift< 0, 1>(push & lastRank, 1));
+        add(64 + 3 * k + 2, unshift< 1, 1>(east & lastRank, 1));
+    }
+  }
+
+
+  void Generator::generate() {
+
+    Vec king = themKing();
+
+    attacked =  shift< 1, -1>(themPawns()) | shift<-1, -1>(themPawns())
+              | shift< 0,  1>(king) | shift< 1,  1>(king) | shift< 1,  0>(king) | shift< 1, -1>(king)
+              | shift< 0, -1>(king) | shift<-1, -1>(king) | shift<-1,  0>(king) | shift<-1,  1>(king);
+
+    scan<0>(); scan<1>(); scan<2>(); scan<3>();
+    scan<4>(); scan<5>(); scan<6>(); scan<7>();
+
+    // Sliders are done, checkMask now gets the non-slider checkers. A pawn or
+    // a knight check can come with a discovered check but not with each other.
+    Vec sliderChecks = checkMask;
+
+    checkMask = (shift<1, 1>(usKing()) | shift<-1, 1>(usKing())) & themPawns();
+
+    knight_scan<0>(); knight_scan<1>(); knight_scan<2>(); knight_scan<3>();
+    knight_scan<4>(); knight_scan<5>(); knight_scan<6>(); knight_scan<7>();
+
+    Vec hit = nonzero(checkMask);
+
+    doubleChecked |= checked & hit;
+    checked |= hit;
+    checkMask |= sliderChecks;
+
+    // Out of check everything not ours is a target. In check, only the
+    // checker and the squares between it and the king; in double check,
+    // nothing but king moves.
+    filter = andnot(doubleChecked, (checked & checkMask) | andnot(checked, Vec::set(~0ULL)));
+    target = andnot(us, filter);
+
+    slide<0>(); slide<1>(); slide<2>(); slide<3>();
+    slide<4>(); slide<5>(); slide<6>(); slide<7>();
+
+    knight<0>(); knight<1>(); knight<2>(); knight<3>();
+    knight<4>(); knight<5>(); knight<6>(); knight<7>();
+
+    pawns();
+  }
+
+} // namespace
+
+
+/// PositionBatch::load() replaces the content of the batch with 'n' positions.
+/// The lanes of the last group past the end are left empty, which generates
+/// no moves.
+
+void PositionBatch::load(const Position* positions, size_t n) {
+
+  size_t groups = (n + Lanes - 1) / Lanes;
+
+  count = n;
+  bb.assign(groups * FIELD_NB * Lanes, 0);
+  info.resize(n);
+
+  for (size_t i = 0; i < n; ++i)
+  {
+      const Position& pos = positions[i];
+      const Color us = pos.sideToMove;
+      const bool flipped = us == BLACK;
+      Bitboard* g = &bb[i / Lanes * FIELD_NB * Lanes + i % Lanes];
+      LaneInfo& li = info[i];
+
+      auto f = [=](Bitboard b) { return flipped ? flip(b) : b; };
+      auto s = [=](Square sq) { return flipped ? ~sq : sq; };
+
+      for (Color c = WHITE; c <= BLACK; ++c)
+      {
+          Bitboard* fields = g + (c == us ? US_PAWN : THEM_PAWN) * Lanes;
+
+          fields[0 * Lanes] = f(pos.pieces(c, PAWN));
+          fields[1 * Lanes] = f(pos.pieces(c, KNIGHT));
+          fields[2 * Lanes] = f(pos.pieces(c, BISHOP, QUEEN));
+          fields[3 * Lanes] = f(pos.pieces(c, ROOK, QUEEN));
+          fields[4 * Lanes] = f(pos.pieces(c, KING));
+      }
+
+      li.sideToMove = us;
+      li.epSquare = pos.epSquare == SQ_NONE ? SQ_NONE : s(pos.epSquare);
+
+      for (CastlingSide cs = KING_SIDE; cs <= QUEEN_SIDE; cs = CastlingSide(cs + 1))
+      {
+          CastlingRight cr = us | cs;
+          Square kfrom = pos.square<KING>(us);
+          Square kto = relative_square(us, cs == KING_SIDE ? SQ_G1 : SQ_C1);
+
+          li.castlingRook[cs] = pos.can_castle(cr) ? s(pos.castling_rook_square(cr)) : SQ_NONE;
+          li.castlingPath[cs] = f(pos.castlingInfo->castlingPath[cr]);
+          li.kingPath[cs] = kfrom == kto ? 0 : f(between_bb(kfrom, kto) | kto);
+      }
+  }
+}
+
+
+/// PositionBatch::legal_bits() runs the vector generator on each group, then
+/// adds castling and en passant captures lane by lane, and finally writes the
+/// planes of each position in the requested perspective.
+
+void PositionBatch::legal_bits(uint64_t* out, bool stmPerspective, int* counts) const {
+
+  static_assert(MaskWords == PlaneNb, "Each mask word must be a plane");
+
+  Bitboard planes[PlaneNb][Lanes], attacked[Lanes], checked[Lanes];
+
+  for (size_t g = 0; g * Lanes < count; ++g)
+  {
+      const Bitboard* fields = group(g);
+      Generator gen(fields);
+
+      gen.generate();
+
+      for (int p = 0; p < PlaneNb; ++p)
+          gen.planes[p].store(planes[p]);
+
+      gen.attacked.store(attacked);
+      gen.checked.store(checked);
+
+      for (int l = 0; l < Lanes && g * Lanes + l < count; ++l)
+      {
+          const size_t i = g * Lanes + l;
+          const LaneInfo& li = info[i];
+          auto field = [&](Field f) { return fields[f * Lanes + l]; };
+
+          Bitboard occupied = 0;
+
+          for (int f = 0; f < FIELD_NB; ++f)
+              occupied |= fields[f * Lanes + l];
+
+          Square ksq = lsb(field(US_KING));
+
+          // Castling: not in check, path empty and not attacked. In Chess960
+          // the castling rook may be what shields the king destination from
+          // an enemy rook or queen on the first rank.
+          for (int cs = KING_SIDE; cs <= QUEEN_SIDE && !checked[l]; ++cs)
+          {
+              Square rsq = li.castlingRook[cs];
+              Square kto = cs == KING_SIDE ? SQ_G1 : SQ_C1;
+
+              if (   rsq == SQ_NONE
+                  || (li.castlingPath[cs] & occupied)
+                  || (li.kingPath[cs] & attacked[l])
+                  || (attacks_bb<ROOK>(kto, occupied ^ rsq) & field(THEM_ORTH)))
+                  continue;
+
+              int dx = file_of(rsq) - file_of(ksq);
+              planes[7 * (dx > 0 ? 2 : 6) + (dx > 0 ? dx : -dx) - 1][l] |= ksq;
+          }
+
+          // En passant: test the king against everything once both pawns are
+          // gone from their squares, captured pawn included, which also
+          // settles the evasions.
+          if (li.epSquare != SQ_NONE)
+          {
+              Square capsq = li.epSquare - Square(8);
+              Bitboard b = StepAttacksBB[B_PAWN][li.epSquare] & field(US_PAWN);
+
+              while (b)
+              {
+                  Square from = pop_lsb(&b);
+                  Bitboard occ = (occupied ^ from ^ capsq) | li.epSquare;
+
+                  if (   !(attacks_bb<  ROOK>(ksq, occ) & field(THEM_ORTH))
+                      && !(attacks_bb<BISHOP>(ksq, occ) & field(THEM_DIAG))
+                      && !(StepAttacksBB[KNIGHT][ksq] & field(THEM_KNIGHT))
+                      && !(StepAttacksBB[W_PAWN][ksq] & field(THEM_PAWN) & ~SquareBB[capsq]))
+                      planes[file_of(li.epSquare) > file_of(from) ? 7 : 49][l] |= from;
+              }
+          }
+
+          uint64_t* dst = out + i * MaskWords;
+
+          if (stmPerspective || li.sideToMove == WHITE)
+              for (int p = 0; p < PlaneNb; ++p)
+                  dst[p] = planes[p][l];
+          else
+              for (int p = 0; p < PlaneNb; ++p)
+                  dst[FlipPlane.plane[p]] = flip(planes[p][l]);
+
+          if (counts)
+          {
+              int n = 0;
+
+              for (int p = 0; p < PlaneNb; ++p)
+                  n += popcount(dst[p]);
+
+              counts[i] = n;
+          }
+      }
+  }
+}
@@ -0,0 +1,85 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+#include <cstddef>
+#include <vector>
+
+#include "types.h"
+
+struct Position;
+
+/// PositionBatch stores many positions as a structure of arrays, so that move
+/// generation can run on several positions per instruction. Positions are
+/// grouped by Lanes, and each group holds, for each piece set, one bitboard
+/// per lane in consecutive memory, ready for a vector load.
+///
+/// Every lane is stored from the side to move perspective: black to move
+/// positions are flipped vertically with colors swapped, so the generator
+/// only ever deals with 'us' playing north.
+
+class PositionBatch {
+
+  enum Field {
+    US_PAWN, US_KNIGHT, US_DIAG, US_ORTH, US_KING, // DIAG: bishops and queens, ORTH: rooks and queens
+    THEM_PAWN, THEM_KNIGHT, THEM_DIAG, THEM_ORTH, THEM_KING,
+    FIELD_NB
+  };
+
+  // Data not worth a vector field, used by the scalar fix-ups of castling
+  // and en passant that follow the vector generation
+  struct LaneInfo {
+    Color sideToMove;
+    Square epSquare;
+    Square castlingRook[CASTLING_SIDE_NB]; // SQ_NONE if no right
+    Bitboard castlingPath[CASTLING_SIDE_NB];
+    Bitboard kingPath[CASTLING_SIDE_NB];    // Squares the king crosses, destination included
+  };
+
+public:
+#if defined(USE_AVX512)
+  static const int Lanes = 8;
+#elif defined(USE_AVX2)
+  static const int Lanes = 4;
+#else
+  static const int Lanes = 1;
+#endif
+
+  PositionBatch() : count(0) {}
+
+  void load(const Position* positions, size_t n);
+  size_t size() const { return count; }
+
+  /// legal_bits() writes for each position the policy bitset of its legal
+  /// moves, Policy::MaskWords words in the layout of Policy::legal_bits().
+  /// If 'counts' is given it also gets the number of legal moves of each one.
+  void legal_bits(uint64_t* out, bool stmPerspective = false, int* counts = nullptr) const;
+
+private:
+  const Bitboard* group(size_t g) const { return &bb[g * FIELD_NB * Lanes]; }
+
+  std::vector<Bitboard> bb; // [group][field][lane]
+  std::vector<LaneInfo> info;
+  size_t count;
+};
+
+#endif // #ifndef BATCH_H_INCLUDED
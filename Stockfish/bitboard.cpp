@@ -18,84 +18,480 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <cpuid.h>
+#elif defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
+#if defined(__linux__)
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
 
 #include "bitboard.h"
 #include "misc.h"
 
-uint8_t PopCnt16[1 << 16];
-int SquareDistance[SQUARE_NB][SQUARE_NB];
+namespace {
 
-Bitboard  RookMasks  [SQUARE_NB];
-Bitboard  RookMagics [SQUARE_NB];
-Bitboard* RookAttacks[SQUARE_NB];
-unsigned  RookShifts [SQUARE_NB];
+  // The tables of this file are computed at compile time, so that they are
+  // constant data in the read-only section of the binary, shared by all the
+  // processes running it and ready without any startup work. Only the slider
+  // attack tables are left to Bitboards::init().
+  //
+  // The helpers are C++11 constexpr functions, a single return each, so loops
+  // are written as recursion. A table is built by expanding an index pack.
 
-Bitboard  BishopMasks  [SQUARE_NB];
-Bitboard  BishopMagics [SQUARE_NB];
-Bitboard* BishopAttacks[SQUARE_NB];
-unsigned  BishopShifts [SQUARE_NB];
-
-Bitboard SquareBB[SQUARE_NB];
-Bitboard FileBB[FILE_NB];
-Bitboard RankBB[RANK_NB];
-Bitboard AdjacentFilesBB[FILE_NB];
-Bitboard InFrontBB[COLOR_NB][RANK_NB];
-Bitboard StepAttacksBB[PIECE_NB][SQUARE_NB];
-Bitboard BetweenBB[SQUARE_NB][SQUARE_NB];
-Bitboard LineBB[SQUARE_NB][SQUARE_NB];
-Bitboard DistanceRingBB[SQUARE_NB][8];
-Bitboard ForwardBB[COLOR_NB][SQUARE_NB];
-Bitboard PassedPawnMask[COLOR_NB][SQUARE_NB];
-Bitboard PawnAttackSpan[COLOR_NB][SQUARE_NB];
-Bitboard PseudoAttacks[PIECE_TYPE_NB][SQUARE_NB];
+  template<int... I> struct Seq {};
 
-namespace {
+  template<typename S1, typename S2> struct Concat;
+
+  template<int... I, int... J>
+  struct Concat<Seq<I...>, Seq<J...>> { typedef Seq<I..., int(sizeof...(I)) + J...> type; };
+
+  // MakeSeq<N>::type is Seq<0, 1, ..., N - 1>, built in log(N) nested steps
+  template<int N>
+  struct MakeSeq { typedef typename Concat<typename MakeSeq<N / 2>::type,
+                                           typename MakeSeq<N - N / 2>::type>::type type; };
+
+  template<> struct MakeSeq<0> { typedef Seq<> type; };
+  template<> struct MakeSeq<1> { typedef Seq<0> type; };
+
+  template<typename T, T (*F)(int), int... I>
+  constexpr Array<T, sizeof...(I)> table(Seq<I...>) { return {{ F(I)... }}; }
+
+  template<typename T, T (*F)(int, int), int... J>
+  constexpr Array<T, sizeof...(J)> row(int i, Seq<J...>) { return {{ F(i, J)... }}; }
+
+  template<typename T, int M, T (*F)(int, int), int... I>
+  constexpr Array<Array<T, M>, sizeof...(I)> table2d(Seq<I...>) {
+    return {{ row<T, F>(I, typename MakeSeq<M>::type())... }};
+  }
+
+  template<typename T, int N, T (*F)(int)>
+  constexpr Array<T, N> make_table() { return table<T, F>(typename MakeSeq<N>::type()); }
+
+  template<typename T, int N, int M, T (*F)(int, int)>
+  constexpr Array<Array<T, M>, N> make_table() { return table2d<T, M, F>(typename MakeSeq<N>::type()); }
+
+
+  constexpr int file(int s) { return s & 7; }
+  constexpr int rank(int s) { return s >> 3; }
+  constexpr int absolute(int x) { return x < 0 ? -x : x; }
+  constexpr int max(int x, int y) { return x > y ? x : y; }
+
+  constexpr int popcnt(uint64_t b) { return b ? 1 + popcnt(b & (b - 1)) : 0; }
+
+  // The bitboard of the square on file 'f' and rank 'r', empty if off board
+  constexpr Bitboard bb(int f, int r) {
+    return f >= 0 && f < 8 && r >= 0 && r < 8 ? 1ULL << (8 * r + f) : 0;
+  }
+
+  constexpr int square_distance(int s1, int s2) {
+    return max(absolute(file(s1) - file(s2)), absolute(rank(s1) - rank(s2)));
+  }
+
+  // Sliding attacks from (f, r) along (df, dr), stopping at the first occupied square
+  constexpr Bitboard ray(int f, int r, int df, int dr, Bitboard occupied) {
+    return !bb(f + df, r + dr) ? 0
+          : bb(f + df, r + dr) | (occupied & bb(f + df, r + dr) ? 0 : ray(f + df, r + dr, df, dr, occupied));
+  }
+
+  constexpr Bitboard rook_attacks(int s, Bitboard occupied) {
+    return  ray(file(s), rank(s), 0,  1, occupied) | ray(file(s), rank(s),  1, 0, occupied)
+          | ray(file(s), rank(s), 0, -1, occupied) | ray(file(s), rank(s), -1, 0, occupied);
+  }
+
+  constexpr Bitboard bishop_attacks(int s, Bitboard occupied) {
+    return  ray(file(s), rank(s),  1, 1, occupied) | ray(file(s), rank(s),  1, -1, occupied)
+          | ray(file(s), rank(s), -1, 1, occupied) | ray(file(s), rank(s), -1, -1, occupied);
+  }
+
+  constexpr Bitboard slider_attacks(int pt, int s, Bitboard occupied) {
+    return pt == BISHOP ? bishop_attacks(s, occupied) : pt == ROOK ? rook_attacks(s, occupied) : 0;
+  }
+
+  constexpr Bitboard file_mask(int f) { return FileABB << f; }
+  constexpr Bitboard rank_mask(int r) { return Rank1BB << (8 * r); }
+
+  // Ranks in front of rank 'r' from the point of view of color 'c'
+  constexpr Bitboard in_front(int c, int r) {
+    return c == WHITE ? (r < 7 ? ~0ULL << (8 * (r + 1)) : 0) : (r > 0 ? ~0ULL >> (8 * (8 - r)) : 0);
+  }
+
+  constexpr Bitboard adjacent_files(int f) {
+    return (f > 0 ? file_mask(f - 1) : 0) | (f < 7 ? file_mask(f + 1) : 0);
+  }
+
+  constexpr Bitboard forward(int c, int s) { return in_front(c, rank(s)) & file_mask(file(s)); }
+  constexpr Bitboard attack_span(int c, int s) { return in_front(c, rank(s)) & adjacent_files(file(s)); }
+  constexpr Bitboard passed_mask(int c, int s) { return forward(c, s) | attack_span(c, s); }
+
+  // Pawn, knight and king attacks, for black pieces the pawn attacks go south
+  constexpr Bitboard step_attacks(int pc, int s) {
+    return pc == W_PAWN || pc == B_PAWN
+          ? bb(file(s) - 1, rank(s) + (pc == W_PAWN ? 1 : -1)) | bb(file(s) + 1, rank(s) + (pc == W_PAWN ? 1 : -1))
+          : pc % 8 == KNIGHT
+          ?  bb(file(s) + 1, rank(s) + 2) | bb(file(s) + 2, rank(s) + 1) | bb(file(s) + 2, rank(s) - 1)
+           | bb(file(s) + 1, rank(s) - 2) | bb(file(s) - 1, rank(s) - 2) | bb(file(s) - 2, rank(s) - 1)
+           | bb(file(s) - 2, rank(s) + 1) | bb(file(s) - 1, rank(s) + 2)
+          : pc % 8 == KING
+          ?  bb(file(s) - 1, rank(s) + 1) | bb(file(s), rank(s) + 1) | bb(file(s) + 1, rank(s) + 1)
+           | bb(file(s) - 1, rank(s))                                | bb(file(s) + 1, rank(s))
+           | bb(file(s) - 1, rank(s) - 1) | bb(file(s), rank(s) - 1) | bb(file(s) + 1, rank(s) - 1)
+          : 0;
+  }
+
+  constexpr Bitboard pseudo_attacks(int pt, int s) {
+    return pt == QUEEN ? rook_attacks(s, 0) | bishop_attacks(s, 0) : slider_attacks(pt, s, 0);
+  }
+
+  // The slider, bishop or rook, that joins s1 and s2, if any
+  constexpr int line_type(int s1, int s2) {
+    return s1 == s2 ? 0 : bishop_attacks(s1, 0) & bb(file(s2), rank(s2)) ? BISHOP
+                        : rook_attacks(s1, 0) & bb(file(s2), rank(s2)) ? ROOK : 0;
+  }
+
+  constexpr Bitboard line(int s1, int s2) {
+    return !line_type(s1, s2) ? 0 : (  slider_attacks(line_type(s1, s2), s1, 0)
+                                     & slider_attacks(line_type(s1, s2), s2, 0)) | (1ULL << s1) | (1ULL << s2);
+  }
+
+  constexpr Bitboard between(int s1, int s2) {
+    return !line_type(s1, s2) ? 0 :  slider_attacks(line_type(s1, s2), s1, 1ULL << s2)
+                                   & slider_attacks(line_type(s1, s2), s2, 1ULL << s1);
+  }
+
+  // Squares at distance d + 1 from s, built one square at a time
+  constexpr Bitboard ring(int s, int d, int s2) {
+    return s2 > 63 ? 0 : (square_distance(s, s2) == d + 1 ? 1ULL << s2 : 0) | ring(s, d, s2 + 1);
+  }
+
+  constexpr Bitboard distance_ring(int s, int d) { return ring(s, d, 0); }
+
+  // Board edges are not considered in the relevant occupancies
+  constexpr Bitboard edges(int s) {
+    return ((Rank1BB | Rank8BB) & ~rank_mask(rank(s))) | ((FileABB | FileHBB) & ~file_mask(file(s)));
+  }
+
+  constexpr Bitboard rook_mask(int s) { return rook_attacks(s, 0) & ~edges(s); }
+  constexpr Bitboard bishop_mask(int s) { return bishop_attacks(s, 0) & ~edges(s); }
+  constexpr unsigned rook_shift(int s) { return (Is64Bit ? 64 : 32) - popcnt(rook_mask(s)); }
+  constexpr unsigned bishop_shift(int s) { return (Is64Bit ? 64 : 32) - popcnt(bishop_mask(s)); }
+
+  constexpr Bitboard square_bb(int s) { return 1ULL << s; }
+  constexpr uint8_t popcnt16(int i) { return uint8_t(popcnt(uint64_t(i))); }
 
   // De Bruijn sequences. See chessprogramming.wikispaces.com/BitScan
   const uint64_t DeBruijn64 = 0x3F79D71B4CB0A89ULL;
   const uint32_t DeBruijn32 = 0x783A9B23;
 
-  int MSBTable[256];            // To implement software msb()
-  Square BSFTable[SQUARE_NB];   // To implement software bitscan
+  // bsf_index() returns the index into BSFTable[] to look up the bitscan. Uses
+  // Matt Taylor's folding for 32 bit case, extended to 64 bit by Kim Walisch.
+
+  constexpr unsigned bsf_index(Bitboard b) {
+    return Is64Bit ? ((b ^ (b - 1)) * DeBruijn64) >> 58
+                   : ((unsigned(b ^ (b - 1)) ^ unsigned((b ^ (b - 1)) >> 32)) * DeBruijn32) >> 26;
+  }
+
+  // The square s >= from with bsf_index(s) == i
+  constexpr Square bsf_square(int i, int from = 0) {
+    return from > 63 || bsf_index(1ULL << from) == unsigned(i) ? Square(from) : bsf_square(i, from + 1);
+  }
+
+  constexpr Square bsf_table(int i) { return bsf_square(i); }
+  constexpr int msb8(int b) { return b > 1 ? 1 + msb8(b >> 1) : 0; }
+
+  // Magics found with the PRNG based search Stockfish used before: they are
+  // the very same numbers, so the indices and table sizes do not change.
+  constexpr Bitboard RookMagics64[SQUARE_NB] = {
+    0x0A80004000801220ULL, 0x8040004010002008ULL, 0x2080200010008008ULL, 0x1100100008210004ULL,
+    0xC200209084020008ULL, 0x2100010004000208ULL, 0x0400081000822421ULL, 0x0200010422048844ULL,
+    0x0800800080400024ULL, 0x0001402000401000ULL, 0x3000801000802001ULL, 0x4400800800100083ULL,
+    0x0904802402480080ULL, 0x4040800400020080ULL, 0x0018808042000100ULL, 0x4040800080004100ULL,
+    0x0040048001458024ULL, 0x00A0004000205000ULL, 0x3100808010002000ULL, 0x4825010010000820ULL,
+    0x5004808008000401ULL, 0x2024818004000A00ULL, 0x0005808002000100ULL, 0x2100060004806104ULL,
+    0x0080400880008421ULL, 0x4062220600410280ULL, 0x010A004A00108022ULL, 0x0000100080080080ULL,
+    0x0021000500080010ULL, 0x0044000202001008ULL, 0x0000100400080102ULL, 0xC020128200040545ULL,
+    0x0080002000400040ULL, 0x0000804000802004ULL, 0x0000120022004080ULL, 0x010A386103001001ULL,
+    0x9010080080800400ULL, 0x8440020080800400ULL, 0x0004228824001001ULL, 0x000000490A000084ULL,
+    0x0080002000504000ULL, 0x200020005000C000ULL, 0x0012088020420010ULL, 0x0010010080080800ULL,
+    0x0085001008010004ULL, 0x0002000204008080ULL, 0x0040413002040008ULL, 0x0000304081020004ULL,
+    0x0080204000800080ULL, 0x3008804000290100ULL, 0x1010100080200080ULL, 0x2008100208028080ULL,
+    0x5000850800910100ULL, 0x8402019004680200ULL, 0x0120911028020400ULL, 0x0000008044010200ULL,
+    0x0020850200244012ULL, 0x0020850200244012ULL, 0x0000102001040841ULL, 0x140900040A100021ULL,
+    0x000200282410A102ULL, 0x000200282410A102ULL, 0x000200282410A102ULL, 0x4048240043802106ULL
+  };
+
+  constexpr Bitboard BishopMagics64[SQUARE_NB] = {
+    0x40106000A1160020ULL, 0x0020010250810120ULL, 0x2010010220280081ULL, 0x002806004050C040ULL,
+    0x0002021018000000ULL, 0x2001112010000400ULL, 0x0881010120218080ULL, 0x1030820110010500ULL,
+    0x0000120222042400ULL, 0x2000020404040044ULL, 0x8000480094208000ULL, 0x0003422A02000001ULL,
+    0x000A220210100040ULL, 0x8004820202226000ULL, 0x0018234854100800ULL, 0x0100004042101040ULL,
+    0x0004001004082820ULL, 0x0010000810010048ULL, 0x1014004208081300ULL, 0x2080818802044202ULL,
+    0x0040880C00A00100ULL, 0x0080400200522010ULL, 0x0001000188180B04ULL, 0x0080249202020204ULL,
+    0x1004400004100410ULL, 0x00013100A0022206ULL, 0x2148500001040080ULL, 0x4241080011004300ULL,
+    0x4020848004002000ULL, 0x10101380D1004100ULL, 0x0008004422020284ULL, 0x01010A1041008080ULL,
+    0x0808080400082121ULL, 0x0808080400082121ULL, 0x0091128200100C00ULL, 0x0202200802010104ULL,
+    0x8C0A020200440085ULL, 0x01A0008080B10040ULL, 0x0889520080122800ULL, 0x100902022202010AULL,
+    0x04081A0816002000ULL, 0x0000681208005000ULL, 0x8170840041008802ULL, 0x0A00004200810805ULL,
+    0x0830404408210100ULL, 0x2602208106006102ULL, 0x1048300680802628ULL, 0x2602208106006102ULL,
+    0x0602010120110040ULL, 0x0941010801043000ULL, 0x000040440A210428ULL, 0x0008240020880021ULL,
+    0x0400002012048200ULL, 0x00AC102001210220ULL, 0x0220021002009900ULL, 0x84440C080A013080ULL,
+    0x0001008044200440ULL, 0x0004C04410841000ULL, 0x2000500104011130ULL, 0x1A0C010011C20229ULL,
+    0x0044800112202200ULL, 0x0434804908100424ULL, 0x0300404822C08200ULL, 0x48081010008A2A80ULL
+  };
+
+  constexpr Bitboard RookMagics32[SQUARE_NB] = {
+    0x1100400000808020ULL, 0x1100400000808020ULL, 0x00200A10E0800890ULL, 0x010A00C000800410ULL,
+    0x9080084080810404ULL, 0x04081A0481000201ULL, 0x48600480102008A1ULL, 0x8201228080801249ULL,
+    0x0100500000440204ULL, 0x1020031000200804ULL, 0x2010802000082008ULL, 0x2010802000082008ULL,
+    0x20500806801A0022ULL, 0x20500806801A0022ULL, 0x038421000A008022ULL, 0x0108442002200811ULL,
+    0x8002C02009010202ULL, 0x2041200441100040ULL, 0x2400300100004420ULL, 0x0400090210004042ULL,
+    0x0580100800080102ULL, 0x03100C0020020202ULL, 0x0005020048820101ULL, 0x2491040100000201ULL,
+    0x1080010200424021ULL, 0x3042050080908022ULL, 0x004820802C020212ULL, 0x1010006420000921ULL,
+    0x58CC050008229801ULL, 0x0014400200408901ULL, 0xC008104230680104ULL, 0x0D00048201380041ULL,
+    0x0040105040900823ULL, 0x0040105040900823ULL, 0x0080220600008610ULL, 0x0080502010008289ULL,
+    0x1640040011120008ULL, 0x0080048000A41102ULL, 0x0040010000028C4AULL, 0x0081004000009601ULL,
+    0x0020800000049050ULL, 0x2020200802409009ULL, 0x0184202200080441ULL, 0x0821000800210010ULL,
+    0x0302040201006208ULL, 0x0400402220054302ULL, 0x004020808200E001ULL, 0x0400404030110081ULL,
+    0x0040302000900080ULL, 0x60108080C0086941ULL, 0x041010200C002106ULL, 0x801180800810400AULL,
+    0x041010200C002106ULL, 0x0890C80401002004ULL, 0x11B0201000104082ULL, 0x0180028090800871ULL,
+    0x0280006104304013ULL, 0x00A1405140040221ULL, 0x2011482520086005ULL, 0x0404405290881822ULL,
+    0x12508C220A640482ULL, 0x0818211260000402ULL, 0x0012008104000A85ULL, 0x20009023018000C1ULL
+  };
+
+  constexpr Bitboard BishopMagics32[SQUARE_NB] = {
+    0x31010A0044021521ULL, 0x0080200710301002ULL, 0x4221080080049122ULL, 0x1000124640080581ULL,
+    0x84084410001450C0ULL, 0x900808020A060104ULL, 0x0848401C04C0D808ULL, 0x01100A40C3808528ULL,
+    0x4801304440803027ULL, 0x024081202006901BULL, 0x8606120002000401ULL, 0x0880102091A82404ULL,
+    0x1040002A20030A32ULL, 0x44201A0160021091ULL, 0x1008080104402244ULL, 0x0182203100450909ULL,
+    0x12100C4302280010ULL, 0x9A58410212580017ULL, 0x0142058800102009ULL, 0x0620A00400008104ULL,
+    0x0301148200010002ULL, 0x8900900800204026ULL, 0x0105200108024202ULL, 0x00420A0410804092ULL,
+    0x4802086023601201ULL, 0x1811040840B00600ULL, 0x0900C20004031000ULL, 0x2010201840004400ULL,
+    0x0080805008101440ULL, 0x0080A00C11006100ULL, 0x0424010600114904ULL, 0x0424010600114904ULL,
+    0x1220200802021804ULL, 0x0814040000015102ULL, 0x0006C10180040C04ULL, 0x401880A000000208ULL,
+    0x0812480883820042ULL, 0x0080808025149011ULL, 0x0006C10180040C04ULL, 0x0101C2007000812AULL,
+    0x2402120200880202ULL, 0x0863244230004108ULL, 0x0120820000114108ULL, 0x2090110022400099ULL,
+    0x1410020240000202ULL, 0xB040822001411001ULL, 0x020031000204012AULL, 0x81420500109001C1ULL,
+    0x0828000078040105ULL, 0x0402063624084424ULL, 0x40B0000124240049ULL, 0x504400000C040252ULL,
+    0x020A050102880092ULL, 0x100220000130A004ULL, 0x008108540051302BULL, 0x708028A2008D1044ULL,
+    0x10940401000A0101ULL, 0x0118244024002821ULL, 0x8406062000441221ULL, 0x020A020000030108ULL,
+    0x10020225200102A0ULL, 0x02C6220020400120ULL, 0x080E910800104144ULL, 0x50C200800A982129ULL
+  };
+
+  constexpr Bitboard rook_magic(int s) { return Is64Bit ? RookMagics64[s] : RookMagics32[s]; }
+  constexpr Bitboard bishop_magic(int s) { return Is64Bit ? BishopMagics64[s] : BishopMagics32[s]; }
+
+} // namespace
+
+constexpr Array<uint8_t, 1 << 16> PopCnt16 = make_table<uint8_t, 1 << 16, popcnt16>(); // Software popcount()
+constexpr Array<Array<int, SQUARE_NB>, SQUARE_NB> SquareDistance = make_table<int, SQUARE_NB, SQUARE_NB, square_distance>();
+
+constexpr Array<Bitboard, SQUARE_NB> RookMasks    = make_table<Bitboard, SQUARE_NB, rook_mask>();
+constexpr Array<Bitboard, SQUARE_NB> RookMagics   = make_table<Bitboard, SQUARE_NB, rook_magic>();
+constexpr Array<unsigned, SQUARE_NB> RookShifts   = make_table<unsigned, SQUARE_NB, rook_shift>();
+Bitboard* RookAttacks[SQUARE_NB];
+
+constexpr Array<Bitboard, SQUARE_NB> BishopMasks  = make_table<Bitboard, SQUARE_NB, bishop_mask>();
+constexpr Array<Bitboard, SQUARE_NB> BishopMagics = make_table<Bitboard, SQUARE_NB, bishop_magic>();
+constexpr Array<unsigned, SQUARE_NB> BishopShifts = make_table<unsigned, SQUARE_NB, bishop_shift>();
+Bitboard* BishopAttacks[SQUARE_NB];
+
+uint16_t* RookCompact[SQUARE_NB];
+uint16_t* BishopCompact[SQUARE_NB];
+
+SliderBackend Backend = HasPext ? PEXT_BACKEND : MAGIC_BACKEND;
+
+constexpr Array<Bitboard, SQUARE_NB> SquareBB = make_table<Bitboard, SQUARE_NB, square_bb>();
+constexpr Array<Bitboard, FILE_NB> FileBB = make_table<Bitboard, FILE_NB, file_mask>();
+constexpr Array<Bitboard, RANK_NB> RankBB = make_table<Bitboard, RANK_NB, rank_mask>();
+constexpr Array<Bitboard, FILE_NB> AdjacentFilesBB = make_table<Bitboard, FILE_NB, adjacent_files>();
+constexpr Array<Array<Bitboard, RANK_NB>, COLOR_NB> InFrontBB = make_table<Bitboard, COLOR_NB, RANK_NB, in_front>();
+constexpr Array<Array<Bitboard, SQUARE_NB>, PIECE_NB> StepAttacksBB = make_table<Bitboard, PIECE_NB, SQUARE_NB, step_attacks>();
+constexpr Array<Array<Bitboard, SQUARE_NB>, SQUARE_NB> BetweenBB = make_table<Bitboard, SQUARE_NB, SQUARE_NB, between>();
+constexpr Array<Array<Bitboard, SQUARE_NB>, SQUARE_NB> LineBB = make_table<Bitboard, SQUARE_NB, SQUARE_NB, line>();
+constexpr Array<Array<Bitboard, 8>, SQUARE_NB> DistanceRingBB = make_table<Bitboard, SQUARE_NB, 8, distance_ring>();
+constexpr Array<Array<Bitboard, SQUARE_NB>, COLOR_NB> ForwardBB = make_table<Bitboard, COLOR_NB, SQUARE_NB, forward>();
+constexpr Array<Array<Bitboard, SQUARE_NB>, COLOR_NB> PassedPawnMask = make_table<Bitboard, COLOR_NB, SQUARE_NB, passed_mask>();
+constexpr Array<Array<Bitboard, SQUARE_NB>, COLOR_NB> PawnAttackSpan = make_table<Bitboard, COLOR_NB, SQUARE_NB, attack_span>();
+constexpr Array<Array<Bitboard, SQUARE_NB>, PIECE_TYPE_NB> PseudoAttacks = make_table<Bitboard, PIECE_TYPE_NB, SQUARE_NB, pseudo_attacks>();
+
+namespace {
+
+  constexpr Array<int, 256> MSBTable = make_table<int, 256, msb8>();             // To implement software msb()
+  constexpr Array<Square, SQUARE_NB> BSFTable = make_table<Square, SQUARE_NB, bsf_table>(); // To implement software bitscan
+
+  // The CPU supports BMI2, hence PEXT
+  bool cpu_has_bmi2() {
+
+    unsigned regs[4] = { 0 };
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__get_cpuid_max(0, nullptr) >= 7)
+        __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        regs[1] = unsigned(info[1]);
+    }
+#endif
+
+    return regs[1] & (1 << 8);
+  }
+
+  // The CPU implements PEXT in microcode: AMD before Zen 3, that is before
+  // family 19h, where it takes up to hundreds of cycles.
+  bool cpu_slow_pext() {
+
+    unsigned regs[4] = { 0 };
+    char vendor[13] = { 0 };
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __get_cpuid(0, &regs[0], &regs[1], &regs[2], &regs[3]);
+    std::memcpy(vendor, &regs[1], 4), std::memcpy(vendor + 4, &regs[3], 4), std::memcpy(vendor + 8, &regs[2], 4);
+    __get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    std::memcpy(vendor, &info[1], 4), std::memcpy(vendor + 4, &info[3], 4), std::memcpy(vendor + 8, &info[2], 4);
+    __cpuid(info, 1);
+    regs[0] = unsigned(info[0]);
+#endif
+
+    unsigned family = ((regs[0] >> 8) & 0xF) + ((regs[0] >> 20) & 0xFF);
+
+    return !std::strcmp(vendor, "AuthenticAMD") && family < 0x19;
+  }
+
+  // MissCounter counts the cache misses of the calling thread between start()
+  // and stop() with the Linux hardware performance counters. stop() returns -1
+  // if they are not available, as on other systems or in most containers.
+  enum MissEvent { L1_MISSES, LL_MISSES };
+
+  struct MissCounter {
+
+    explicit MissCounter(MissEvent e) : fd(-1) {
+#if defined(__linux__)
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      if (e == L1_MISSES)
+          attr.type = PERF_TYPE_HW_CACHE,
+          attr.config = PERF_COUNT_HW_CACHE_L1D
+                      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      else
+          attr.type = PERF_TYPE_HARDWARE,
+          attr.config = PERF_COUNT_HW_CACHE_MISSES;
+
+      fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+      (void)e;
+#endif
+    }
+
+    ~MissCounter() {
+#if defined(__linux__)
+      if (fd >= 0)
+          close(fd);
+#endif
+    }
+
+    bool ok() const { return fd >= 0; }
+
+    void start() {
+#if defined(__linux__)
+      if (fd >= 0)
+      {
+          ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+          ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif
+    }
+
+    int64_t stop() {
+      int64_t count = -1;
+#if defined(__linux__)
+      if (fd >= 0)
+      {
+          ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+          if (read(fd, &count, sizeof(count)) != sizeof(count))
+              count = -1;
+      }
+#endif
+      return count;
+    }
+
+  private:
+    int fd;
+  };
+
   Bitboard RookTable[0x19000];  // To store rook attacks
   Bitboard BishopTable[0x1480]; // To store bishop attacks
 
-  typedef unsigned (Fn)(Square, Bitboard);
+  uint16_t RookCompactTable[0x19000];  // Compact rook attacks, 16 bits each
+  uint16_t BishopCompactTable[0x1480]; // Compact bishop attacks, 16 bits each
 
-  void init_magics(Bitboard table[], Bitboard* attacks[], Bitboard magics[],
-                   Bitboard masks[], unsigned shifts[], Square deltas[], Fn index);
+  // init_attacks() fills the attack table of a slider in the index order of
+  // the current backend: with the fixed magics above or in pext order. As a
+  // reference see chessprogramming.wikispaces.com/Magic+Bitboards. In
+  // particular, here we use the so called "fancy" approach: each square gets
+  // a table of its own size, 2 to the power of the number of relevant
+  // occupancy bits. Compact tables store instead the attacks pext'ed by the
+  // pseudo attacks, at most 14 squares, and so have 16 bit entries.
 
-  // bsf_index() returns the index into BSFTable[] to look up the bitscan. Uses
-  // Matt Taylor's folding for 32 bit case, extended to 64 bit by Kim Walisch.
+  template<PieceType Pt, typename T>
+  void init_attacks(T table[], T* attacks[]) {
 
-  unsigned bsf_index(Bitboard b) {
-    b ^= b - 1;
-    return Is64Bit ? (b * DeBruijn64) >> 58
-                   : ((unsigned(b) ^ unsigned(b >> 32)) * DeBruijn32) >> 26;
-  }
+    const Array<Bitboard, SQUARE_NB>& masks = Pt == ROOK ? RookMasks : BishopMasks;
+
+    // attacks[s] is a pointer to the beginning of the attacks table for square 's'
+    attacks[SQ_A1] = table;
 
+    for (Square s = SQ_A1; s <= SQ_H8; ++s)
+    {
+        // Use Carry-Rippler trick to enumerate all subsets of masks[s] and
+        // store the corresponding sliding attack bitboard.
+        Bitboard b = 0;
+        int size = 0;
 
-  // popcount16() counts the non-zero bits using SWAR-Popcount algorithm
+        do {
+            Bitboard a = slider_attacks(Pt, s, b);
+            attacks[s][magic_index<Pt>(s, b)] = T(sizeof(T) < sizeof(Bitboard) ? pext_bmi2(a, PseudoAttacks[Pt][s]) : a);
+            size++;
+            b = (b - masks[s]) & masks[s];
+        } while (b);
 
-  unsigned popcount16(unsigned u) {
-    u -= (u >> 1) & 0x5555U;
-    u = ((u >> 2) & 0x3333U) + (u & 0x3333U);
-    u = ((u >> 4) + u) & 0x0F0FU;
-    return (u * 0x0101U) >> 8;
+        if (s < SQ_H8)
+            attacks[s + 1] = attacks[s] + size;
+    }
   }
 }
 
-#ifdef NO_BSF
-
 /// Software fall-back of lsb() and msb() for CPU lacking hardware support
 
-Square lsb(Bitboard b) {
+Square soft_lsb(Bitboard b) {
   assert(b);
   return BSFTable[bsf_index(b)];
 }
 
-Square msb(Bitboard b) {
+Square soft_msb(Bitboard b) {
 
   assert(b);
   unsigned b32;
@@ -124,8 +520,6 @@ Square msb(Bitboard b) {
   return Square(result + MSBTable[b32]);
 }
 
-#endif // ifdef NO_BSF
-
 
 /// Bitboards::pretty() returns an ASCII representation of a bitboard suitable
 /// to be printed to standard output. Useful for debugging.
@@ -146,188 +540,210 @@ const std::string Bitboards::pretty(Bitboard b) {
 }
 
 
-/// Bitboards::init() initializes various bitboard tables. It is called at
-/// startup and relies on global objects to be already zero-initialized.
+/// Bitboards::init() selects the slider backend and fills the slider attack
+/// tables, the only ones that are not computed at compile time. It is called
+/// at startup.
 
 void Bitboards::init() {
 
-  for (unsigned i = 0; i < (1 << 16); ++i)
-      PopCnt16[i] = (uint8_t) popcount16(i);
+  set_backend(best_backend());
+}
+
+
+/// Bitboards::backend_supported() tells whether the build and the CPU allow
+/// the given backend.
+
+bool Bitboards::backend_supported(SliderBackend b) {
 
-  for (Square s = SQ_A1; s <= SQ_H8; ++s)
+  switch (b)
   {
-      SquareBB[s] = 1ULL << s;
-      BSFTable[bsf_index(SquareBB[s])] = s;
+  case MAGIC_BACKEND  : return !HasPext;
+  case PEXT_BACKEND   :
+  case COMPACT_BACKEND: return HasPext || (HasPextDispatch && cpu_has_bmi2());
+  default             : return false;
   }
+}
 
-  for (Bitboard b = 2; b < 256; ++b)
-      MSBTable[b] = MSBTable[b - 1] + !more_than_one(b);
 
-  for (File f = FILE_A; f <= FILE_H; ++f)
-      FileBB[f] = f > FILE_A ? FileBB[f - 1] << 1 : FileABB;
+/// Bitboards::best_backend() returns the fastest backend expected on this CPU,
+/// or the compact one if asked for at compile time and supported.
 
-  for (Rank r = RANK_1; r <= RANK_8; ++r)
-      RankBB[r] = r > RANK_1 ? RankBB[r - 1] << 8 : Rank1BB;
+SliderBackend Bitboards::best_backend() {
 
-  for (File f = FILE_A; f <= FILE_H; ++f)
-      AdjacentFilesBB[f] = (f > FILE_A ? FileBB[f - 1] : 0) | (f < FILE_H ? FileBB[f + 1] : 0);
+#ifdef USE_COMPACT_ATTACKS
+  if (backend_supported(COMPACT_BACKEND))
+      return COMPACT_BACKEND;
+#endif
 
-  for (Rank r = RANK_1; r < RANK_8; ++r)
-      InFrontBB[WHITE][r] = ~(InFrontBB[BLACK][r + 1] = InFrontBB[BLACK][r] | RankBB[r]);
+  return HasPext || (backend_supported(PEXT_BACKEND) && !cpu_slow_pext()) ? PEXT_BACKEND : MAGIC_BACKEND;
+}
 
-  for (Color c = WHITE; c <= BLACK; ++c)
-      for (Square s = SQ_A1; s <= SQ_H8; ++s)
-      {
-          ForwardBB[c][s]      = InFrontBB[c][rank_of(s)] & FileBB[file_of(s)];
-          PawnAttackSpan[c][s] = InFrontBB[c][rank_of(s)] & AdjacentFilesBB[file_of(s)];
-          PassedPawnMask[c][s] = ForwardBB[c][s] | PawnAttackSpan[c][s];
-      }
 
-  for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
-      for (Square s2 = SQ_A1; s2 <= SQ_H8; ++s2)
-          if (s1 != s2)
-          {
-              SquareDistance[s1][s2] = std::max(distance<File>(s1, s2), distance<Rank>(s1, s2));
-              DistanceRingBB[s1][SquareDistance[s1][s2] - 1] |= s2;
-          }
+/// Bitboards::set_backend() switches to the given backend and refills the
+/// attack tables in its order. The tables must not be in use by any thread.
+/// Returns false, leaving everything untouched, if the backend is not
+/// supported.
 
-  int steps[][9] = { {}, { 7, 9 }, { 17, 15, 10, 6, -6, -10, -15, -17 },
-                     {}, {}, {}, { 9, 7, -7, -9, 8, 1, -1, -8 } };
+bool Bitboards::set_backend(SliderBackend b) {
 
-  for (Color c = WHITE; c <= BLACK; ++c)
-      for (PieceType pt = PAWN; pt <= KING; ++pt)
-          for (Square s = SQ_A1; s <= SQ_H8; ++s)
-              for (int i = 0; steps[pt][i]; ++i)
-              {
-                  Square to = s + Square(c == WHITE ? steps[pt][i] : -steps[pt][i]);
+  if (!backend_supported(b))
+      return false;
 
-                  if (is_ok(to) && distance(s, to) < 3)
-                      StepAttacksBB[make_piece(c, pt)][s] |= to;
-              }
+  Backend = b;
 
-  Square RookDeltas[] = { NORTH,  EAST,  SOUTH,  WEST  };
-  Square BishopDeltas[] = { NORTH_EAST, SOUTH_EAST, SOUTH_WEST, NORTH_WEST };
+  if (b == COMPACT_BACKEND)
+  {
+      init_attacks<ROOK>(RookCompactTable, RookCompact);
+      init_attacks<BISHOP>(BishopCompactTable, BishopCompact);
+  }
+  else
+  {
+      init_attacks<ROOK>(RookTable, RookAttacks);
+      init_attacks<BISHOP>(BishopTable, BishopAttacks);
+  }
 
-  init_magics(RookTable, RookAttacks, RookMagics, RookMasks, RookShifts, RookDeltas, magic_index<ROOK>);
-  init_magics(BishopTable, BishopAttacks, BishopMagics, BishopMasks, BishopShifts, BishopDeltas, magic_index<BISHOP>);
+  return true;
+}
 
-  for (Square s1 = SQ_A1; s1 <= SQ_H8; ++s1)
-  {
-      PseudoAttacks[QUEEN][s1]  = PseudoAttacks[BISHOP][s1] = attacks_bb<BISHOP>(s1, 0);
-      PseudoAttacks[QUEEN][s1] |= PseudoAttacks[  ROOK][s1] = attacks_bb<  ROOK>(s1, 0);
 
-      for (Piece pc = W_BISHOP; pc <= W_ROOK; ++pc)
-          for (Square s2 = SQ_A1; s2 <= SQ_H8; ++s2)
-          {
-              if (!(PseudoAttacks[pc][s1] & s2))
-                  continue;
+const char* Bitboards::backend_name(SliderBackend b) {
 
-              LineBB[s1][s2] = (attacks_bb(pc, s1, 0) & attacks_bb(pc, s2, 0)) | s1 | s2;
-              BetweenBB[s1][s2] = attacks_bb(pc, s1, SquareBB[s2]) & attacks_bb(pc, s2, SquareBB[s1]);
-          }
-  }
+  return b == MAGIC_BACKEND   ? "magic"
+       : b == PEXT_BACKEND    ? "pext"
+       : b == COMPACT_BACKEND ? "compact" : "none";
 }
 
 
-namespace {
+/// Bitboards::self_test() checks attacks_bb() of the current backend against
+/// the reference computation for every relevant occupancy of every square,
+/// each time with some random occupancy outside of the relevant squares.
 
-  Bitboard sliding_attack(Square deltas[], Square sq, Bitboard occupied) {
+bool Bitboards::self_test() {
 
-    Bitboard attack = 0;
+  PRNG rng(0x9E3779B97F4A7C15ULL);
 
-    for (int i = 0; i < 4; ++i)
-        for (Square s = sq + deltas[i];
-             is_ok(s) && distance(s, s - deltas[i]) == 1;
-             s += deltas[i])
-        {
-            attack |= s;
+  for (PieceType pt = BISHOP; pt <= ROOK; ++pt)
+      for (Square s = SQ_A1; s <= SQ_H8; ++s)
+      {
+          Bitboard mask = pt == ROOK ? RookMasks[s] : BishopMasks[s];
+          Bitboard b = 0;
 
-            if (occupied & s)
-                break;
-        }
+          do {
+              Bitboard occupied = b | (rng.rand<Bitboard>() & ~mask);
 
-    return attack;
-  }
+              if (attacks_bb(make_piece(WHITE, pt), s, occupied) != slider_attacks(pt, s, b))
+                  return false;
 
+              b = (b - mask) & mask;
+          } while (b);
+      }
 
-  // init_magics() computes all rook and bishop attacks at startup. Magic
-  // bitboards are used to look up attacks of sliding pieces. As a reference see
-  // chessprogramming.wikispaces.com/Magic+Bitboards. In particular, here we
-  // use the so called "fancy" approach.
+  return true;
+}
 
-  void init_magics(Bitboard table[], Bitboard* attacks[], Bitboard magics[],
-                   Bitboard masks[], unsigned shifts[], Square deltas[], Fn index) {
 
-    int seeds[][RANK_NB] = { { 8977, 44560, 54343, 38998,  5731, 95205, 104912, 17020 },
-                             {  728, 10316, 55013, 32803, 12281, 15100,  16645,   255 } };
+/// Bitboards::bench_backends() runs the self test and times the lookups of
+/// each backend supported here, then goes back to the best backend. Lookups
+/// are timed alone, where the tables of all backends fit in L2, and then
+/// interleaved with a walk over a buffer much larger than L2, as the nodes
+/// of a search tree would do. Where the kernel gives access to the hardware
+/// counters, the L1 and last level cache misses per lookup are reported as
+/// well, net of the ones of the walk alone. Returns false if any self test
+/// failed.
 
-    Bitboard occupancy[4096], reference[4096], edges, b;
-    int age[4096] = {0}, current = 0, i, size;
+bool Bitboards::bench_backends() {
 
-    // attacks[s] is a pointer to the beginning of the attacks table for square 's'
-    attacks[SQ_A1] = table;
+  const int Lookups = 1 << 22;
+  const size_t PressureSize = 4 << 20;
+  std::vector<Bitboard> occupancies(4096);
+  std::vector<char> pressure(PressureSize);
+  PRNG rng(1070372);
 
-    for (Square s = SQ_A1; s <= SQ_H8; ++s)
-    {
-        // Board edges are not considered in the relevant occupancies
-        edges = ((Rank1BB | Rank8BB) & ~rank_bb(s)) | ((FileABB | FileHBB) & ~file_bb(s));
+  // Random occupancies of about a quarter of the board, as in middlegames
+  for (Bitboard& b : occupancies)
+      b = rng.rand<Bitboard>() & rng.rand<Bitboard>();
 
-        // Given a square 's', the mask is the bitboard of sliding attacks from
-        // 's' computed on an empty board. The index must be big enough to contain
-        // all the attacks for each possible subset of the mask and so is 2 power
-        // the number of 1s of the mask. Hence we deduce the size of the shift to
-        // apply to the 64 or 32 bits word to get the index.
-        masks[s]  = sliding_attack(deltas, s, 0) & ~edges;
-        shifts[s] = (Is64Bit ? 64 : 32) - popcount(masks[s]);
+  bool allOk = true;
 
-        // Use Carry-Rippler trick to enumerate all subsets of masks[s] and
-        // store the corresponding sliding attack bitboard in reference[].
-        b = size = 0;
-        do {
-            occupancy[size] = b;
-            reference[size] = sliding_attack(deltas, s, b);
+  std::cout << "Best backend on this CPU: " << backend_name(best_backend())
+            << "\nTables: " << sizeof(RookTable) + sizeof(BishopTable) << " bytes, compact "
+            << sizeof(RookCompactTable) + sizeof(BishopCompactTable) << " bytes"
+            << "\nCache misses per lookup: " << (MissCounter(L1_MISSES).ok() ? "L1 / last level" : "not available")
+            << std::endl;
 
-            if (HasPext)
-                attacks[s][pext(b, masks[s])] = reference[size];
+  // Measures ns/lookup and misses/lookup of 'Lookups' pairs of lookups, each
+  // one depending on the previous one as in move generation. Every 8 lookups
+  // 'stride' bytes of the pressure buffer are touched, no lookups at all if
+  // 'lookups' is false.
+  auto run = [&](bool lookups, size_t stride, Bitboard& sum, double* result) {
 
-            size++;
-            b = (b - masks[s]) & masks[s];
-        } while (b);
+      MissCounter l1(L1_MISSES), ll(LL_MISSES);
+      size_t p = 0;
 
-        // Set the offset for the table of the next square. We have individual
-        // table sizes for each square with "Fancy Magic Bitboards".
-        if (s < SQ_H8)
-            attacks[s + 1] = attacks[s] + size;
+      auto start = std::chrono::steady_clock::now();
+      l1.start(), ll.start();
+
+      for (int n = 0; n < Lookups; ++n)
+      {
+          if (lookups)
+          {
+              Square s = Square(n & 63);
+              Bitboard occupied = occupancies[(n >> 6) & 4095] ^ (sum & 0xFF);
+              sum += attacks_bb<ROOK>(s, occupied) + attacks_bb<BISHOP>(s, occupied);
+          }
 
-        if (HasPext)
-            continue;
+          if (stride && !(n & 7))
+          {
+              for (size_t i = 0; i < stride; i += 64)
+                  pressure[p + i]++;
 
-        PRNG rng(seeds[Is64Bit][rank_of(s)]);
+              p = (p + stride) % PressureSize;
+          }
+      }
 
-        // Find a magic for square 's' picking up an (almost) random number
-        // until we find the one that passes the verification test.
-        do {
-            do
-                magics[s] = rng.sparse_rand<Bitboard>();
-            while (popcount((magics[s] * masks[s]) >> 56) < 6);
-
-            // A good magic must map every possible occupancy to an index that
-            // looks up the correct sliding attack in the attacks[s] database.
-            // Note that we build up the database for square 's' as a side
-            // effect of verifying the magic.
-            for (++current, i = 0; i < size; ++i)
-            {
-                unsigned idx = index(s, occupancy[i]);
-
-                if (age[idx] < current)
-                {
-                    age[idx] = current;
-                    attacks[s][idx] = reference[i];
-                }
-                else if (attacks[s][idx] != reference[i])
-                    break;
-            }
-        } while (i < size);
-    }
+      result[1] = double(l1.stop()) / (2.0 * Lookups);
+      result[2] = double(ll.stop()) / (2.0 * Lookups);
+      result[0] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (2.0 * Lookups);
+  };
+
+  Bitboard sum = 0;
+  double base[3];
+  run(false, 256, sum, base);
+
+  for (int i = 0; i < SLIDER_BACKEND_NB; ++i)
+  {
+      SliderBackend b = SliderBackend(i);
+
+      std::cout << std::setw(8) << backend_name(b) << ": ";
+
+      if (!set_backend(b))
+      {
+          std::cout << "not supported" << std::endl;
+          continue;
+      }
+
+      bool ok = self_test();
+      allOk &= ok;
+      sum = 0;
+
+      double alone[3], loaded[3];
+      run(true, 0, sum, alone);
+      run(true, 256, sum, loaded);
+
+      std::cout << (ok ? "self test ok" : "self test FAILED") << std::fixed << std::setprecision(2)
+                << "  alone " << alone[0] << " ns/lookup";
+
+      if (alone[1] >= 0)
+          std::cout << " " << std::setprecision(3) << alone[1] << " / " << alone[2];
+
+      std::cout << std::setprecision(2) << "  under L2 pressure " << loaded[0] - base[0] << " ns/lookup";
+
+      if (loaded[1] >= 0)
+          std::cout << " " << std::setprecision(3) << loaded[1] - base[1] << " / " << loaded[2] - base[2];
+
+      std::cout << "  (checksum " << std::hex << sum << std::dec << ")" << std::endl;
   }
+
+  set_backend(best_backend());
+  return allOk;
 }
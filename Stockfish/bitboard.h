@@ -23,13 +23,80 @@
 
 #include <string>
 
+#include "instrument.h"
 #include "types.h"
 
+/// SliderBackend is the layout of the slider attack tables. Unless USE_PEXT
+/// fixes it at compile time, Bitboards::init() picks one at startup from the
+/// CPU: PEXT where it is fast, magics elsewhere, e.g. on AMD before Zen 3,
+/// where PEXT is microcoded and much slower than a multiply. COMPACT_BACKEND
+/// indexes with PEXT too, but stores each attack set as 16 bits, its squares
+/// within PseudoAttacks[], and expands them with PDEP: 210 KB of tables
+/// instead of 840 KB, which leaves more of L2 to the rest of the program.
+/// It is used by default if USE_COMPACT_ATTACKS is defined.
+enum SliderBackend {
+  MAGIC_BACKEND, PEXT_BACKEND, COMPACT_BACKEND, SLIDER_BACKEND_NB
+};
+
 namespace Bitboards {
 
 void init();
 const std::string pretty(Bitboard b);
 
+SliderBackend best_backend();
+bool backend_supported(SliderBackend b);
+bool set_backend(SliderBackend b);
+const char* backend_name(SliderBackend b);
+bool self_test();
+bool bench_backends();
+
+}
+
+extern SliderBackend Backend;
+
+/// Builds that do not fix the backend with USE_PEXT can still emit pext and
+/// pdep: gcc through inline assembly, which needs no -mbmi2, and MSVC through
+/// its intrinsics, which need no special switch either. PEXT_DISPATCH may
+/// also be set on the command line.
+#if   !defined(PEXT_DISPATCH) && !defined(USE_PEXT) \
+    && ((defined(__GNUC__) && defined(__x86_64__)) || (defined(_MSC_VER) && defined(_WIN64)))
+#  define PEXT_DISPATCH
+#endif
+
+#if defined(PEXT_DISPATCH) && defined(_MSC_VER)
+#  include <immintrin.h> // Header for _pext_u64() and _pdep_u64() intrinsics
+#endif
+
+#ifdef PEXT_DISPATCH
+const bool HasPextDispatch = true;
+#else
+const bool HasPextDispatch = false;
+#endif
+
+/// pext_bmi2() and pdep_bmi2() are for the backends based on BMI2. They are
+/// only called when one of them is selected, that is when the CPU has BMI2.
+inline Bitboard pext_bmi2(Bitboard b, Bitboard m) {
+
+#if defined(USE_PEXT) || (defined(PEXT_DISPATCH) && defined(_MSC_VER))
+  return _pext_u64(b, m);
+#elif defined(PEXT_DISPATCH)
+  __asm__("pextq %2, %1, %0" : "=r" (b) : "r" (b), "r" (m));
+  return b;
+#else
+  return b & m & 0; // Never called
+#endif
+}
+
+inline Bitboard pdep_bmi2(Bitboard b, Bitboard m) {
+
+#if defined(USE_PEXT) || (defined(PEXT_DISPATCH) && defined(_MSC_VER))
+  return _pdep_u64(b, m);
+#elif defined(PEXT_DISPATCH)
+  __asm__("pdepq %2, %1, %0" : "=r" (b) : "r" (b), "r" (m));
+  return b;
+#else
+  return b & m & 0; // Never called
+#endif
 }
 
 const Bitboard DarkSquares = 0xAA55AA55AA55AA55ULL;
@@ -52,21 +119,29 @@ const Bitboard Rank6BB = Rank1BB << (8 * 5);
 const Bitboard Rank7BB = Rank1BB << (8 * 6);
 const Bitboard Rank8BB = Rank1BB << (8 * 7);
 
-extern int SquareDistance[SQUARE_NB][SQUARE_NB];
-
-extern Bitboard SquareBB[SQUARE_NB];
-extern Bitboard FileBB[FILE_NB];
-extern Bitboard RankBB[RANK_NB];
-extern Bitboard AdjacentFilesBB[FILE_NB];
-extern Bitboard InFrontBB[COLOR_NB][RANK_NB];
-extern Bitboard StepAttacksBB[PIECE_NB][SQUARE_NB];
-extern Bitboard BetweenBB[SQUARE_NB][SQUARE_NB];
-extern Bitboard LineBB[SQUARE_NB][SQUARE_NB];
-extern Bitboard DistanceRingBB[SQUARE_NB][8];
-extern Bitboard ForwardBB[COLOR_NB][SQUARE_NB];
-extern Bitboard PassedPawnMask[COLOR_NB][SQUARE_NB];
-extern Bitboard PawnAttackSpan[COLOR_NB][SQUARE_NB];
-extern Bitboard PseudoAttacks[PIECE_TYPE_NB][SQUARE_NB];
+/// Array is a plain array wrapped in a struct, so that a constexpr function
+/// can return it. The tables below are built this way at compile time.
+template<typename T, int N>
+struct Array {
+  constexpr const T& operator[](int i) const { return v[i]; }
+  T v[N];
+};
+
+extern const Array<Array<int, SQUARE_NB>, SQUARE_NB> SquareDistance;
+
+extern const Array<Bitboard, SQUARE_NB> SquareBB;
+extern const Array<Bitboard, FILE_NB> FileBB;
+extern const Array<Bitboard, RANK_NB> RankBB;
+extern const Array<Bitboard, FILE_NB> AdjacentFilesBB;
+extern const Array<Array<Bitboard, RANK_NB>, COLOR_NB> InFrontBB;
+extern const Array<Array<Bitboard, SQUARE_NB>, PIECE_NB> StepAttacksBB;
+extern const Array<Array<Bitboard, SQUARE_NB>, SQUARE_NB> BetweenBB;
+extern const Array<Array<Bitboard, SQUARE_NB>, SQUARE_NB> LineBB;
+extern const Array<Array<Bitboard, 8>, SQUARE_NB> DistanceRingBB;
+extern const Array<Array<Bitboard, SQUARE_NB>, COLOR_NB> ForwardBB;
+extern const Array<Array<Bitboard, SQUARE_NB>, COLOR_NB> PassedPawnMask;
+extern const Array<Array<Bitboard, SQUARE_NB>, COLOR_NB> PawnAttackSpan;
+extern const Array<Array<Bitboard, SQUARE_NB>, PIECE_TYPE_NB> PseudoAttacks;
 
 
 /// Overloads of bitwise operators between a Bitboard and a Square for testing
@@ -204,24 +279,28 @@ template<> inline int distance<Rank>(Square x, Square y) { return distance(rank_
 
 /// attacks_bb() returns a bitboard representing all the squares attacked by a
 /// piece of type Pt (bishop or rook) placed on 's'. The helper magic_index()
-/// looks up the index using the 'magic bitboards' approach.
+/// looks up the index using the 'magic bitboards' approach, or PEXT, which
+/// gives the same per square table sizes.
 template<PieceType Pt>
 inline unsigned magic_index(Square s, Bitboard occupied) {
 
-  extern Bitboard RookMasks[SQUARE_NB];
-  extern Bitboard RookMagics[SQUARE_NB];
-  extern unsigned RookShifts[SQUARE_NB];
-  extern Bitboard BishopMasks[SQUARE_NB];
-  extern Bitboard BishopMagics[SQUARE_NB];
-  extern unsigned BishopShifts[SQUARE_NB];
+  extern const Array<Bitboard, SQUARE_NB> RookMasks;
+  extern const Array<Bitboard, SQUARE_NB> RookMagics;
+  extern const Array<unsigned, SQUARE_NB> RookShifts;
+  extern const Array<Bitboard, SQUARE_NB> BishopMasks;
+  extern const Array<Bitboard, SQUARE_NB> BishopMagics;
+  extern const Array<unsigned, SQUARE_NB> BishopShifts;
 
-  Bitboard* const Masks  = Pt == ROOK ? RookMasks  : BishopMasks;
-  Bitboard* const Magics = Pt == ROOK ? RookMagics : BishopMagics;
-  unsigned* const Shifts = Pt == ROOK ? RookShifts : BishopShifts;
+  const Array<Bitboard, SQUARE_NB>& Masks  = Pt == ROOK ? RookMasks  : BishopMasks;
+  const Array<Bitboard, SQUARE_NB>& Magics = Pt == ROOK ? RookMagics : BishopMagics;
+  const Array<unsigned, SQUARE_NB>& Shifts = Pt == ROOK ? RookShifts : BishopShifts;
 
   if (HasPext)
       return unsigned(pext(occupied, Masks[s]));
 
+  if (HasPextDispatch && Backend != MAGIC_BACKEND)
+      return unsigned(pext_bmi2(occupied, Masks[s]));
+
   if (Is64Bit)
       return unsigned(((occupied & Masks[s]) * Magics[s]) >> Shifts[s]);
 
@@ -235,6 +314,14 @@ inline Bitboard attacks_bb(Square s, Bitboard occupied) {
 
   extern Bitboard* RookAttacks[SQUARE_NB];
   extern Bitboard* BishopAttacks[SQUARE_NB];
+  extern uint16_t* RookCompact[SQUARE_NB];
+  extern uint16_t* BishopCompact[SQUARE_NB];
+
+  Instrument::count(Instrument::SLIDER_LOOKUPS);
+
+  if ((HasPext || HasPextDispatch) && Backend == COMPACT_BACKEND)
+      return pdep_bmi2((Pt == ROOK ? RookCompact : BishopCompact)[s][magic_index<Pt>(s, occupied)],
+                       PseudoAttacks[Pt][s]);
 
   return (Pt == ROOK ? RookAttacks : BishopAttacks)[s][magic_index<Pt>(s, occupied)];
 }
@@ -251,15 +338,76 @@ inline Bitboard attacks_bb(Piece pc, Square s, Bitboard occupied) {
 }
 
 
-/// popcount() counts the number of non-zero bits in a bitboard
+/// flip() mirrors a bitboard vertically (a1 <-> a8), which in the little
+/// endian square layout is just a byte swap.
 
-inline int popcount(Bitboard b) {
+inline Bitboard flip(Bitboard b) {
+
+#if defined(__GNUC__)
+  return __builtin_bswap64(b);
+#elif defined(_MSC_VER)
+  return _byteswap_uint64(b);
+#else
+  b = ((b >>  8) & 0x00FF00FF00FF00FFULL) | ((b & 0x00FF00FF00FF00FFULL) <<  8);
+  b = ((b >> 16) & 0x0000FFFF0000FFFFULL) | ((b & 0x0000FFFF0000FFFFULL) << 16);
+  return (b >> 32) | (b << 32);
+#endif
+}
+
+
+
+/// mirror() mirrors a bitboard horizontally (a1 <-> h1) by reversing the bits
+/// of each byte, swapping adjacent bits, then bit pairs, then nibbles.
+
+inline Bitboard mirror(Bitboard b) {
+
+  b = ((b >> 1) & 0x5555555555555555ULL) | ((b & 0x5555555555555555ULL) << 1);
+  b = ((b >> 2) & 0x3333333333333333ULL) | ((b & 0x3333333333333333ULL) << 2);
+  return ((b >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((b & 0x0F0F0F0F0F0F0F0FULL) << 4);
+}
+
+
+/// transpose() reflects a bitboard in the a1-h8 diagonal (a8 <-> h1), swapping
+/// the off-diagonal 4x4 quadrants, then 2x2 blocks, then single squares.
+
+inline Bitboard transpose(Bitboard b) {
+
+  Bitboard t;
+  t = 0x0F0F0F0F00000000ULL & (b ^ (b << 28)); b ^= t ^ (t >> 28);
+  t = 0x3333000033330000ULL & (b ^ (b << 14)); b ^= t ^ (t >> 14);
+  t = 0x5500550055005500ULL & (b ^ (b <<  7)); b ^= t ^ (t >>  7);
+  return b;
+}
 
-#ifndef USE_POPCNT
 
-  extern uint8_t PopCnt16[1 << 16];
+/// transform() applies the geometric part of a Symmetry to a bitboard
+
+inline Bitboard transform(Bitboard b, Symmetry sym) {
+
+  if (sym & TRANSPOSE)
+      b = transpose(b);
+
+  if (sym & MIRROR)
+      b = mirror(b);
+
+  return sym & FLIP ? flip(b) : b;
+}
+/// popcount() counts the number of non-zero bits in a bitboard. Without
+/// USE_POPCNT it falls back on soft_popcount(), a lookup of each 16 bit word,
+/// which is available in every build so that both can be benchmarked.
+
+inline int soft_popcount(Bitboard b) {
+
+  extern const Array<uint8_t, 1 << 16> PopCnt16;
   union { Bitboard bb; uint16_t u[4]; } v = { b };
   return PopCnt16[v.u[0]] + PopCnt16[v.u[1]] + PopCnt16[v.u[2]] + PopCnt16[v.u[3]];
+}
+
+inline int popcount(Bitboard b) {
+
+#ifndef USE_POPCNT
+
+  return soft_popcount(b);
 
 #elif defined(_MSC_VER) || defined(__INTEL_COMPILER)
 
@@ -273,7 +421,12 @@ inline int popcount(Bitboard b) {
 }
 
 
-/// lsb() and msb() return the least/most significant bit in a non-zero bitboard
+/// lsb() and msb() return the least/most significant bit in a non-zero bitboard.
+/// Where the compiler has no bitscan intrinsic they fall back on soft_lsb() and
+/// soft_msb(), table based versions that every build provides for benchmarks.
+
+Square soft_lsb(Bitboard b);
+Square soft_msb(Bitboard b);
 
 #if defined(__GNUC__)
 
@@ -307,8 +460,8 @@ inline Square msb(Bitboard b) {
 
 #define NO_BSF // Fallback on software implementation for other cases
 
-Square lsb(Bitboard b);
-Square msb(Bitboard b);
+inline Square lsb(Bitboard b) { return soft_lsb(b); }
+inline Square msb(Bitboard b) { return soft_msb(b); }
 
 #endif
 
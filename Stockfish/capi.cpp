@@ -0,0 +1,297 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bitboard.h"
+#include "capi.h"
+#include "encoder.h"
+#include "instrument.h"
+#include "movegen.h"
+#include "policy.h"
+#include "position.h"
+#include "record.h"
+
+static_assert(SF_PACKED_SIZE == sizeof(PackedPosition), "Wrong SF_PACKED_SIZE");
+static_assert(SF_PLANES == Encoder::PLANE_NB && SF_INPUT_SIZE == Encoder::InputSize, "Wrong SF_INPUT_SIZE");
+static_assert(SF_POLICY_SIZE == Policy::PolicySize && SF_MASK_WORDS == Policy::MaskWords, "Wrong SF_POLICY_SIZE");
+static_assert(sizeof(int32_t) == sizeof(int), "Move counts are written as int");
+
+/// sf_batch owns its positions and, for each of them, the key history that
+/// repetition detection reads. Histories are never reallocated while the
+/// positions point to them: both vectors are only resized by the loaders.
+
+struct sf_batch {
+
+  void attach() {
+    histories.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); ++i)
+        positions[i].set_history(&histories[i]);
+  }
+
+  std::vector<Position> positions;
+  std::vector<KeyHistory> histories;
+};
+
+namespace {
+
+  std::once_flag InitFlag;
+  std::once_flag NamesFlag;
+  std::vector<std::string> InstrumentNames;
+
+  const size_t InstrumentSize =  Instrument::COUNTER_NB
+                               + Instrument::SECTION_NB * Instrument::BUCKET_NB;
+
+  // PackedPosition::unpack() trusts its input, so records coming from the
+  // caller are checked first: known piece codes, one king per side, no pawn
+  // on the first or last rank, castling rooks on the back rank of their king,
+  // at most one on each side of it, and an en passant square that a double
+  // push could have left: empty, on the sixth rank, with an empty square
+  // behind it and the enemy pawn in front of it. This is the rule of
+  // fen_parse(), and as there the square is cleared when no pawn of the side
+  // to move can capture there.
+  bool validate(PackedPosition& pp) {
+
+    const int CastlingRookCode = 7; // See PackedPosition
+    Bitboard kings[COLOR_NB] = {}, rooks[COLOR_NB] = {}, pawns[COLOR_NB] = {};
+    int n = 0;
+
+    if (popcount(pp.occupied) > 32 || pp.flags > 1 || pp.reserved)
+        return false;
+
+    for (Bitboard b = pp.occupied; b; ++n)
+    {
+        Square s = pop_lsb(&b);
+        int code = (pp.pieces[n / 2] >> (4 * (n & 1))) & 0xF;
+        Color c = Color(code >> 3);
+
+        if (   !(code & 7)
+            || ((code & 7) == PAWN && (rank_of(s) == RANK_1 || rank_of(s) == RANK_8)))
+            return false;
+
+        if ((code & 7) == KING)
+            kings[c] |= s;
+
+        if ((code & 7) == PAWN)
+            pawns[c] |= s;
+
+        if ((code & 7) == CastlingRookCode)
+            rooks[c] |= s;
+    }
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        if (popcount(kings[c]) != 1)
+            return false;
+
+        Square ksq = lsb(kings[c]);
+
+        if (rooks[c] && (   (rooks[c] & ~rank_bb(relative_rank(c, RANK_1)))
+                         || relative_rank(c, ksq) != RANK_1
+                         || popcount(rooks[c] & ((kings[c] - 1))) > 1
+                         || popcount(rooks[c] & ~((kings[c] - 1))) > 1))
+            return false;
+    }
+
+    if (pp.epSquare == SQ_NONE)
+        return true;
+
+    Color us = Color(pp.flags);
+    Square ep = Square(pp.epSquare);
+
+    if (   ep > SQ_NONE
+        || relative_rank(us, ep) != RANK_6
+        || (pp.occupied & ep)
+        || (pp.occupied & (ep + pawn_push(us)))
+        || !(pawns[~us] & (ep + pawn_push(~us))))
+        return false;
+
+    if (!(StepAttacksBB[make_piece(~us, PAWN)][ep] & pawns[us]))
+        pp.epSquare = SQ_NONE;
+
+    return true;
+  }
+
+} // namespace
+
+
+int sf_abi_version(void) {
+  return SF_ABI_VERSION;
+}
+
+sf_batch* sf_batch_new(void) {
+
+  std::call_once(InitFlag, [] { Bitboards::init(); Position::init(); });
+  return new sf_batch();
+}
+
+void sf_batch_free(sf_batch* batch) {
+  delete batch;
+}
+
+size_t sf_batch_size(const sf_batch* batch) {
+  return batch->positions.size();
+}
+
+size_t sf_batch_load_fen(sf_batch* batch, const char* const* fens, size_t n) {
+
+  std::vector<Position> positions(n);
+
+  for (size_t i = 0; i < n; ++i)
+      if (positions[i].fen_parse(fens[i], std::strlen(fens[i])) != FEN_OK)
+          return i;
+
+  batch->positions.swap(positions);
+  batch->attach();
+  return n;
+}
+
+size_t sf_batch_load_packed(sf_batch* batch, const void* records, size_t n) {
+
+  const PackedPosition* pp = static_cast<const PackedPosition*>(records);
+  std::vector<Position> positions(n);
+
+  for (size_t i = 0; i < n; ++i)
+  {
+      PackedPosition record = pp[i];
+
+      if (!validate(record))
+          return i;
+
+      Position& pos = positions[i];
+      record.unpack(pos);
+
+      // Piece counts must fit the material key, and the side not to move
+      // must not be in check.
+      if (   !pos.material_ok()
+          || (pos.attackers_to(pos.square<KING>(~pos.sideToMove)) & pos.pieces(pos.sideToMove)))
+          return i;
+  }
+
+  batch->positions.swap(positions);
+  batch->attach();
+  return n;
+}
+
+void sf_batch_save_packed(const sf_batch* batch, void* out) {
+
+  PackedPosition* pp = static_cast<PackedPosition*>(out);
+
+  for (const Position& pos : batch->positions)
+      *pp++ = PackedPosition::pack(pos);
+}
+
+size_t sf_batch_make_moves(sf_batch* batch, const int32_t* moves, int stmPerspective) {
+
+  std::vector<Position>& positions = batch->positions;
+  std::vector<Move> decoded(positions.size(), MOVE_NONE);
+
+  for (size_t i = 0; i < positions.size(); ++i)
+      if (moves[i] >= 0)
+      {
+          if (moves[i] >= Policy::PolicySize)
+              return i;
+
+          decoded[i] = Policy::move(positions[i], moves[i], stmPerspective);
+
+          if (decoded[i] == MOVE_NONE || !MoveList<LEGAL>(positions[i]).contains(decoded[i]))
+              return i;
+      }
+
+  for (size_t i = 0; i < positions.size(); ++i)
+      if (decoded[i] != MOVE_NONE)
+          positions[i].move(decoded[i]);
+
+  return positions.size();
+}
+
+void sf_batch_legal_masks(const sf_batch* batch, uint8_t* out, int32_t* counts, int stmPerspective) {
+  Policy::legal_mask(batch->positions.data(), batch->positions.size(), out, stmPerspective, counts);
+}
+
+void sf_batch_legal_bits(const sf_batch* batch, uint64_t* out, int32_t* counts, int stmPerspective) {
+  Policy::legal_bits(batch->positions.data(), batch->positions.size(), out, stmPerspective, counts);
+}
+
+void sf_batch_encode_u8(const sf_batch* batch, uint8_t* out, int stmPerspective) {
+  Encoder::encode(batch->positions.data(), batch->positions.size(), out, stmPerspective);
+}
+
+void sf_batch_encode_f32(const sf_batch* batch, float* out, int stmPerspective) {
+  Encoder::encode(batch->positions.data(), batch->positions.size(), out, stmPerspective);
+}
+
+void sf_batch_is_terminal(const sf_batch* batch, int8_t* out) {
+
+  for (const Position& pos : batch->positions)
+  {
+      if (!has_legal_move(pos))
+          *out++ = pos.checkers() ? SF_CHECKMATE : SF_STALEMATE;
+      else
+          *out++ = pos.is_draw() ? SF_DRAW : SF_ONGOING;
+  }
+}
+
+int sf_instrument_enabled(void) {
+  return HasInstrument;
+}
+
+size_t sf_instrument_size(void) {
+  return InstrumentSize;
+}
+
+const char* sf_instrument_name(size_t i) {
+
+  std::call_once(NamesFlag, [] {
+
+      for (int c = 0; c < Instrument::COUNTER_NB; ++c)
+          InstrumentNames.push_back(Instrument::name(Instrument::Counter(c)));
+
+      for (int sec = 0; sec < Instrument::SECTION_NB; ++sec)
+          for (int b = 0; b < Instrument::BUCKET_NB; ++b)
+              InstrumentNames.push_back(  std::string("cycles.")
+                                        + Instrument::name(Instrument::Section(sec))
+                                        + "." + std::to_string(b));
+  });
+
+  return i < InstrumentNames.size() ? InstrumentNames[i].c_str() : nullptr;
+}
+
+size_t sf_instrument_snapshot(uint64_t* out, size_t n) {
+
+  Instrument::Snapshot s;
+  Instrument::snapshot(s);
+
+  std::vector<uint64_t> flat(s.counters, s.counters + Instrument::COUNTER_NB);
+
+  for (auto& h : s.histograms)
+      flat.insert(flat.end(), h, h + Instrument::BUCKET_NB);
+
+  n = std::min(n, flat.size());
+  std::copy(flat.begin(), flat.begin() + n, out);
+  return n;
+}
+
+void sf_instrument_reset(void) {
+  Instrument::reset();
+}
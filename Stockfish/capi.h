@@ -0,0 +1,125 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef CAPI_H_INCLUDED
+#define CAPI_H_INCLUDED
+
+/// C interface for training frameworks. A batch is an opaque set of positions
+/// that every call processes as a whole, so that a Python trainer pays one
+/// foreign call per batch and not per position or per move. All the outputs
+/// go to contiguous buffers owned by the caller, laid out as C arrays of shape
+/// [batch size][...], which numpy arrays or DLPack tensors can wrap without a
+/// copy. The calls never call back into the caller, so bindings can release
+/// the GIL around them (ctypes does), and distinct batches may be used from
+/// distinct threads at the same time.
+///
+/// The ABI only grows: new functions may be added, existing ones keep their
+/// signature and behavior. sf_abi_version() tells which ones are available.
+///
+/// Build as a shared library from all the sources but main.cpp, for instance
+/// with g++ -std=c++11 -O3 -fPIC -shared -fvisibility=hidden.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#  define SF_API __declspec(dllexport)
+#else
+#  define SF_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SF_ABI_VERSION   2
+
+#define SF_PACKED_SIZE   32              // Bytes of a PackedPosition record
+#define SF_PLANES        19              // Encoder planes, see encoder.h
+#define SF_INPUT_SIZE    (SF_PLANES * 64)
+#define SF_POLICY_SIZE   (73 * 64)       // Policy indices, see policy.h
+#define SF_MASK_WORDS    73              // 64-bit words of a legal moves bitset
+
+/// Values written by sf_batch_is_terminal()
+enum {
+  SF_ONGOING   = 0,
+  SF_CHECKMATE = 1, // The side to move is mated
+  SF_STALEMATE = 2,
+  SF_DRAW      = 3  // 50 moves rule, repetition or insufficient material
+};
+
+typedef struct sf_batch sf_batch;
+
+SF_API int sf_abi_version(void);
+
+SF_API sf_batch* sf_batch_new(void);
+SF_API void sf_batch_free(sf_batch* batch);
+SF_API size_t sf_batch_size(const sf_batch* batch);
+
+/// The loaders replace the content of the batch with 'n' positions, given as
+/// FEN strings or as consecutive PackedPosition records. They return the
+/// number of valid entries before the first invalid one: when that is less
+/// than 'n' the batch is left unchanged. Repetitions are detected from the
+/// loaded positions onwards.
+SF_API size_t sf_batch_load_fen(sf_batch* batch, const char* const* fens, size_t n);
+SF_API size_t sf_batch_load_packed(sf_batch* batch, const void* records, size_t n);
+
+/// sf_batch_save_packed() writes the positions as PackedPosition records to
+/// 'out', which must have room for size * SF_PACKED_SIZE bytes.
+SF_API void sf_batch_save_packed(const sf_batch* batch, void* out);
+
+/// sf_batch_make_moves() plays in each position the move at the given policy
+/// index, or nothing if the index is negative. It returns the number of moves
+/// before the first illegal one: when that is less than the batch size no move
+/// is played at all.
+SF_API size_t sf_batch_make_moves(sf_batch* batch, const int32_t* moves, int stmPerspective);
+
+/// sf_batch_legal_masks() writes [size][SF_POLICY_SIZE] bytes, 1 at the index
+/// of each legal move, sf_batch_legal_bits() the same as [size][SF_MASK_WORDS]
+/// bitsets, word p holding the origin squares of the moves of plane p. If
+/// 'counts' is not null it gets the number of legal moves of each position.
+SF_API void sf_batch_legal_masks(const sf_batch* batch, uint8_t* out, int32_t* counts, int stmPerspective);
+SF_API void sf_batch_legal_bits(const sf_batch* batch, uint64_t* out, int32_t* counts, int stmPerspective);
+
+/// sf_batch_encode_u8() and sf_batch_encode_f32() write the network input
+/// planes as [size][SF_PLANES][64] values.
+SF_API void sf_batch_encode_u8(const sf_batch* batch, uint8_t* out, int stmPerspective);
+SF_API void sf_batch_encode_f32(const sf_batch* batch, float* out, int stmPerspective);
+
+/// sf_batch_is_terminal() writes one SF_ONGOING ... SF_DRAW value per position
+SF_API void sf_batch_is_terminal(const sf_batch* batch, int8_t* out);
+
+/// Since ABI version 2. Instrumentation counters of the whole library, see
+/// instrument.h, as a flat array of sf_instrument_size() values: the event
+/// counters, then the cycle histogram buckets of each timed section. Their
+/// names ("legal.calls", "cycles.move.7"...) are given by sf_instrument_name().
+/// Unless the library is built with -DUSE_INSTRUMENT, sf_instrument_enabled()
+/// returns 0 and all the values are zero. sf_instrument_snapshot() writes at
+/// most 'n' values and returns how many it wrote.
+SF_API int sf_instrument_enabled(void);
+SF_API size_t sf_instrument_size(void);
+SF_API const char* sf_instrument_name(size_t i);
+SF_API size_t sf_instrument_snapshot(uint64_t* out, size_t n);
+SF_API void sf_instrument_reset(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // #ifndef CAPI_H_INCLUDED
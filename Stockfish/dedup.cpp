@@ -0,0 +1,704 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <thread>
+
+#include "dedup.h"
+#include "position.h"
+
+using namespace Dedup;
+
+namespace {
+
+  const size_t BatchSize = 1 << 16;   // Positions per call to Index::add()
+  const size_t FileBuffer = 1 << 18;  // Buffer of each output stream of a shard
+  const size_t ReadBuffer = 1 << 16;  // Bytes read at once from each merged run
+  const size_t MaxRuns = 64;          // Runs of a kind per shard before compaction
+  const int Probes = 6;               // Bits set per key in the Bloom filters
+
+  // An Entry is a record kept in a run, with the number of times its key was
+  // seen. While in memory, in FIRST mode, 'count' is the arrival order of the
+  // record in its shard instead, so that sorting keeps the first occurrence.
+  struct Entry {
+    Key key;
+    uint64_t count;
+    PackedPosition pos;
+  };
+
+  Key key_of(Key k) { return k; }
+  Key key_of(const Entry& e) { return e.key; }
+
+  void combine(Key&, Key) {}
+  void combine(Entry& e, const Entry& other) { e.count += other.count; }
+
+
+  // BloomFilter is a blocked Bloom filter: a key selects one cache line with
+  // the high bits of a multiplicative hash, then sets or tests Probes bits in
+  // it taken from its own low bits, so that a query costs a single miss. The
+  // top bits of the key, which select the shard, are not used.
+  class BloomFilter {
+
+  public:
+    void resize(size_t bytes) {
+
+      blockCount = std::max(bytes / 64, size_t(1));
+      words.assign(blockCount * 8 + 7, 0);
+      blocks = (uint64_t*)((uintptr_t(words.data()) + 63) & ~uintptr_t(63));
+    }
+
+    // test_and_set() adds the key and returns whether it may have been added
+    // before. False positives get more frequent as the filter fills up.
+    bool test_and_set(Key key) {
+
+      uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+      uint64_t* block = blocks + 8 * ((uint64_t(uint32_t(h >> 32)) * blockCount) >> 32);
+      bool seen = true;
+
+      for (int i = 0; i < Probes; ++i)
+      {
+          unsigned bit = (key >> (9 * i)) & 511;
+          uint64_t mask = 1ULL << (bit & 63);
+
+          seen &= bool(block[bit >> 6] & mask);
+          block[bit >> 6] |= mask;
+      }
+
+      return seen;
+    }
+
+  private:
+    std::vector<uint64_t> words;
+    uint64_t* blocks;
+    size_t blockCount;
+  };
+
+
+  // RunReader reads a run sequentially, a buffer at a time
+  template<typename T>
+  class RunReader {
+
+  public:
+    RunReader() : file(nullptr), pos(0), len(0), error(false) {}
+    RunReader(const RunReader&) = delete;
+    RunReader& operator=(const RunReader&) = delete;
+   ~RunReader() { if (file) fclose(file); }
+
+    bool open(const std::string& path) {
+      buf.resize(std::max(ReadBuffer / sizeof(T), size_t(1)));
+      return (file = fopen(path.c_str(), "rb")) != nullptr;
+    }
+
+    // next() makes the next record current, returning false at the end
+    bool next() {
+
+      if (++pos < len)
+          return true;
+
+      len = fread(buf.data(), sizeof(T), buf.size(), file);
+      error |= len < buf.size() && ferror(file);
+      pos = 0;
+      return len > 0;
+    }
+
+    const T& current() const { return buf[pos]; }
+    bool failed() const { return error; }
+
+  private:
+    FILE* file;
+    std::vector<T> buf;
+    size_t pos, len;
+    bool error;
+  };
+
+
+  // Merger walks a set of sorted runs as a single sorted sequence: records
+  // come in key order and, for equal keys, in the order of the runs.
+  template<typename T>
+  class Merger {
+
+  public:
+    bool open(const std::vector<std::string>& paths) {
+
+      readers.clear();
+
+      for (const std::string& path : paths)
+      {
+          readers.emplace_back(new RunReader<T>());
+
+          if (!readers.back()->open(path))
+              return false;
+
+          if (readers.back()->next())
+              heap.push(Item{ key_of(readers.back()->current()), int(readers.size() - 1) });
+      }
+
+      return true;
+    }
+
+    bool empty() const { return heap.empty(); }
+    const T& top() const { return readers[heap.top().run]->current(); }
+
+    void pop() {
+
+      int run = heap.top().run;
+      heap.pop();
+
+      if (readers[run]->next())
+          heap.push(Item{ key_of(readers[run]->current()), run });
+    }
+
+    bool failed() const {
+      return std::any_of(readers.begin(), readers.end(),
+                         [](const std::unique_ptr<RunReader<T>>& r) { return r->failed(); });
+    }
+
+  private:
+    struct Item {
+      Key key;
+      int run;
+      bool operator<(const Item& i) const { return key != i.key ? key > i.key : run > i.run; }
+    };
+
+    std::vector<std::unique_ptr<RunReader<T>>> readers;
+    std::priority_queue<Item> heap;
+  };
+
+
+  template<typename T>
+  bool write_file(const std::string& path, const T* data, size_t n) {
+
+    FILE* f = fopen(path.c_str(), "wb");
+
+    if (!f)
+        return false;
+
+    bool ok = fwrite(data, sizeof(T), n, f) == n;
+    return (fclose(f) == 0) && ok;
+  }
+
+  // compact() merges the runs into a single one, with the records of equal
+  // keys combined into the first of them. It bounds the number of runs, which
+  // are all open at once when merged.
+  template<typename T>
+  bool compact(std::vector<std::string>& runs, const std::string& path) {
+
+    bool ok;
+
+    {
+        Merger<T> merger;
+        FILE* f;
+        std::vector<char> buffer(FileBuffer);
+
+        if (!merger.open(runs) || !(f = fopen(path.c_str(), "wb")))
+            return false;
+
+        setvbuf(f, buffer.data(), _IOFBF, buffer.size());
+        ok = true;
+
+        while (!merger.empty())
+        {
+            T r = merger.top();
+
+            for (merger.pop(); !merger.empty() && key_of(merger.top()) == key_of(r); merger.pop())
+                combine(r, merger.top());
+
+            ok &= fwrite(&r, sizeof(r), 1, f) == 1;
+        }
+
+        ok &= !merger.failed();
+        ok &= fclose(f) == 0;
+    }
+
+    for (const std::string& run : runs)
+        std::remove(run.c_str());
+
+    runs.assign(1, path);
+    return ok;
+  }
+
+  // concat() writes the records of the part files, in order, as a record file
+  template<typename Record>
+  bool concat(const std::vector<std::string>& parts, const std::string& path) {
+
+    RecordWriter<Record> writer;
+    std::vector<Record> buf(BatchSize);
+
+    if (!writer.open(path))
+        return false;
+
+    for (const std::string& part : parts)
+    {
+        FILE* f = fopen(part.c_str(), "rb");
+
+        if (!f)
+            return false;
+
+        for (size_t n; (n = fread(buf.data(), sizeof(Record), buf.size(), f)) > 0; )
+            writer.write(buf.data(), n);
+
+        bool ok = !ferror(f);
+        fclose(f);
+
+        if (!ok)
+            return false;
+    }
+
+    return writer.close();
+  }
+
+  // FEN text input, one position per line. Lines too long to be a FEN are
+  // counted as invalid.
+  bool read_fens(const std::string& path, std::vector<PackedPosition>& batch,
+                 uint64_t& invalid, Index& index) {
+
+    FILE* f = fopen(path.c_str(), "rb");
+
+    if (!f)
+        return false;
+
+    std::vector<char> buf(1 << 20);
+    size_t used = 0;
+    bool eof = false;
+    Position pos;
+
+    while (!eof)
+    {
+        size_t n = fread(buf.data() + used, 1, buf.size() - used, f);
+        eof = n < buf.size() - used;
+        used += n;
+
+        char* line = buf.data();
+        char* end = buf.data() + used;
+
+        for (char* nl; (nl = (char*)memchr(line, '\n', end - line)) || (eof && line < end); line = nl + 1)
+        {
+            if (!nl)
+                nl = end;
+
+            size_t len = nl - line;
+
+            if (len && line[len - 1] == '\r')
+                len--;
+
+            if (!len)
+                continue;
+
+            if (pos.fen_parse(line, len) == FEN_OK)
+                batch.push_back(PackedPosition::pack(pos));
+            else
+                invalid++;
+
+            if (batch.size() == BatchSize)
+                index.add(batch.data(), batch.size()), batch.clear();
+
+            if (nl == end)
+                break;
+        }
+
+        used = end > line ? end - line : 0;
+
+        if (used == buf.size()) // No end of line in a whole buffer
+            invalid++, used = 0;
+        else
+            std::memmove(buf.data(), line, used);
+    }
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+  }
+
+} // namespace
+
+
+/// Shard is the part of the index for the keys of one prefix. It is only
+/// touched by the thread the prefix is assigned to.
+
+struct Dedup::Shard {
+
+  Shard(const Options& o, const std::string& prefix);
+ ~Shard();
+
+  void add(Key key, const PackedPosition& pp);
+  void spill_entries();
+  void spill_keys();
+  bool finish();
+
+  Mode mode;
+  std::string prefix;
+  BloomFilter filter;
+  std::vector<Entry> entries; // Candidates for FIRST, all the records for COUNT
+  std::vector<Key> written;   // FIRST: keys of the records written directly
+  size_t entryCapacity, keyCapacity;
+  uint64_t arrivals;
+  FILE* part;                 // Output of the shard
+  std::vector<std::string> entryRuns, keyRuns;
+  std::vector<char> partBuffer;
+  Stats stats;
+  bool failed;
+};
+
+
+Shard::Shard(const Options& o, const std::string& pfx)
+  : mode(o.mode), prefix(pfx), arrivals(0), part(nullptr), stats(), failed(false) {
+
+  // Share of the memory of one shard: half to the filter and a quarter to
+  // each buffer for FIRST, all to the records for COUNT.
+  size_t budget = (o.memoryMb << 20) >> o.shardBits;
+
+  if (mode == FIRST)
+  {
+      filter.resize(budget / 2);
+      keyCapacity = std::max(budget / 4 / sizeof(Key), size_t(1));
+      entryCapacity = std::max(budget / 4 / sizeof(Entry), size_t(1));
+      written.reserve(keyCapacity);
+
+      std::string path = prefix + ".part";
+      partBuffer.resize(FileBuffer);
+
+      if ((part = fopen(path.c_str(), "wb")) != nullptr)
+          setvbuf(part, partBuffer.data(), _IOFBF, partBuffer.size());
+      else
+          failed = true;
+  }
+  else
+      entryCapacity = std::max(budget / sizeof(Entry), size_t(1));
+
+  entries.reserve(entryCapacity);
+}
+
+Shard::~Shard() {
+
+  if (part)
+      fclose(part);
+
+  for (const std::string& path : entryRuns)
+      std::remove(path.c_str());
+
+  for (const std::string& path : keyRuns)
+      std::remove(path.c_str());
+
+  std::remove((prefix + ".part").c_str());
+}
+
+
+void Shard::add(Key key, const PackedPosition& pp) {
+
+  stats.input++;
+
+  if (mode == FIRST && !filter.test_and_set(key))
+  {
+      failed |= fwrite(&pp, sizeof(pp), 1, part) != 1;
+      stats.output++;
+      written.push_back(key);
+
+      if (written.size() == keyCapacity)
+          spill_keys();
+
+      return;
+  }
+
+  stats.candidates += (mode == FIRST);
+  entries.push_back(Entry{ key, mode == FIRST ? arrivals++ : 1, pp });
+
+  if (entries.size() == entryCapacity)
+      spill_entries();
+}
+
+
+/// Shard::spill_entries() sorts the records in memory by key, combines the
+/// ones with equal keys into the first of them and writes them as a run.
+
+void Shard::spill_entries() {
+
+  if (entries.empty())
+      return;
+
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+      return a.key != b.key ? a.key < b.key : a.count < b.count;
+  });
+
+  size_t n = 0;
+
+  for (size_t i = 0; i < entries.size(); ++n)
+  {
+      Entry e = entries[i];
+      uint64_t count = 0;
+
+      for ( ; i < entries.size() && entries[i].key == e.key; ++i)
+          count += entries[i].count;
+
+      e.count = mode == COUNT ? count : 1;
+      entries[n] = e;
+  }
+
+  entryRuns.push_back(prefix + ".r" + std::to_string(stats.runs++));
+  failed |= !write_file(entryRuns.back(), entries.data(), n);
+  entries.clear();
+
+  if (entryRuns.size() == MaxRuns)
+      failed |= !compact<Entry>(entryRuns, prefix + ".r" + std::to_string(stats.runs++));
+}
+
+void Shard::spill_keys() {
+
+  if (written.empty())
+      return;
+
+  std::sort(written.begin(), written.end());
+  written.erase(std::unique(written.begin(), written.end()), written.end());
+
+  keyRuns.push_back(prefix + ".r" + std::to_string(stats.runs++));
+  failed |= !write_file(keyRuns.back(), written.data(), written.size());
+  written.clear();
+
+  if (keyRuns.size() == MaxRuns)
+      failed |= !compact<Key>(keyRuns, prefix + ".r" + std::to_string(stats.runs++));
+}
+
+
+/// Shard::finish() merges the runs into the part file of the shard. For
+/// FIRST the candidates are merged against the keys written directly, and
+/// the first candidate of each key not found there is appended.
+
+bool Shard::finish() {
+
+  spill_entries();
+  spill_keys();
+
+  if (failed)
+      return false;
+
+  Merger<Entry> candidates;
+
+  if (!candidates.open(entryRuns))
+      return false;
+
+  if (mode == FIRST)
+  {
+      Merger<Key> keys;
+
+      if (!keys.open(keyRuns))
+          return false;
+
+      while (!candidates.empty())
+      {
+          const Entry& e = candidates.top();
+          Key key = e.key;
+
+          while (!keys.empty() && keys.top() < key)
+              keys.pop();
+
+          if (keys.empty() || keys.top() != key)
+          {
+              failed |= fwrite(&e.pos, sizeof(e.pos), 1, part) != 1;
+              stats.output++;
+              stats.falsePositives++;
+          }
+
+          while (!candidates.empty() && candidates.top().key == key)
+              candidates.pop();
+      }
+
+      failed |= keys.failed();
+  }
+  else
+  {
+      std::string path = prefix + ".part";
+      partBuffer.resize(FileBuffer);
+
+      if (!(part = fopen(path.c_str(), "wb")))
+          return false;
+
+      setvbuf(part, partBuffer.data(), _IOFBF, partBuffer.size());
+
+      while (!candidates.empty())
+      {
+          CountedPosition cp = { candidates.top().pos, 0 };
+          Key key = candidates.top().key;
+
+          for ( ; !candidates.empty() && candidates.top().key == key; candidates.pop())
+              cp.count += candidates.top().count;
+
+          failed |= fwrite(&cp, sizeof(cp), 1, part) != 1;
+          stats.output++;
+      }
+  }
+
+  failed |= candidates.failed();
+  failed |= fclose(part) != 0;
+  part = nullptr;
+  return !failed;
+}
+
+
+Index::Index(const Options& o) : options(o), input(0), failed(false) {
+
+  options.threads = std::max(options.threads, 1);
+  options.shardBits = std::min(std::max(options.shardBits, 0), 12);
+
+  // Run names are unique to this index, so that several can share a directory
+  std::string tag = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())
+                  + "-" + std::to_string(uintptr_t(this) & 0xFFFFFF);
+
+  for (int i = 0; i < 1 << options.shardBits; ++i)
+      shards.emplace_back(new Shard(options, options.tmpDir + "/sfdedup-" + tag + "-" + std::to_string(i)));
+}
+
+Index::~Index() {}
+
+
+/// Index::parallel() calls f(t) for each thread index t, on as many threads
+template<typename F>
+void Index::parallel(F f) {
+
+  std::vector<std::thread> threads;
+
+  for (int t = 1; t < options.threads; ++t)
+      threads.emplace_back(f, t);
+
+  f(0);
+
+  for (std::thread& th : threads)
+      th.join();
+}
+
+
+void Index::add(const PackedPosition* positions, size_t n) {
+
+  int T = options.threads;
+  int shift = 64 - options.shardBits;
+
+  keys.resize(n);
+  input += n;
+
+  // Keys first, each thread taking a slice of the positions...
+  parallel([&](int t) {
+
+      Position pos;
+
+      for (size_t i = n * t / T; i < n * (t + 1) / T; ++i)
+      {
+          positions[i].unpack(pos);
+          keys[i] = options.canonical ? pos.canonical_key() : pos.key();
+      }
+  });
+
+  // ...then each shard takes its keys, in input order
+  parallel([&](int t) {
+
+      for (size_t i = 0; i < n; ++i)
+      {
+          size_t s = shift < 64 ? size_t(keys[i] >> shift) : 0;
+
+          if (int(s % T) == t)
+              shards[s]->add(keys[i], positions[i]);
+      }
+  });
+}
+
+
+bool Index::finish(const std::string& path, Stats& stats) {
+
+  std::memset(&stats, 0, sizeof(stats));
+
+  std::vector<char> ok(shards.size());
+
+  parallel([&](int t) {
+      for (size_t s = t; s < shards.size(); s += options.threads)
+          ok[s] = shards[s]->finish();
+  });
+
+  failed |= std::count(ok.begin(), ok.end(), 0) > 0;
+
+  std::vector<std::string> parts;
+
+  for (auto& shard : shards)
+      parts.push_back(shard->prefix + ".part");
+
+  failed = failed || !(options.mode == FIRST ? concat<PackedPosition>(parts, path)
+                                             : concat<CountedPosition>(parts, path));
+
+  for (auto& shard : shards)
+  {
+      stats.output         += shard->stats.output;
+      stats.candidates     += shard->stats.candidates;
+      stats.falsePositives += shard->stats.falsePositives;
+      stats.runs           += shard->stats.runs;
+  }
+
+  stats.input = input;
+  shards.clear(); // Removes the temporary files
+
+  return !failed;
+}
+
+
+bool Dedup::run(const std::vector<std::string>& inputs, const std::string& output,
+                const Options& options, Stats& stats) {
+
+  Index index(options);
+  std::vector<PackedPosition> batch;
+  uint64_t invalid = 0;
+
+  batch.reserve(BatchSize);
+
+  auto flush = [&]() {
+      index.add(batch.data(), batch.size());
+      batch.clear();
+  };
+
+  for (const std::string& path : inputs)
+  {
+      RecordReader<PackedPosition> positions;
+      RecordReader<PackedGameRecord> games;
+
+      if (positions.open(path))
+      {
+          flush();
+
+          for (size_t i = 0; i < positions.size(); i += BatchSize)
+              index.add(positions.begin() + i, std::min(BatchSize, positions.size() - i));
+      }
+      else if (games.open(path))
+      {
+          for (const PackedGameRecord& r : games)
+          {
+              batch.push_back(r.pos);
+
+              if (batch.size() == BatchSize)
+                  flush();
+          }
+      }
+      else if (!read_fens(path, batch, invalid, index))
+          return false;
+  }
+
+  flush();
+
+  bool ok = index.finish(output, stats);
+  stats.invalid = invalid;
+  return ok;
+}
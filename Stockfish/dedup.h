@@ -0,0 +1,116 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEDUP_H_INCLUDED
+#define DEDUP_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "record.h"
+
+/// Dedup removes the duplicate positions of a training corpus, identified by
+/// their Zobrist key, or counts how many times each position occurs. It is
+/// built for corpora much larger than memory: all the disk accesses are
+/// sequential, to the input, to sorted runs spilled in a temporary directory
+/// and to the output.
+///
+/// Keys are split by their top bits into shards, each handled by one thread,
+/// with its own share of the memory budget:
+///
+///  - FIRST keeps the first occurrence of each position. A Bloom filter sits
+///    in front of the index: a key it has never seen is certainly new, so
+///    the record goes straight to the output and only its key is kept, to be
+///    sorted into runs. Only the records the filter may have seen are kept as
+///    candidates, and at the end the candidates are merged with the keys
+///    written out: a candidate is dropped if its key was written, otherwise
+///    it is a filter false positive and its first occurrence is written.
+///
+///  - COUNT writes each distinct position once, as a CountedPosition, with its
+///    number of occurrences. Records are combined in memory, then in runs,
+///    and the runs are merged at the end.
+///
+/// Output order is by shard. Two distinct positions with the same 64 bit key
+/// are merged; at a billion distinct positions, odds are about 1 in 40 that
+/// this happens once at all.
+
+namespace Dedup {
+
+enum Mode { FIRST, COUNT };
+
+struct Options {
+  Mode        mode      = FIRST;
+  size_t      memoryMb  = 1024; // Filters and buffers of all the shards
+  int         threads   = 1;
+  int         shardBits = 6;    // 2^shardBits shards
+  std::string tmpDir    = ".";
+  bool        canonical = false; // Positions equal up to a symmetry are duplicates
+};
+
+struct Stats {
+  uint64_t input;          // Positions given to add()
+  uint64_t invalid;        // Input lines that were not valid FEN
+  uint64_t output;         // Positions written
+  uint64_t candidates;     // FIRST: records the filter may have seen
+  uint64_t falsePositives; // FIRST: candidates that turned out new
+  uint64_t runs;           // Sorted runs written to disk, merged ones included
+};
+
+struct Shard;
+
+class Index {
+public:
+  explicit Index(const Options& options);
+  Index(const Index&) = delete;
+  Index& operator=(const Index&) = delete;
+ ~Index();
+
+  /// add() indexes 'n' positions, computing their keys and updating the
+  /// shards on all the threads. It is not itself thread safe.
+  void add(const PackedPosition* positions, size_t n);
+
+  /// finish() merges the runs and writes the result to 'path': a record file
+  /// of PackedPosition for FIRST, of CountedPosition for COUNT. The index
+  /// can't be used afterwards. Returns false on any I/O error.
+  bool finish(const std::string& path, Stats& stats);
+
+private:
+  template<typename F> void parallel(F f);
+
+  Options options;
+  std::vector<std::unique_ptr<Shard>> shards;
+  std::vector<Key> keys;
+  uint64_t input;
+  bool failed;
+};
+
+/// run() streams the given files through an Index and writes the result to
+/// 'output'. Inputs are record files of PackedPosition or PackedGameRecord,
+/// or else text files of one FEN per line. Returns false if an input can't be
+/// read or on any I/O error.
+bool run(const std::vector<std::string>& inputs, const std::string& output,
+         const Options& options, Stats& stats);
+
+} // namespace Dedup
+
+#endif // #ifndef DEDUP_H_INCLUDED
@@ -0,0 +1,141 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "encoder.h"
+#include "position.h"
+
+namespace {
+
+  // expand() writes a bitboard as 64 values, one per square, set to 1 where
+  // the bitboard has a bit. With AVX2 the bitboard bytes are broadcast across
+  // a register, each lane is masked with its own bit and compared against it.
+
+  void expand(Bitboard b, uint8_t* out) {
+
+#ifdef USE_AVX2
+    const __m256i select = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201LL);
+    const __m256i one = _mm256_set1_epi8(1);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        __m256i v = _mm256_set1_epi32(int(b >> (32 * i)));
+        v = _mm256_and_si256(_mm256_shuffle_epi8(v, select), bits);
+        v = _mm256_and_si256(_mm256_cmpeq_epi8(v, bits), one);
+        _mm256_storeu_si256((__m256i*)(out + 32 * i), v);
+    }
+#else
+    for (Square s = SQ_A1; s <= SQ_H8; ++s)
+        out[s] = uint8_t((b >> s) & 1);
+#endif
+  }
+
+  void expand(Bitboard b, float* out) {
+
+#ifdef USE_AVX2
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i one = _mm256_castps_si256(_mm256_set1_ps(1.0f));
+
+    for (int i = 0; i < 8; ++i)
+    {
+        __m256i v = _mm256_set1_epi32(int((b >> (8 * i)) & 0xFF));
+        v = _mm256_cmpeq_epi32(_mm256_and_si256(v, bits), bits);
+        _mm256_storeu_ps(out + 8 * i, _mm256_castsi256_ps(_mm256_and_si256(v, one)));
+    }
+#else
+    for (Square s = SQ_A1; s <= SQ_H8; ++s)
+        out[s] = float((b >> s) & 1);
+#endif
+  }
+
+  template<typename T>
+  void fill(T* out, int v) {
+    std::fill(out, out + Encoder::PlaneSize, T(v));
+  }
+
+
+  // The transformed position is encoded from the original one: colors are
+  // swapped when reading it, and the geometric part of the symmetry, with the
+  // perspective flip on top, is one transform() of each bitboard. Castling
+  // rights and en passant survive the same symmetries as in transform().
+  template<typename T>
+  void encode_position(const Position& pos, T* out, bool stmPerspective, Symmetry sym) {
+
+    using namespace Encoder;
+
+    const bool swap = sym & SWAP_COLORS;
+    const bool forward = !(sym & TRANSPOSE) && !(sym & FLIP) == !swap;
+    const Color stm = swap ? ~pos.sideToMove : pos.sideToMove;
+    const Color first = stmPerspective ? stm : WHITE;
+    const Symmetry geometry = Symmetry((sym & ~SWAP_COLORS) ^ (first == BLACK ? FLIP : 0));
+    const Color colors[] = { swap ? ~first : first, swap ? first : ~first }; // In 'pos'
+
+    for (int i = 0; i < 2; ++i)
+        for (PieceType pt = PAWN; pt <= KING; ++pt)
+            expand(transform(pos.pieces(colors[i], pt), geometry),
+                   out + (PIECE_PLANES + 6 * i + pt - PAWN) * PlaneSize);
+
+    fill(out + SIDE_PLANE * PlaneSize, stm == BLACK);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        bool castles = forward && !(sym & MIRROR);
+        fill(out + (CASTLE_PLANES + 2 * i    ) * PlaneSize, castles && pos.can_castle(colors[i] | KING_SIDE));
+        fill(out + (CASTLE_PLANES + 2 * i + 1) * PlaneSize, castles && pos.can_castle(colors[i] | QUEEN_SIDE));
+    }
+
+    Bitboard ep = pos.epSquare != SQ_NONE && forward ? SquareBB[pos.epSquare] : 0;
+    expand(transform(ep, geometry), out + EP_PLANE * PlaneSize);
+
+    fill(out + RULE50_PLANE * PlaneSize, std::min(pos.rule50, 255));
+  }
+
+  template<typename T>
+  void encode_batch(const Position* positions, const Symmetry* symmetries, size_t count,
+                    T* out, bool stmPerspective) {
+
+    for (size_t i = 0; i < count; ++i)
+        encode_position(positions[i], out + i * Encoder::InputSize, stmPerspective,
+                        symmetries ? symmetries[i] : IDENTITY);
+  }
+
+} // namespace
+
+
+void Encoder::encode(const Position* positions, size_t count, uint8_t* out, bool stmPerspective) {
+  encode_batch(positions, nullptr, count, out, stmPerspective);
+}
+
+void Encoder::encode(const Position* positions, size_t count, float* out, bool stmPerspective) {
+  encode_batch(positions, nullptr, count, out, stmPerspective);
+}
+
+void Encoder::encode(const Position* positions, const Symmetry* symmetries, size_t count,
+                     uint8_t* out, bool stmPerspective) {
+  encode_batch(positions, symmetries, count, out, stmPerspective);
+}
+
+void Encoder::encode(const Position* positions, const Symmetry* symmetries, size_t count,
+                     float* out, bool stmPerspective) {
+  encode_batch(positions, symmetries, count, out, stmPerspective);
+}
@@ -0,0 +1,76 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ENCODER_H_INCLUDED
+#define ENCODER_H_INCLUDED
+
+#include <cstddef>
+
+#include "types.h"
+
+struct Position;
+
+namespace Encoder {
+
+/// Planes of the network input of a single position, each one 64 values in
+/// square order (a1, b1, ..., h8):
+///
+/// 0-5   : pieces of the first color, PAWN to KING
+/// 6-11  : pieces of the second color, PAWN to KING
+/// 12    : side to move, all ones if black is to move
+/// 13-16 : castling rights, king and queen side of the first color, then of
+///         the second color, all ones when the right is available
+/// 17    : en passant square
+/// 18    : rule50 counter, on every square
+///
+/// The first color is white. When encoding from the side to move perspective
+/// the first color is the side to move and, if that is black, the board is
+/// flipped vertically so that the side to move always plays up the board.
+
+enum Plane {
+  PIECE_PLANES  = 0,
+  SIDE_PLANE    = 12,
+  CASTLE_PLANES = 13,
+  EP_PLANE      = 17,
+  RULE50_PLANE  = 18,
+  PLANE_NB      = 19
+};
+
+const int PlaneSize = SQUARE_NB;
+const int InputSize = PLANE_NB * PlaneSize;
+
+/// encode() writes 'count' consecutive positions as a contiguous tensor of
+/// shape [count][PLANE_NB][64] to 'out', which must have room for
+/// count * InputSize values.
+void encode(const Position* positions, size_t count, uint8_t* out, bool stmPerspective = false);
+void encode(const Position* positions, size_t count, float* out, bool stmPerspective = false);
+
+/// encode() with symmetries writes each position as Position::transform() by
+/// symmetries[i] would leave it, without building the transformed position:
+/// the symmetry is applied to the bitboards on their way to the tensor, so an
+/// augmented batch costs no more than a plain one.
+void encode(const Position* positions, const Symmetry* symmetries, size_t count,
+            uint8_t* out, bool stmPerspective = false);
+void encode(const Position* positions, const Symmetry* symmetries, size_t count,
+            float* out, bool stmPerspective = false);
+
+} // namespace Encoder
+
+#endif // #ifndef ENCODER_H_INCLUDED
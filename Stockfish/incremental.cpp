@@ -0,0 +1,99 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cassert>
+
+#include "bitboard.h"
+#include "incremental.h"
+
+using namespace Incremental;
+
+Accumulator::Accumulator(const int16_t* w, int n) : weights(w), width(n), ply(0) {
+
+  stack.resize(16 * width);
+}
+
+
+/// Accumulator::reset() sums the rows of all the pieces of the board and
+/// empties the stack.
+
+void Accumulator::reset(const Position& pos) {
+
+  int32_t* acc = &stack[0];
+
+  ply = 0;
+  std::fill(acc, acc + width, 0);
+
+  for (Bitboard b = pos.pieces(); b; )
+  {
+      Square s = pop_lsb(&b);
+      const int16_t* r = row(pos.piece_on(s), s);
+
+      for (int i = 0; i < width; ++i)
+          acc[i] += r[i];
+  }
+}
+
+
+/// Accumulator::apply() writes the sums of the next ply as those of the
+/// current one, minus the rows of the pieces taken off their old squares,
+/// plus the rows of the pieces put on their new ones. Each row is a plain
+/// loop over the width, which the compiler vectorizes.
+
+void Accumulator::apply(const DirtyPiece& dp) {
+
+  assert(dp.count >= 1 && dp.count <= 3);
+
+  if (stack.size() < (ply + 2) * width)
+      stack.resize(2 * stack.size());
+
+  const int32_t* cur = &stack[ply * width];
+  int32_t* next = &stack[++ply * width];
+
+  std::copy(cur, cur + width, next);
+
+  for (int k = 0; k < dp.count; ++k)
+  {
+      if (dp.from[k] != SQ_NONE)
+      {
+          const int16_t* r = row(dp.piece[k], dp.from[k]);
+
+          for (int i = 0; i < width; ++i)
+              next[i] -= r[i];
+      }
+
+      if (dp.to[k] != SQ_NONE)
+      {
+          const int16_t* r = row(dp.piece[k], dp.to[k]);
+
+          for (int i = 0; i < width; ++i)
+              next[i] += r[i];
+      }
+  }
+}
+
+
+void Accumulator::undo() {
+
+  assert(ply > 0);
+
+  ply--;
+}
@@ -0,0 +1,79 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCREMENTAL_H_INCLUDED
+#define INCREMENTAL_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "position.h"
+
+namespace Incremental {
+
+/// Evaluator is the hook through which an evaluator with incremental state
+/// follows a line of play: reset() sets it up from scratch for a position,
+/// then each move made from there, with do_move() or move(), is reported by
+/// apply() with the DirtyPiece the move filled in, and each move taken back
+/// by undo(), in stack order. An instance follows a single line, in a single
+/// thread, like a KeyHistory.
+class Evaluator {
+
+public:
+  virtual ~Evaluator() {}
+
+  virtual void reset(const Position& pos) = 0;
+  virtual void apply(const DirtyPiece& dp) = 0;
+  virtual void undo() = 0;
+};
+
+
+/// Accumulator is the Evaluator of the first layer of an NNUE style network:
+/// 'width' sums over the (piece, square) features of the board, the feature
+/// of piece pc on square s being the row pc * SQUARE_NB + s of 'weights',
+/// which must hold PIECE_NB * SQUARE_NB rows and outlive the accumulator.
+/// A move adds and subtracts at most a handful of rows instead of summing one
+/// per piece, and the sums of the earlier plies are kept on a stack, so that
+/// undo() costs nothing.
+class Accumulator : public Evaluator {
+
+public:
+  Accumulator(const int16_t* weights, int width);
+
+  void reset(const Position& pos) override;
+  void apply(const DirtyPiece& dp) override;
+  void undo() override;
+
+  const int32_t* values() const { return &stack[ply * width]; }
+  int size() const { return width; }
+
+private:
+  const int16_t* row(Piece pc, Square s) const { return weights + (int(pc) * int(SQUARE_NB) + int(s)) * width; }
+
+  const int16_t* weights;
+  int width;
+  size_t ply;
+  std::vector<int32_t> stack; // [ply][width]
+};
+
+} // namespace Incremental
+
+#endif // #ifndef INCREMENTAL_H_INCLUDED
@@ -0,0 +1,169 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "bitboard.h"
+#include "instrument.h"
+
+namespace Instrument {
+
+namespace {
+
+  const char* CounterNames[COUNTER_NB] = {
+    "generate.captures", "generate.quiets", "generate.quiet_checks",
+    "generate.evasions", "generate.non_evasions", "generate.legal",
+    "emitted.captures", "emitted.quiets", "emitted.quiet_checks",
+    "emitted.evasions", "emitted.non_evasions", "emitted.legal",
+    "legal.calls", "legal.rejected",
+    "attacks_bb.sliders",
+    "move.normal", "move.promotion", "move.enpassant", "move.castling",
+    "gives_check.calls", "gives_check.hits"
+  };
+
+  const char* SectionNames[SECTION_NB] = {
+    "generate.captures", "generate.quiets", "generate.quiet_checks",
+    "generate.evasions", "generate.non_evasions", "generate.legal",
+    "legal", "move", "gives_check"
+  };
+
+#ifdef USE_INSTRUMENT
+
+  const size_t CacheLineSize = 64;
+
+  // Blocks are never freed, as the counts of exited threads must still show
+  // up in the totals. Instead the block of an exiting thread is handed over,
+  // counts included, to the next new thread, so that there are never more
+  // blocks than threads alive at the same time.
+  std::mutex Mutex;
+  std::vector<Block*> Blocks, Free;
+
+  struct Releaser {
+   ~Releaser() {
+      if (block)
+      {
+          std::lock_guard<std::mutex> lock(Mutex);
+          Free.push_back(block);
+      }
+    }
+
+    Block* block = nullptr;
+  };
+
+#endif
+
+} // namespace
+
+#ifdef USE_INSTRUMENT
+
+/// attach() gives the calling thread a block on its first probe: a released
+/// one if any, else a new one, zeroed and aligned on its own cache lines.
+
+Block* attach() {
+
+  static thread_local Releaser releaser;
+  std::lock_guard<std::mutex> lock(Mutex);
+
+  if (!Free.empty())
+  {
+      releaser.block = Free.back();
+      Free.pop_back();
+      return releaser.block;
+  }
+
+  size_t size = (sizeof(Block) + CacheLineSize - 1) & ~(CacheLineSize - 1);
+  void* mem = calloc(size + CacheLineSize - 1, 1);
+
+  if (!mem)
+      std::abort();
+
+  releaser.block = (Block*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+  Blocks.push_back(releaser.block);
+  return releaser.block;
+}
+
+void record(Section sec, uint64_t elapsed) {
+
+  int b = elapsed ? int(msb(elapsed)) : 0;
+  bump(local().histograms[sec][std::min(b, BUCKET_NB - 1)], 1);
+}
+
+#endif
+
+void snapshot(Snapshot& s) {
+
+  std::memset(&s, 0, sizeof(s));
+
+#ifdef USE_INSTRUMENT
+  std::lock_guard<std::mutex> lock(Mutex);
+
+  for (const Block* block : Blocks)
+  {
+      for (int c = 0; c < COUNTER_NB; ++c)
+          s.counters[c] += block->counters[c].load(std::memory_order_relaxed);
+
+      for (int sec = 0; sec < SECTION_NB; ++sec)
+          for (int b = 0; b < BUCKET_NB; ++b)
+              s.histograms[sec][b] += block->histograms[sec][b].load(std::memory_order_relaxed);
+  }
+
+  s.threads = int(Blocks.size());
+#endif
+}
+
+void reset() {
+
+#ifdef USE_INSTRUMENT
+  std::lock_guard<std::mutex> lock(Mutex);
+
+  for (Block* block : Blocks)
+  {
+      for (auto& w : block->counters)
+          w.store(0, std::memory_order_relaxed);
+
+      for (auto& h : block->histograms)
+          for (auto& w : h)
+              w.store(0, std::memory_order_relaxed);
+  }
+#endif
+}
+
+const char* name(Counter c) { return CounterNames[c]; }
+const char* name(Section sec) { return SectionNames[sec]; }
+
+void print(std::ostream& os, const Snapshot& s) {
+
+  os << "instrument.threads " << s.threads << "\n";
+
+  for (int c = 0; c < COUNTER_NB; ++c)
+      os << CounterNames[c] << " " << s.counters[c] << "\n";
+
+  for (int sec = 0; sec < SECTION_NB; ++sec)
+      for (int b = 0; b < BUCKET_NB; ++b)
+          if (s.histograms[sec][b])
+              os << "cycles." << SectionNames[sec] << "." << b
+                 << " " << s.histograms[sec][b] << "\n";
+}
+
+} // namespace Instrument
@@ -0,0 +1,165 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INSTRUMENT_H_INCLUDED
+#define INSTRUMENT_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+#include "types.h"
+
+/// Hot path instrumentation, compiled in only with -DUSE_INSTRUMENT. Without
+/// it every probe below is an empty inline function and the engine is exactly
+/// the same as before. With it each thread counts into its own cache line
+/// aligned block, so that probes never contend: a plain load and store of a
+/// thread private word, no locked instruction. Blocks of exited threads are
+/// kept and reused, so totals cover the whole life of the process.
+///
+/// Sections are also timed with the cycle counter and binned in histograms
+/// of power of 2 buckets, bucket b holding the runs of [2^b, 2^(b+1)) cycles.
+/// The counter costs some 20 cycles itself, so short sections are slowed down
+/// and their histograms are mostly useful to compare workloads, not to read
+/// absolute figures.
+
+#ifdef USE_INSTRUMENT
+#  if defined(_MSC_VER)
+#    include <intrin.h>    // Microsoft header for __rdtsc()
+#  elif defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h> // Header for __rdtsc()
+#  else
+#    include <chrono>
+#  endif
+const bool HasInstrument = true;
+#else
+const bool HasInstrument = false;
+#endif
+
+namespace Instrument {
+
+/// Counters are indexed by event, the per GenType ones in GenType order
+enum Counter {
+  GENERATE_CAPTURES, GENERATE_QUIETS, GENERATE_QUIET_CHECKS,
+  GENERATE_EVASIONS, GENERATE_NON_EVASIONS, GENERATE_LEGAL,
+  EMITTED_CAPTURES, EMITTED_QUIETS, EMITTED_QUIET_CHECKS,
+  EMITTED_EVASIONS, EMITTED_NON_EVASIONS, EMITTED_LEGAL,
+  LEGAL_CALLS, LEGAL_REJECTED,
+  SLIDER_LOOKUPS,
+  MOVE_NORMAL, MOVE_PROMOTION, MOVE_ENPASSANT, MOVE_CASTLING,
+  GIVES_CHECK_CALLS, GIVES_CHECK_HITS,
+  COUNTER_NB
+};
+
+/// Timed sections, the generate<> ones again in GenType order
+enum Section {
+  SEC_GENERATE_CAPTURES, SEC_GENERATE_QUIETS, SEC_GENERATE_QUIET_CHECKS,
+  SEC_GENERATE_EVASIONS, SEC_GENERATE_NON_EVASIONS, SEC_GENERATE_LEGAL,
+  SEC_LEGAL, SEC_MOVE, SEC_GIVES_CHECK,
+  SECTION_NB
+};
+
+const int BUCKET_NB = 32; // The last bucket also takes all the longer runs
+
+struct Snapshot {
+  uint64_t counters[COUNTER_NB];
+  uint64_t histograms[SECTION_NB][BUCKET_NB];
+  int threads; // Blocks summed up, the most threads ever counting at once
+};
+
+/// snapshot() sums up the blocks of all the threads into 's' and reset()
+/// zeroes them. Both may run while other threads are counting: a snapshot is
+/// then not atomic as a whole (two counters may be read at different times)
+/// and a reset may lose the increments racing with it, which is acceptable
+/// for telemetry. Without USE_INSTRUMENT the snapshot is all zeros.
+void snapshot(Snapshot& s);
+void reset();
+
+/// print() writes a snapshot in a line oriented 'name value' format, for
+/// people and scrapers alike. Empty histogram buckets are skipped.
+void print(std::ostream& os, const Snapshot& s);
+
+const char* name(Counter c);
+const char* name(Section sec);
+
+
+#ifdef USE_INSTRUMENT
+
+/// Block is the set of counters of one thread. Its words are only written by
+/// the owning thread, so they are atomics just to make reading them from
+/// snapshot() well defined; relaxed loads and stores compile to plain moves.
+struct Block {
+  std::atomic<uint64_t> counters[COUNTER_NB];
+  std::atomic<uint64_t> histograms[SECTION_NB][BUCKET_NB];
+};
+
+Block* attach();
+void record(Section sec, uint64_t elapsed);
+
+inline Block& local() {
+  static thread_local Block* block = nullptr;
+  return *(block ? block : block = attach());
+}
+
+inline void bump(std::atomic<uint64_t>& w, uint64_t n) {
+  w.store(w.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void count(Counter c, uint64_t n = 1) { bump(local().counters[c], n); }
+
+inline uint64_t cycles() {
+
+#  if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#  else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>
+        (std::chrono::steady_clock::now().time_since_epoch()).count();
+#  endif
+}
+
+/// Timer records in the histogram of its section the cycles elapsed between
+/// its construction and its destruction.
+class Timer {
+
+  uint64_t start;
+  Section section;
+
+public:
+  explicit Timer(Section sec) : start(cycles()), section(sec) {}
+ ~Timer() { record(section, cycles() - start); }
+
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+};
+
+#else
+
+inline void count(Counter, uint64_t = 1) {}
+
+class Timer {
+public:
+  explicit Timer(Section) {}
+};
+
+#endif
+
+} // namespace Instrument
+
+#endif // #ifndef INSTRUMENT_H_INCLUDED
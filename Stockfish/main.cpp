@@ -0,0 +1,267 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bitboard.h"
+#include "dedup.h"
+#include "instrument.h"
+#include "mcts.h"
+#include "microbench.h"
+#include "perft.h"
+#include "pgn.h"
+#include "position.h"
+#include "selfplay.h"
+#include "tbprobe.h"
+#include "tt.h"
+
+namespace {
+
+  const char* Usage =
+    "Usage: stockfish bench [threads] [hashMB]\n"
+    "       stockfish perft <depth> [threads] [hashMB] [fen]\n"
+    "       stockfish selfplay <games> <file> [threads] [seed] [syzygyPath]\n"
+    "       stockfish sliders\n"
+    "       stockfish microbench\n"
+    "       stockfish mcts <playouts> [threads] [fen]\n"
+    "       stockfish dedup <first|count> <memoryMB> <output> <input>...\n"
+    "       stockfish pgn <output> <input>...\n";
+
+  int default_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? int(n) : 1;
+  }
+
+  // With instrumentation compiled in, the counters of the run are printed at
+  // its end, in the 'name value' lines of Instrument::print().
+  void report() {
+
+    if (!HasInstrument)
+        return;
+
+    Instrument::Snapshot s;
+    Instrument::snapshot(s);
+    std::cout << "\n";
+    Instrument::print(std::cout, s);
+  }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+
+  Bitboards::init();
+  Position::init();
+
+  std::string cmd = argc > 1 ? argv[1] : "bench";
+
+  if (cmd == "bench")
+  {
+      int threads = argc > 2 ? std::atoi(argv[2]) : default_threads();
+      size_t hashMb = argc > 3 ? size_t(std::atoll(argv[3])) : 0;
+
+      bool ok = Perft::bench(std::max(threads, 1), hashMb);
+      report();
+      return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (cmd == "perft" && argc > 2)
+  {
+      int depth = std::atoi(argv[2]);
+      int threads = argc > 3 ? std::atoi(argv[3]) : default_threads();
+      size_t hashMb = argc > 4 ? size_t(std::atoll(argv[4])) : 0;
+      std::string fen;
+
+      for (int i = 5; i < argc; ++i)
+          fen += std::string(argv[i]) + " ";
+
+      Position pos;
+
+      if (!fen.empty() && pos.fen(fen) != FEN_OK)
+      {
+          std::cerr << "Invalid FEN: " << fen << std::endl;
+          return EXIT_FAILURE;
+      }
+
+      TranspositionTable tt;
+
+      if (hashMb)
+          tt.resize(hashMb);
+
+      auto start = std::chrono::steady_clock::now();
+      uint64_t nodes = Perft::divide(pos, depth, std::max(threads, 1), hashMb ? &tt : nullptr);
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+                    (std::chrono::steady_clock::now() - start).count() + 1;
+
+      std::cout << "\nNodes searched: " << nodes
+                << "\nTime (ms)     : " << elapsed
+                << "\nNodes/second  : " << 1000 * nodes / elapsed << std::endl;
+
+      report();
+      return EXIT_SUCCESS;
+  }
+
+  if (cmd == "selfplay" && argc > 3)
+  {
+      SelfPlay::Limits limits;
+      SelfPlay::Stats stats;
+      limits.games = std::strtoull(argv[2], nullptr, 10);
+      limits.threads = argc > 4 ? std::atoi(argv[4]) : default_threads();
+      limits.seed = argc > 5 ? std::max(std::strtoull(argv[5], nullptr, 10), 1ULL) : 1;
+
+      if (argc > 6)
+          std::cout << "Tablebases    : " << Tablebases::init(argv[6])
+                    << " up to " << Tablebases::MaxCardinality << " pieces" << std::endl;
+
+      auto start = std::chrono::steady_clock::now();
+      bool ok = SelfPlay::play(argv[3], Position(), limits, SelfPlay::uniform, stats);
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+                    (std::chrono::steady_clock::now() - start).count() + 1;
+
+      if (!ok)
+      {
+          std::cerr << "Cannot write " << argv[3] << std::endl;
+          return EXIT_FAILURE;
+      }
+
+      std::cout << "Games         : " << stats.games
+                << "\nPositions     : " << stats.positions
+                << "\nW / D / L     : " << stats.whiteWins << " / " << stats.draws << " / " << stats.blackWins
+                << "\nTime (ms)     : " << elapsed
+                << "\nGames/second  : " << 1000 * stats.games / elapsed << std::endl;
+
+      report();
+      return EXIT_SUCCESS;
+  }
+
+  if (cmd == "sliders")
+      return Bitboards::bench_backends() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  if (cmd == "mcts" && argc > 2)
+  {
+      uint64_t playouts = std::strtoull(argv[2], nullptr, 10);
+      int threads = argc > 3 ? std::atoi(argv[3]) : default_threads();
+      std::string fen;
+
+      for (int i = 4; i < argc; ++i)
+          fen += std::string(argv[i]) + " ";
+
+      Position pos;
+
+      if (!fen.empty() && pos.fen(fen) != FEN_OK)
+      {
+          std::cerr << "Invalid FEN: " << fen << std::endl;
+          return EXIT_FAILURE;
+      }
+
+      // Uniform priors and a null value: the cost measured is all the tree's
+      auto eval = [](const Position&, const ExtMove*, size_t count, float* priors) {
+          std::fill(priors, priors + count, 1.0f);
+          return 0.0f;
+      };
+
+      MCTS::Tree tree(std::max(threads, 1));
+      tree.reset(pos);
+
+      auto start = std::chrono::steady_clock::now();
+      uint64_t done = tree.search(playouts, eval);
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+                    (std::chrono::steady_clock::now() - start).count() + 1;
+
+      std::cout << "Best move     : " << Perft::move(tree.best_move())
+                << "\nPlayouts      : " << done << " (" << playouts - done << " collisions)"
+                << "\nMemory (KB)   : " << tree.memory() / 1024
+                << "\nTime (ms)     : " << elapsed
+                << "\nPlayouts/sec  : " << 1000 * done / elapsed << std::endl;
+
+      report();
+      return EXIT_SUCCESS;
+  }
+
+  if (cmd == "dedup" && argc > 5 && (std::string(argv[2]) == "first" || std::string(argv[2]) == "count"))
+  {
+      Dedup::Options options;
+      Dedup::Stats stats;
+      std::string output = argv[4];
+      size_t slash = output.find_last_of('/');
+
+      options.mode = std::string(argv[2]) == "first" ? Dedup::FIRST : Dedup::COUNT;
+      options.memoryMb = std::max(size_t(std::atoll(argv[3])), size_t(1));
+      options.threads = default_threads();
+      options.tmpDir = slash == std::string::npos ? "." : output.substr(0, slash);
+
+      auto start = std::chrono::steady_clock::now();
+      bool ok = Dedup::run(std::vector<std::string>(argv + 5, argv + argc), output, options, stats);
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+                    (std::chrono::steady_clock::now() - start).count() + 1;
+
+      if (!ok)
+      {
+          std::cerr << "Deduplication into " << output << " failed" << std::endl;
+          return EXIT_FAILURE;
+      }
+
+      std::cout << "Input         : " << stats.input << " (" << stats.invalid << " invalid lines)"
+                << "\nOutput        : " << stats.output
+                << "\nCandidates    : " << stats.candidates << " (" << stats.falsePositives << " false positives)"
+                << "\nRuns          : " << stats.runs
+                << "\nTime (ms)     : " << elapsed
+                << "\nPositions/sec : " << 1000 * stats.input / elapsed << std::endl;
+
+      return EXIT_SUCCESS;
+  }
+
+  if (cmd == "pgn" && argc > 3)
+  {
+      Pgn::Options options;
+      Pgn::Stats stats;
+      options.threads = default_threads();
+
+      auto start = std::chrono::steady_clock::now();
+      bool ok = Pgn::convert(std::vector<std::string>(argv + 3, argv + argc), argv[2], options, stats);
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>
+                    (std::chrono::steady_clock::now() - start).count() + 1;
+
+      if (!ok)
+      {
+          std::cerr << "Conversion into " << argv[2] << " failed" << std::endl;
+          return EXIT_FAILURE;
+      }
+
+      std::cout << "Games         : " << stats.games << " (" << stats.skipped << " skipped)"
+                << "\nPositions     : " << stats.positions
+                << "\nW / D / L     : " << stats.whiteWins << " / " << stats.draws << " / " << stats.blackWins
+                << "\nTime (ms)     : " << elapsed
+                << "\nMB/second     : " << stats.bytes / 1000 / elapsed << std::endl;
+
+      return EXIT_SUCCESS;
+  }
+
+  if (cmd == "microbench")
+      return MicroBench::run(std::cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  std::cerr << Usage;
+  return EXIT_FAILURE;
+}
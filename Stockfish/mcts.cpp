@@ -0,0 +1,375 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+#include "mcts.h"
+
+using namespace MCTS;
+
+namespace {
+
+  const size_t CacheLineSize = 64;
+
+  // Nothing in the arenas is ever destroyed, rewinding just drops it
+  static_assert(std::is_trivially_destructible<Node>::value, "Node must be trivially destructible");
+  static_assert(std::is_trivially_destructible<Edge>::value, "Edge must be trivially destructible");
+
+  size_t aligned(size_t size) { return (size + CacheLineSize - 1) & ~(CacheLineSize - 1); }
+
+  // C++11 has no fetch_add() for atomic floats
+  void add(std::atomic<float>& a, float v) {
+    float old = a.load(std::memory_order_relaxed);
+    while (!a.compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {}
+  }
+
+} // namespace
+
+
+/// Arena::allocate() returns 'size' bytes aligned on a cache line, so that
+/// the objects of different threads never share one. A new chunk, zeroed, is
+/// only taken when all the ones kept from before are used up.
+
+void* Arena::allocate(size_t size) {
+
+  size = aligned(size);
+
+  assert(size <= ChunkSize);
+
+  if (offset + size > ChunkSize || chunks.empty())
+  {
+      if (!chunks.empty())
+          current++, offset = 0;
+
+      if (current == chunks.size())
+      {
+          void* mem = calloc(ChunkSize + CacheLineSize - 1, 1);
+
+          if (!mem)
+              throw std::bad_alloc();
+
+          chunks.push_back(mem);
+      }
+  }
+
+  void* p = top();
+  offset += size;
+  return p;
+}
+
+void Arena::undo(void* p, size_t size) {
+
+  size = aligned(size);
+
+  if (offset >= size && (char*)p + size == top())
+      offset -= size;
+}
+
+char* Arena::top() const {
+  return (char*)((uintptr_t(chunks[current]) + CacheLineSize - 1) & ~(CacheLineSize - 1)) + offset;
+}
+
+Arena::~Arena() {
+
+  for (void* mem : chunks)
+      free(mem);
+}
+
+
+/// Worker is the state of one search thread: its arena and the path of its
+/// current descent, with the keys of the positions along it. 'nodes' are the
+/// inner nodes of the path, 'path' the edges taken from each of them.
+
+struct Tree::Worker {
+  Arena arena;
+  KeyHistory history;
+  std::vector<Node*> nodes;
+  std::vector<Edge*> path;
+};
+
+Tree::Tree(int threads, const Params& p) : params(p), rootNode(nullptr) {
+
+  for (int i = 0; i < std::max(threads, 1); ++i)
+      workers.emplace_back(new Worker());
+
+  reset(Position());
+}
+
+Tree::~Tree() {}
+
+
+void Tree::reset(const Position& root) {
+
+  for (auto& w : workers)
+      w->arena.rewind();
+
+  if (root.history)
+      rootHistory = *root.history;
+  else
+  {
+      rootHistory.start = root.turn;
+      rootHistory.keys[root.turn & (KeyHistory::Size - 1)] = root.hashKey;
+  }
+
+  rootNode = new (workers[0]->arena.allocate(sizeof(Node))) Node(root);
+}
+
+
+bool Tree::advance(Move m) {
+
+  for (int i = 0; rootNode->state == EXPANDED && i < rootNode->edgeCount; ++i)
+  {
+      Edge& e = rootNode->edges[i];
+
+      if (e.move() == m && e.child)
+      {
+          rootNode = e.child;
+          rootHistory.keys[rootNode->pos.turn & (KeyHistory::Size - 1)] = rootNode->pos.hashKey;
+          return true;
+      }
+  }
+
+  // The root history must follow the game, so it goes through a copy that
+  // records the new key before the tree is reset to it.
+  KeyHistory h = rootHistory;
+  Position pos(rootNode->pos);
+  pos.history = &h;
+  pos.move(m);
+  reset(pos);
+  return false;
+}
+
+
+uint64_t Tree::search(uint64_t playouts, const Evaluator& eval) {
+
+  std::atomic<uint64_t> budget(playouts);
+  std::vector<std::thread> threads;
+  std::vector<uint64_t> done(workers.size());
+
+  for (size_t i = 1; i < workers.size(); ++i)
+      threads.emplace_back([&, i] { done[i] = run(*workers[i], budget, eval); });
+
+  done[0] = run(*workers[0], budget, eval);
+
+  for (std::thread& th : threads)
+      th.join();
+
+  uint64_t total = 0;
+  for (uint64_t n : done)
+      total += n;
+
+  return total;
+}
+
+
+Move Tree::best_move() const {
+
+  const Edge* best = nullptr;
+
+  for (int i = 0; rootNode->state == EXPANDED && i < rootNode->edgeCount; ++i)
+  {
+      const Edge& e = rootNode->edges[i];
+
+      if (   !best || e.visits > best->visits
+          || (e.visits == best->visits && e.prior > best->prior))
+          best = &e;
+  }
+
+  return best ? best->move() : MOVE_NONE;
+}
+
+
+size_t Tree::memory() const {
+
+  size_t bytes = 0;
+
+  for (auto& w : workers)
+      bytes += w->arena.used();
+
+  return bytes;
+}
+
+
+/// Tree::run() is the loop of a search thread: it takes playouts out of the
+/// budget until there are none left.
+
+uint64_t Tree::run(Worker& w, std::atomic<uint64_t>& budget, const Evaluator& eval) {
+
+  uint64_t n = 0;
+  w.history = rootHistory;
+
+  for (uint64_t left = budget.load(); left; )
+      if (budget.compare_exchange_weak(left, left - 1))
+      {
+          n += playout(w, eval);
+          left = budget.load();
+      }
+
+  return n;
+}
+
+
+/// Tree::playout() descends from the root, each time along the edge of best
+/// PUCT score with the virtual losses of the other threads counted in, until
+/// it reaches an unexpanded or terminal node. The value found there is then
+/// backed up the path, with the sign flipping at each ply. Returns false if
+/// the descent collided with an expansion in progress and was given up.
+
+bool Tree::playout(Worker& w, const Evaluator& eval) {
+
+  Node* node = rootNode;
+  float value;
+
+  w.path.clear();
+  w.nodes.clear();
+
+  while (true)
+  {
+      w.history.keys[node->pos.turn & (KeyHistory::Size - 1)] = node->pos.hashKey;
+
+      NodeState state = node->state.load(std::memory_order_acquire);
+
+      if (state == UNEXPANDED && node->state.compare_exchange_strong(state, EXPANDING))
+      {
+          value = expand(w, node, eval);
+          break;
+      }
+
+      if (state == TERMINAL)
+      {
+          value = node->terminalValue;
+          break;
+      }
+
+      if (state != EXPANDED)
+      {
+          for (Edge* e : w.path)
+              e->inFlight.fetch_sub(1, std::memory_order_relaxed);
+
+          return false;
+      }
+
+      // PUCT selection. Descents in flight count as losses, both in the value
+      // and in the visits.
+      float sqrtN = std::sqrt(float(node->visits.load(std::memory_order_relaxed) + 1));
+      float vl = float(params.virtualLoss);
+      Edge* best = nullptr;
+      float bestScore = -1e9f;
+
+      for (Edge* e = node->edges; e < node->edges + node->edgeCount; ++e)
+      {
+          float n = float(e->visits.load(std::memory_order_relaxed));
+          float f = vl * float(e->inFlight.load(std::memory_order_relaxed));
+          float q = n + f > 0 ? (e->valueSum.load(std::memory_order_relaxed) - f) / (n + f) : params.fpu;
+          float score = q + params.cpuct * e->prior * sqrtN / (1 + n + f);
+
+          if (score > bestScore)
+              bestScore = score, best = e;
+      }
+
+      best->inFlight.fetch_add(1, std::memory_order_relaxed);
+      w.path.push_back(best);
+      w.nodes.push_back(node);
+
+      Node* child = best->child.load(std::memory_order_acquire);
+
+      // First visit of the move: the position is made now. If another thread
+      // got there first, ours is dropped, and as it is the last allocation of
+      // our arena its memory is given back at once.
+      if (!child)
+      {
+          Node* fresh = new (w.arena.allocate(sizeof(Node))) Node(node->pos, best->move());
+
+          if (best->child.compare_exchange_strong(child, fresh, std::memory_order_acq_rel))
+              child = fresh;
+          else
+              w.arena.undo(fresh, sizeof(Node));
+      }
+
+      node = child;
+  }
+
+  // Backup. 'value' is for the side to move at the leaf, edges hold it for
+  // the side making their move.
+  node->visits.fetch_add(1, std::memory_order_relaxed);
+
+  for (auto it = w.path.rbegin(); it != w.path.rend(); ++it)
+  {
+      value = -value;
+      (*it)->visits.fetch_add(1, std::memory_order_relaxed);
+      add((*it)->valueSum, value);
+      (*it)->inFlight.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  for (Node* n : w.nodes)
+      n->visits.fetch_add(1, std::memory_order_relaxed);
+
+  return true;
+}
+
+
+/// Tree::expand() is called by the one thread that set the node to EXPANDING.
+/// It returns the value of the node for its side to move: from the evaluator,
+/// unless the game is over there. Edges are published by the release store
+/// of the new state.
+
+float Tree::expand(Worker& w, Node* node, const Evaluator& eval) {
+
+  // Draws need the keys of the path, which only the copy can point to
+  Position pos = node->pos;
+  pos.history = &w.history;
+
+  MoveList<LEGAL> moves(node->pos);
+
+  if (pos.is_draw() || !moves.size())
+  {
+      node->terminalValue = moves.size() || !pos.checkers() ? 0.0f : -1.0f;
+      node->state.store(TERMINAL, std::memory_order_release);
+      return node->terminalValue;
+  }
+
+  float priors[MAX_MOVES];
+  float value = eval(node->pos, moves.begin(), moves.size(), priors);
+  float sum = 0;
+
+  for (size_t i = 0; i < moves.size(); ++i)
+      sum += priors[i] = std::max(priors[i], 0.0f);
+
+  Edge* edges = (Edge*)w.arena.allocate(moves.size() * sizeof(Edge));
+
+  for (size_t i = 0; i < moves.size(); ++i)
+  {
+      Edge* e = new (edges + i) Edge();
+      e->move16 = uint16_t(moves.begin()[i].move);
+      e->prior = sum > 0 ? priors[i] / sum : 1.0f / moves.size();
+  }
+
+  node->edges = edges;
+  node->edgeCount = int(moves.size());
+  node->state.store(EXPANDED, std::memory_order_release);
+
+  return std::max(-1.0f, std::min(value, 1.0f));
+}
@@ -0,0 +1,177 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MCTS_H_INCLUDED
+#define MCTS_H_INCLUDED
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "movegen.h"
+#include "position.h"
+
+namespace MCTS {
+
+/// An Evaluator fills 'priors' with a non-negative, not necessarily normalized,
+/// probability for each of the 'count' legal moves of 'pos' and returns the
+/// value of the position for the side to move, in [-1, 1]. It is called
+/// concurrently by all the search threads, so it must not touch shared state
+/// without its own synchronization.
+typedef std::function<float(const Position& pos, const ExtMove* moves, size_t count, float* priors)> Evaluator;
+
+/// Arena hands out memory from a list of large chunks by bumping a pointer.
+/// Nothing is freed but the last allocation, all the rest goes at once with
+/// rewind(), which keeps the chunks for the next use: once warmed up, the
+/// tree does no heap allocation at all. An arena is used by one thread.
+
+class Arena {
+public:
+  static const size_t ChunkSize = 1 << 20;
+
+  Arena() : current(0), offset(0) {}
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+ ~Arena();
+
+  void* allocate(size_t size);
+  void undo(void* p, size_t size); // Frees 'p' if it is the last allocation
+  void rewind() { current = offset = 0; }
+  size_t used() const { return current * ChunkSize + offset; }
+
+private:
+  char* top() const;
+
+  std::vector<void*> chunks; // As returned by calloc(), before alignment
+  size_t current, offset;
+};
+
+struct Node;
+
+/// An Edge is a legal move of the position of its node, with the statistics
+/// of the subtree below it. They live in the edge array of the node, so that
+/// selection scans contiguous memory and touches no child node. The values
+/// are from the point of view of the side making the move.
+
+struct Edge {
+
+  Move move() const { return Move(move16); }
+
+  std::atomic<Node*> child;       // Null until the move is first visited
+  float prior;
+  std::atomic<float> valueSum;
+  std::atomic<uint32_t> visits;
+  uint16_t move16;
+  std::atomic<uint16_t> inFlight; // Descents under way, the virtual loss
+};
+
+static_assert(sizeof(Edge) == 24, "Edge should take 24 bytes");
+
+/// A Node is created when its move is first visited, and only then holds a
+/// copy of its position, made with Position(parent, move). Its edges are
+/// allocated in one go, sized from MoveList<LEGAL>, when the node is expanded.
+/// Positions in the tree have no key history: repetitions are detected along
+/// the path of each descent, which in a tree is unique to the node.
+
+enum NodeState : uint8_t {
+  UNEXPANDED, EXPANDING, EXPANDED, TERMINAL
+};
+
+struct Node {
+
+  explicit Node(const Position& p)
+    : pos(p), edges(nullptr), edgeCount(0), terminalValue(0), visits(0), state(UNEXPANDED) {
+    pos.history = nullptr;
+  }
+
+  Node(const Position& parent, Move m)
+    : pos(parent, m), edges(nullptr), edgeCount(0), terminalValue(0), visits(0), state(UNEXPANDED) {
+    assert(!parent.history);
+  }
+
+  Position pos;
+  Edge* edges;
+  int edgeCount;
+  float terminalValue;          // For the side to move, if TERMINAL
+  std::atomic<uint32_t> visits; // Playouts that went through the node
+  std::atomic<NodeState> state;
+};
+
+struct Params {
+  float cpuct       = 1.5f;
+  float fpu         = 0.0f; // Value assumed for unvisited moves
+  int   virtualLoss = 1;    // Losses counted for each descent in flight
+};
+
+/// Tree is a PUCT search tree. search() runs playouts on several threads at
+/// once, each with its own arena for the nodes and edges it creates, and each
+/// descent adds virtual losses on its path so that the threads spread over
+/// the tree. A thread that reaches a node being expanded by another one gives
+/// up that playout and starts a new one.
+///
+/// Between moves, advance() makes a child the new root in O(1). The nodes
+/// left out are only reclaimed by reset(), which is O(1) too: the arenas are
+/// just rewound. Callers tracking a game call advance() at every move and
+/// reset() whenever memory() goes over their budget.
+
+class Tree {
+public:
+  explicit Tree(int threads = 1, const Params& params = Params());
+  Tree(const Tree&) = delete;
+  Tree& operator=(const Tree&) = delete;
+ ~Tree();
+
+  /// reset() discards the tree and sets a new root. If 'root' has a key
+  /// history, it is copied for repetition detection.
+  void reset(const Position& root);
+
+  /// advance() moves the root to the child of move 'm', keeping its subtree.
+  /// Returns false if that child did not exist and the tree was reset to it.
+  bool advance(Move m);
+
+  /// search() runs 'playouts' more playouts. Threads never exceed the count
+  /// given to the constructor. Returns the number of playouts completed, which
+  /// excludes the ones given up on a collision.
+  uint64_t search(uint64_t playouts, const Evaluator& eval);
+
+  const Node& root() const { return *rootNode; }
+  Move best_move() const; // Most visited move, MOVE_NONE if none
+  size_t memory() const;  // Bytes used in the arenas
+
+private:
+  struct Worker;
+
+  uint64_t run(Worker& w, std::atomic<uint64_t>& budget, const Evaluator& eval);
+  bool playout(Worker& w, const Evaluator& eval);
+  float expand(Worker& w, Node* node, const Evaluator& eval);
+
+  Params params;
+  std::vector<std::unique_ptr<Worker>> workers;
+  Node* rootNode;
+  KeyHistory rootHistory;
+};
+
+} // namespace MCTS
+
+#endif // #ifndef MCTS_H_INCLUDED
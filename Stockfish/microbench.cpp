@@ -0,0 +1,412 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "bitboard.h"
+#include "incremental.h"
+#include "instrument.h"
+#include "microbench.h"
+#include "misc.h"
+#include "movegen.h"
+#include "perft.h"
+#include "position.h"
+
+namespace {
+
+  struct Entry {
+    const char* corpus;
+    const char* fen;
+    uint64_t perft3; // Leaf nodes at depth 3, the correctness guard
+  };
+
+  const int AccumulatorWidth = 256; // Typical of the first layer of an NNUE network
+
+  const Entry Corpus[] = {
+    { "opening", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 8902 },
+    { "opening", "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3", 24079 },
+    { "opening", "rnbqkb1r/pp1p1ppp/4pn2/2p5/2PP4/2N5/PP2PPPP/R1BQKBNR w KQkq - 0 4", 30078 },
+    { "opening", "rnbqkb1r/ppp1pppp/5n2/3p4/3P4/5N2/PPP1PPPP/RNBQKB1R w KQkq - 2 3", 24742 },
+    { "opening", "r1bqk2r/pppp1ppp/2n2n2/2b1p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4", 37080 },
+    { "middlegame", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 97862 },
+    { "middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 89890 },
+    { "middlegame", "2rq1rk1/pb1nbppp/1p2pn2/2pp4/2PP4/1P2PN2/PB1NBPPP/2RQ1RK1 w - - 0 11", 24089 },
+    { "middlegame", "r2qr1k1/1b1nbppp/p2p1n2/1pp1p3/4P3/2PP1N1P/PPBN1PP1/R1BQR1K1 w - - 0 12", 27970 },
+    { "middlegame", "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R1BQKB1R w KQ - 0 8", 41795 },
+    { "endgame", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 2812 },
+    { "endgame", "8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1", 1266 },
+    { "endgame", "8/P1k5/K7/8/8/8/8/8 w - - 0 1", 273 },
+    { "endgame", "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1", 3029 },
+    { "endgame", "8/5k2/3p4/1p1Pp2p/pP2Pp1P/P4P1K/8/8 b - - 99 50", 76 },
+    { "checks", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 9467 },
+    { "checks", "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 9467 },
+    { "checks", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 62379 },
+    { "checks", "4k3/8/8/8/1b6/8/8/R3K2R w KQ - 0 1", 1475 },
+    { "checks", "4k3/8/8/8/8/5n2/8/r3K3 w - - 0 1", 239 },
+    { "checks", "rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3", 0 }
+  };
+
+  const char* Corpora[] = { "opening", "middlegame", "endgame", "checks" };
+
+  const std::chrono::milliseconds MinTime(5);
+  const int Rounds = 5;
+
+  volatile uint64_t Sink; // Keeps the timed results alive
+
+  // measure() repeats 'pass', which does 'ops' operations and returns their
+  // checksum, until a round lasts at least MinTime. Then it returns the
+  // fastest of Rounds such rounds, in ns per operation.
+  template<typename F>
+  double measure(F pass, size_t ops) {
+
+    typedef std::chrono::steady_clock Clock;
+
+    size_t reps = 1;
+    auto round = [&]() {
+
+        auto start = Clock::now();
+
+        for (size_t i = 0; i < reps; ++i)
+            Sink = Sink + pass();
+
+        return Clock::now() - start;
+    };
+
+    while (round() < MinTime)
+        reps *= 2;
+
+    double best = std::numeric_limits<double>::max();
+
+    for (int r = 0; r < Rounds; ++r)
+        best = std::min(best, std::chrono::duration<double, std::nano>(round()).count());
+
+    return best / double(reps * std::max(ops, size_t(1)));
+  }
+
+  // The output helpers, the strings written here never need JSON escaping
+
+  std::string json(const char* key, const std::string& value, bool last = false) {
+    return std::string("\"") + key + "\":\"" + value + "\"" + (last ? "" : ",");
+  }
+
+  std::string json(const char* key, uint64_t value, bool last = false) {
+    return std::string("\"") + key + "\":" + std::to_string(value) + (last ? "" : ",");
+  }
+
+  std::string json(const char* key, bool value, bool last = false) {
+    return std::string("\"") + key + "\":" + (value ? "true" : "false") + (last ? "" : ",");
+  }
+
+  std::string hex(uint64_t v) {
+    char buf[20];
+    std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)v);
+    return buf;
+  }
+
+  std::string compiler() {
+
+#if defined(__clang__) || defined(__GNUC__)
+    return std::string(__VERSION__);
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+  }
+
+  template<typename F>
+  uint64_t bench(std::ostream& os, const std::string& name, const std::string& variant,
+                 const char* corpus, F pass, size_t ops) {
+
+    uint64_t checksum = pass();
+    double ns = measure(pass, ops);
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3f", ns);
+
+    os << "{" << json("bench", name) << json("variant", variant) << json("corpus", std::string(corpus))
+       << "\"ns_per_op\":" << buf << "," << json("ops", uint64_t(ops))
+       << json("checksum", hex(checksum), true) << "}" << std::endl;
+
+    return checksum;
+  }
+
+  // A position of the corpus together with the moves to feed to legal() and
+  // the ones to play: its pseudo-legal and its legal moves.
+  struct Sample {
+    const char* corpus;
+    Position pos;
+    std::vector<Move> pseudo, legal;
+  };
+
+  template<GenType Type>
+  uint64_t bench_generate(std::ostream& os, const char* name, const char* corpus,
+                          const std::vector<Sample*>& set) {
+
+    if (set.empty())
+        return 0;
+
+    auto pass = [&]() {
+        ExtMove list[MAX_MOVES];
+        uint64_t n = 0;
+        for (const Sample* s : set)
+            n += generate<Type>(s->pos, list) - list;
+        return n;
+    };
+
+    return bench(os, name, "", corpus, pass, set.size());
+  }
+
+} // namespace
+
+
+bool MicroBench::run(std::ostream& os) {
+
+  std::vector<Sample> samples;
+  std::vector<Bitboard> bitboards;
+  bool ok = true;
+
+  os << "{" << json("build", std::string("microbench")) << json("compiler", compiler())
+     << json("popcnt", HasPopCnt) << json("pext", HasPext)
+     << json("pext_dispatch", HasPextDispatch) << json("64bit", Is64Bit)
+     << json("instrument", HasInstrument)
+     << json("best_backend", std::string(Bitboards::backend_name(Bitboards::best_backend())), true)
+     << "}" << std::endl;
+
+  for (const Entry& e : Corpus)
+  {
+      Sample s;
+      s.corpus = e.corpus;
+      s.pos.fen(e.fen);
+
+      ExtMove list[MAX_MOVES];
+      ExtMove* end = s.pos.checkers() ? generate<EVASIONS>(s.pos, list)
+                                       : generate<NON_EVASIONS>(s.pos, list);
+      for (ExtMove* m = list; m < end; ++m)
+          s.pseudo.push_back(*m);
+
+      for (const ExtMove& m : MoveList<LEGAL>(s.pos))
+          s.legal.push_back(m);
+
+      // The non-empty bitboards of the position for the bit primitives
+      for (Color c = WHITE; c <= BLACK; ++c)
+          for (PieceType pt = ALL_PIECES; pt <= KING; ++pt)
+              if (s.pos.pieces(c, pt))
+                  bitboards.push_back(s.pos.pieces(c, pt));
+
+      bitboards.push_back(s.pos.pieces());
+      samples.push_back(s);
+  }
+
+  // Bit primitives, on all the corpus at once. The fall-backs must give the
+  // same checksums as the paths of this build.
+  size_t nb = bitboards.size();
+  const std::string popcountPath = HasPopCnt ? "popcnt" : "table";
+
+#ifdef NO_BSF
+  const std::string bitscanPath = "table";
+#else
+  const std::string bitscanPath = "builtin";
+#endif
+
+  auto pass_popcount = [&]() { uint64_t n = 0; for (Bitboard b : bitboards) n += popcount(b); return n; };
+  auto pass_soft_popcount = [&]() { uint64_t n = 0; for (Bitboard b : bitboards) n += soft_popcount(b); return n; };
+  auto pass_lsb = [&]() { uint64_t n = 0; for (Bitboard b : bitboards) n = n * 31 + lsb(b); return n; };
+  auto pass_soft_lsb = [&]() { uint64_t n = 0; for (Bitboard b : bitboards) n = n * 31 + soft_lsb(b); return n; };
+  auto pass_msb = [&]() { uint64_t n = 0; for (Bitboard b : bitboards) n = n * 31 + msb(b); return n; };
+  auto pass_soft_msb = [&]() { uint64_t n = 0; for (Bitboard b : bitboards) n = n * 31 + soft_msb(b); return n; };
+
+  ok &=    bench(os, "popcount", popcountPath, "all", pass_popcount, nb)
+        == bench(os, "popcount", "soft", "all", pass_soft_popcount, nb);
+  ok &=    bench(os, "lsb", bitscanPath, "all", pass_lsb, nb)
+        == bench(os, "lsb", "soft", "all", pass_soft_lsb, nb);
+  ok &=    bench(os, "msb", bitscanPath, "all", pass_msb, nb)
+        == bench(os, "msb", "soft", "all", pass_soft_msb, nb);
+
+  // Slider lookups from every square with the occupancy of every position, in
+  // each backend the CPU supports. All backends must agree.
+  uint64_t rookSum = 0, bishopSum = 0;
+  bool first = true;
+
+  for (int i = 0; i < SLIDER_BACKEND_NB; ++i)
+  {
+      SliderBackend b = SliderBackend(i);
+
+      if (!Bitboards::set_backend(b))
+          continue;
+
+      auto pass_rook = [&]() {
+          uint64_t n = 0;
+          for (const Sample& s : samples)
+              for (Square sq = SQ_A1; sq <= SQ_H8; ++sq)
+                  n += attacks_bb<ROOK>(sq, s.pos.pieces());
+          return n;
+      };
+
+      auto pass_bishop = [&]() {
+          uint64_t n = 0;
+          for (const Sample& s : samples)
+              for (Square sq = SQ_A1; sq <= SQ_H8; ++sq)
+                  n += attacks_bb<BISHOP>(sq, s.pos.pieces());
+          return n;
+      };
+
+      uint64_t r = bench(os, "attacks_bb<ROOK>", Bitboards::backend_name(b), "all", pass_rook, 64 * samples.size());
+      uint64_t bs = bench(os, "attacks_bb<BISHOP>", Bitboards::backend_name(b), "all", pass_bishop, 64 * samples.size());
+
+      ok &= first || (r == rookSum && bs == bishopSum);
+      rookSum = r, bishopSum = bs, first = false;
+  }
+
+  Bitboards::set_backend(Bitboards::best_backend());
+
+  // Random first layer weights for the accumulator benchmarks
+  std::vector<int16_t> weights(int(PIECE_NB) * int(SQUARE_NB) * AccumulatorWidth);
+  PRNG rng(1070372);
+
+  for (int16_t& w : weights)
+      w = int16_t(rng.rand<uint64_t>() % 255) - 127;
+
+  Incremental::Accumulator acc(weights.data(), AccumulatorWidth);
+
+  // Generators and move primitives, per corpus
+  for (const char* corpus : Corpora)
+  {
+      std::vector<Sample*> inCheck, quiet, all;
+      size_t pseudoMoves = 0, legalMoves = 0;
+
+      for (Sample& s : samples)
+          if (std::string(s.corpus) == corpus)
+          {
+              (s.pos.checkers() ? inCheck : quiet).push_back(&s);
+              all.push_back(&s);
+              pseudoMoves += s.pseudo.size();
+              legalMoves += s.legal.size();
+          }
+
+      bench_generate<CAPTURES    >(os, "generate<CAPTURES>", corpus, quiet);
+      bench_generate<QUIETS      >(os, "generate<QUIETS>", corpus, quiet);
+      bench_generate<QUIET_CHECKS>(os, "generate<QUIET_CHECKS>", corpus, quiet);
+      bench_generate<EVASIONS    >(os, "generate<EVASIONS>", corpus, inCheck);
+      bench_generate<NON_EVASIONS>(os, "generate<NON_EVASIONS>", corpus, quiet);
+      ok &= bench_generate<LEGAL>(os, "generate<LEGAL>", corpus, all) == legalMoves;
+
+      auto pass_legal = [&]() {
+          uint64_t n = 0;
+          for (const Sample* s : all)
+              for (Move m : s->pseudo)
+                  n += s->pos.legal(m);
+          return n;
+      };
+
+      auto pass_gives_check = [&]() {
+          uint64_t n = 0;
+          for (const Sample* s : all)
+              for (Move m : s->legal)
+                  n += s->pos.gives_check(m);
+          return n;
+      };
+
+      auto pass_move = [&]() {
+          uint64_t n = 0;
+          for (const Sample* s : all)
+              for (Move m : s->legal)
+                  n ^= Position(s->pos, m).hashKey;
+          return n;
+      };
+
+      auto pass_do_undo = [&]() {
+          uint64_t n = 0;
+          StateInfo st;
+          for (Sample* s : all)
+              for (Move m : s->legal)
+              {
+                  s->pos.do_move(m, st);
+                  n ^= s->pos.hashKey;
+                  s->pos.undo_move(m, st);
+              }
+          return n;
+      };
+
+      ok &= bench(os, "legal", "", corpus, pass_legal, pseudoMoves) == legalMoves;
+      bench(os, "gives_check", "", corpus, pass_gives_check, legalMoves);
+      ok &=    bench(os, "move", "copy", corpus, pass_move, legalMoves)
+            == bench(os, "move", "do_undo", corpus, pass_do_undo, legalMoves);
+
+      // The accumulator after each move, summed from scratch or updated from
+      // the dirty pieces of the move. Both must give the same sums.
+      auto pass_refresh = [&]() {
+          uint64_t n = 0;
+          StateInfo st;
+          for (Sample* s : all)
+              for (Move m : s->legal)
+              {
+                  s->pos.do_move(m, st);
+                  acc.reset(s->pos);
+                  n = n * 31 + uint64_t(acc.values()[0] + acc.values()[AccumulatorWidth - 1]);
+                  s->pos.undo_move(m, st);
+              }
+          return n;
+      };
+
+      auto pass_incremental = [&]() {
+          uint64_t n = 0;
+          StateInfo st;
+          DirtyPiece dp;
+          for (Sample* s : all)
+          {
+              acc.reset(s->pos);
+
+              for (Move m : s->legal)
+              {
+                  s->pos.do_move(m, st, &dp);
+                  acc.apply(dp);
+                  n = n * 31 + uint64_t(acc.values()[0] + acc.values()[AccumulatorWidth - 1]);
+                  s->pos.undo_move(m, st);
+                  acc.undo();
+              }
+          }
+          return n;
+      };
+
+      ok &=    bench(os, "accumulator", "refresh", corpus, pass_refresh, legalMoves)
+            == bench(os, "accumulator", "incremental", corpus, pass_incremental, legalMoves);
+  }
+
+  // Perft to depth 3 of the whole corpus, the correctness guard of all the
+  // generation and move making paths above.
+  for (const Entry& e : Corpus)
+  {
+      uint64_t nodes = Perft::perft(Position(e.fen), 3);
+      ok &= nodes == e.perft3;
+
+      os << "{" << json("perft", std::string(e.fen)) << json("corpus", std::string(e.corpus))
+         << json("depth", uint64_t(3)) << json("nodes", nodes) << json("expected", e.perft3)
+         << json("ok", nodes == e.perft3, true) << "}" << std::endl;
+  }
+
+  os << "{" << json("result", std::string(ok ? "ok" : "FAILED"), true) << "}" << std::endl;
+
+  return ok;
+}
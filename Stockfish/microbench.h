@@ -0,0 +1,44 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MICROBENCH_H_INCLUDED
+#define MICROBENCH_H_INCLUDED
+
+#include <ostream>
+
+namespace MicroBench {
+
+/// run() times, one at a time, the primitives of the library on a fixed
+/// corpus of opening, middlegame, endgame and check-heavy positions:
+/// popcount(), lsb() and msb() as built and their table based fall-backs,
+/// attacks_bb() with each slider backend the CPU supports, each generate<>,
+/// legal(), gives_check(), move() and do_move() / undo_move().
+///
+/// The output is one JSON object per line, for tracking across compilers and
+/// CPUs: a "build" line first, then one "bench" line per timing, with the
+/// fastest of several rounds in ns per operation and a checksum of the
+/// results, then a "perft" line per position and a final "result" line.
+/// Alternative paths of a primitive must give the same checksum and the perft
+/// counts must match: run() returns false otherwise.
+bool run(std::ostream& os);
+
+} // namespace MicroBench
+
+#endif // #ifndef MICROBENCH_H_INCLUDED
@@ -15,8 +15,10 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
 
+#include "instrument.h"
 #include "movegen.h"
 #include "position.h"
 
@@ -35,15 +37,16 @@ namespace {
     Square kfrom = pos.square<KING>(us);
     Square rfrom = pos.castling_rook_square(Cr);
     Square kto = relative_square(us, KingSide ? SQ_G1 : SQ_C1);
-    Bitboard enemies = pos.pieces(~us);
 
     assert(!pos.checkers());
 
-    const Square K = KingSide ? WEST : EAST;
+    if (pos.attacks_by(~us) & (between_bb(kfrom, kto) | kto))
+        return moveList;
 
-    for (Square s = kto; s != kfrom; s += K)
-        if (pos.attackers_to(s) & enemies)
-            return moveList;
+    // In Chess960 the castling rook may have been shielding the king
+    // destination from an enemy rook or queen on the first rank.
+    if (attacks_bb<ROOK>(kto, pos.pieces() ^ rfrom) & pos.pieces(~us, ROOK, QUEEN))
+        return moveList;
 
     Move m = make<CASTLING>(kfrom, rfrom);
 
@@ -58,10 +61,10 @@ namespace {
   template<GenType Type, Square D>
   ExtMove* make_promotions(ExtMove* moveList, Square to, Square ksq) {
 
-    if (Type == CAPTURES || Type == EVASIONS || Type == NON_EVASIONS)
+    if (Type == CAPTURES || Type == EVASIONS || Type == NON_EVASIONS || Type == LEGAL)
         *moveList++ = make<PROMOTION>(to - D, to, QUEEN);
 
-    if (Type == QUIETS || Type == EVASIONS || Type == NON_EVASIONS)
+    if (Type == QUIETS || Type == EVASIONS || Type == NON_EVASIONS || Type == LEGAL)
     {
         *moveList++ = make<PROMOTION>(to - D, to, ROOK);
         *moveList++ = make<PROMOTION>(to - D, to, BISHOP);
@@ -221,10 +224,12 @@ namespace {
 
     assert(Pt != KING && Pt != PAWN);
 
-    const Square* pl = pos.squares<Pt>(us);
+    Bitboard bb = pos.pieces(us, Pt);
 
-    for (Square from = *pl; from != SQ_NONE; from = *++pl)
+    while (bb)
     {
+        Square from = pop_lsb(&bb);
+
         if (Checks)
         {
             if (    (Pt == BISHOP || Pt == ROOK || Pt == QUEEN)
@@ -276,6 +281,247 @@ namespace {
     return moveList;
   }
 
+
+  // MoveSink and CountSink are the two outputs of legal_moves(). Moves come
+  // in as target bitboards, set-wise for pawns with the pawn step D, so that
+  // counting is a popcount, and MoveSink expands them in generation order.
+  // Promotion targets count for the four promotion pieces.
+
+  struct MoveSink {
+
+    explicit MoveSink(ExtMove* list) : moveList(list) {}
+
+    bool done() const { return false; }
+
+    void piece(PieceType, Square from, Bitboard to) {
+      while (to)
+          *moveList++ = make_move(from, pop_lsb(&to));
+    }
+
+    template<Square D> void pawns(Bitboard to) {
+      while (to)
+      {
+          Square s = pop_lsb(&to);
+          *moveList++ = make_move(s - D, s);
+      }
+    }
+
+    template<Square D> void promotions(Bitboard to, Square ksq) {
+      while (to)
+          moveList = make_promotions<LEGAL, D>(moveList, pop_lsb(&to), ksq);
+    }
+
+    void promotions(Square from, Bitboard to) {
+      while (to)
+      {
+          Square s = pop_lsb(&to);
+          for (PieceType pt = QUEEN; pt >= KNIGHT; --pt)
+              *moveList++ = make<PROMOTION>(from, s, pt);
+      }
+    }
+
+    void special(PieceType, Move m) { *moveList++ = m; }
+
+    ExtMove* moveList;
+  };
+
+  // CountSink counts the moves of each moving piece type, the total being
+  // kept in ALL_PIECES. With Any set the generator stops at the first move.
+  template<bool Any>
+  struct CountSink {
+
+    CountSink() : counts() {}
+
+    bool done() const { return Any && counts[ALL_PIECES]; }
+
+    void add(PieceType pt, int n) { counts[pt] += n, counts[ALL_PIECES] += n; }
+
+    void piece(PieceType pt, Square, Bitboard to) { add(pt, popcount(to)); }
+
+    template<Square D> void pawns(Bitboard to) { add(PAWN, popcount(to)); }
+
+    template<Square D> void promotions(Bitboard to, Square) { add(PAWN, 4 * popcount(to)); }
+
+    void promotions(Square, Bitboard to) { add(PAWN, 4 * popcount(to)); }
+
+    void special(PieceType pt, Move) { add(pt, 1); }
+
+    int counts[PIECE_TYPE_NB];
+  };
+
+
+  // legal_moves() generates only legal moves, so that nothing has to be
+  // filtered afterwards. The king steps to the squares not in the enemy attack
+  // map, extended beyond our king along the checking rays so that it can't
+  // retreat along them. The other pieces must land in the check mask, the checker and the
+  // squares between it and the king, and pinned pieces stay on their pin ray.
+  // A pinned piece can never resolve a check, so in check they don't move at
+  // all. Only en passant, which can uncover a check on the rank through two
+  // pawns at once, is still verified with Position::legal().
+  template<Color Us, typename Sink>
+  void legal_moves(const Position& pos, Sink& sink) {
+
+    const Color    Them     = (Us == WHITE ? BLACK      : WHITE);
+    const Bitboard TRank7BB = (Us == WHITE ? Rank7BB    : Rank2BB);
+    const Bitboard TRank3BB = (Us == WHITE ? Rank3BB    : Rank6BB);
+    const Square   Up       = (Us == WHITE ? NORTH      : SOUTH);
+    const Square   Right    = (Us == WHITE ? NORTH_EAST : SOUTH_WEST);
+    const Square   Left     = (Us == WHITE ? NORTH_WEST : SOUTH_EAST);
+
+    Square ksq = pos.square<KING>(Us);
+    Bitboard occupied = pos.pieces();
+    Bitboard checkers = pos.checkers();
+    Bitboard attacked = pos.attacks_by(Them);
+
+    // Extend the rays of the checking sliders beyond our king, so that it
+    // can't step back along them. Only squares next to the king matter, and
+    // on such a line they are the checker and the square behind the king.
+    for (Bitboard b = checkers & ~pos.pieces(KNIGHT, PAWN); b; )
+    {
+        Square s = pop_lsb(&b);
+        attacked |= LineBB[s][ksq] ^ s;
+    }
+
+    sink.piece(KING, ksq, pos.attacks_from<KING>(ksq) & ~pos.pieces(Us) & ~attacked);
+
+    if (more_than_one(checkers) || sink.done())
+        return; // Double check, only a king move can save the day
+
+    Bitboard checkMask = checkers ? between_bb(lsb(checkers), ksq) | checkers : ~Bitboard(0);
+    Bitboard pinned = pos.pinned_pieces(Us);
+    Bitboard movable = checkers ? ~pinned : ~Bitboard(0);
+    Bitboard target = ~pos.pieces(Us) & checkMask;
+    Bitboard enemies = pos.pieces(Them) & checkMask;
+    Bitboard emptySquares = ~occupied;
+
+    // Pawns not pinned, set-wise as in generate_pawn_moves()
+    Bitboard pawns = pos.pieces(Us, PAWN) & ~pinned;
+    Bitboard pawnsOn7 = pawns & TRank7BB, pawnsNotOn7 = pawns & ~TRank7BB;
+
+    Bitboard b1 = shift<Up>(pawnsNotOn7) & emptySquares;
+    Bitboard b2 = shift<Up>(b1 & TRank3BB) & emptySquares & checkMask;
+
+    sink.template pawns<Up>(b1 & checkMask);
+    sink.template pawns<Square(2 * int(Up))>(b2);
+    sink.template pawns<Right>(shift<Right>(pawnsNotOn7) & enemies);
+    sink.template pawns<Left >(shift<Left >(pawnsNotOn7) & enemies);
+
+    if (pawnsOn7)
+    {
+        sink.template promotions<Right>(shift<Right>(pawnsOn7) & enemies, ksq);
+        sink.template promotions<Left >(shift<Left >(pawnsOn7) & enemies, ksq);
+        sink.template promotions<Up   >(shift<Up>(pawnsOn7) & emptySquares & checkMask, ksq);
+    }
+
+    // Pinned pawns, one at a time as they are rare. Not in check here.
+    Bitboard b = pos.pieces(Us, PAWN) & pinned & movable;
+    while (b)
+    {
+        Square from = pop_lsb(&b);
+        Bitboard push = shift<Up>(SquareBB[from]) & emptySquares;
+        Bitboard to = (  push | (shift<Up>(push & TRank3BB) & emptySquares)
+                       | (pos.attacks_from<PAWN>(from, Us) & enemies)) & LineBB[ksq][from];
+
+        if (relative_rank(Us, from) == RANK_7)
+            sink.promotions(from, to);
+        else
+            sink.piece(PAWN, from, to);
+    }
+
+    // En passant, legal if it removes the checker: the double pushed pawn
+    if (pos.epSquare != SQ_NONE && (checkMask & (pos.epSquare - Up)))
+    {
+        b = pos.pieces(Us, PAWN) & pos.attacks_from<PAWN>(pos.epSquare, Them);
+
+        while (b)
+        {
+            Move m = make<ENPASSANT>(pop_lsb(&b), pos.epSquare);
+
+            if (pos.legal(m))
+                sink.special(PAWN, m);
+        }
+    }
+
+    if (sink.done())
+        return;
+
+    // Knights, pinned ones can't move at all
+    b = pos.pieces(Us, KNIGHT) & ~pinned;
+    while (b)
+    {
+        Square from = pop_lsb(&b);
+        sink.piece(KNIGHT, from, pos.attacks_from<KNIGHT>(from) & target);
+    }
+
+    b = pos.pieces(Us, BISHOP, QUEEN) & movable;
+    while (b)
+    {
+        Square from = pop_lsb(&b);
+        Bitboard to = attacks_bb<BISHOP>(from, occupied) & target;
+
+        if (pinned & from)
+            to &= LineBB[ksq][from];
+
+        sink.piece(type_of(pos.piece_on(from)), from, to);
+    }
+
+    b = pos.pieces(Us, ROOK, QUEEN) & movable;
+    while (b)
+    {
+        Square from = pop_lsb(&b);
+        Bitboard to = attacks_bb<ROOK>(from, occupied) & target;
+
+        if (pinned & from)
+            to &= LineBB[ksq][from];
+
+        sink.piece(type_of(pos.piece_on(from)), from, to);
+    }
+
+    if (sink.done())
+        return;
+
+    // Castling, the king path is checked against the attack map, which is the
+    // plain one as we are not in check.
+    if (!checkers && pos.can_castle(Us))
+        for (int i = KING_SIDE; i <= QUEEN_SIDE; ++i)
+        {
+            CastlingSide cs = CastlingSide(i);
+            CastlingRight cr = Us | cs;
+
+            if (!pos.can_castle(cr) || pos.castling_impeded(cr))
+                continue;
+
+            Square rfrom = pos.castling_rook_square(cr);
+            Square kto = relative_square(Us, cs == KING_SIDE ? SQ_G1 : SQ_C1);
+
+            // In Chess960 the castling rook may have been shielding the king
+            // destination from an enemy rook or queen on the first rank.
+            if (   !((between_bb(ksq, kto) | kto) & attacked)
+                && !(attacks_bb<ROOK>(kto, occupied ^ rfrom) & pos.pieces(Them, ROOK, QUEEN)))
+                sink.special(KING, make<CASTLING>(ksq, rfrom));
+        }
+  }
+
+  template<typename Sink>
+  void legal_moves(const Position& pos, Sink& sink) {
+
+    if (pos.sideToMove == WHITE)
+        legal_moves<WHITE>(pos, sink);
+    else
+        legal_moves<BLACK>(pos, sink);
+  }
+
+
+  // generated() counts a generate<Type>() call and the moves it emitted, for
+  // the instrumentation counters. It returns the end of the move list.
+  template<GenType Type>
+  ExtMove* generated(ExtMove* begin, ExtMove* end) {
+
+    Instrument::count(Instrument::Counter(Instrument::GENERATE_CAPTURES + Type));
+    Instrument::count(Instrument::Counter(Instrument::EMITTED_CAPTURES + Type), end - begin);
+    return end;
+  }
+
 } // namespace
 
 
@@ -294,14 +540,16 @@ ExtMove* generate(const Position& pos, ExtMove* moveList) {
   assert(Type == CAPTURES || Type == QUIETS || Type == NON_EVASIONS);
   assert(!pos.checkers());
 
+  Instrument::Timer timer(Instrument::Section(Instrument::SEC_GENERATE_CAPTURES + Type));
+
   Color us = pos.sideToMove;
 
   Bitboard target =  Type == CAPTURES     ?  pos.pieces(~us)
                    : Type == QUIETS       ? ~pos.pieces()
                    : Type == NON_EVASIONS ? ~pos.pieces(us) : 0;
 
-  return us == WHITE ? generate_all<WHITE, Type>(pos, moveList, target)
-                     : generate_all<BLACK, Type>(pos, moveList, target);
+  return generated<Type>(moveList, us == WHITE ? generate_all<WHITE, Type>(pos, moveList, target)
+                                              : generate_all<BLACK, Type>(pos, moveList, target));
 }
 
 // Explicit template instantiations
@@ -317,6 +565,10 @@ ExtMove* generate<QUIET_CHECKS>(const Position& pos, ExtMove* moveList) {
 
   assert(!pos.checkers());
 
+  Instrument::Timer timer(Instrument::Section(Instrument::SEC_GENERATE_CAPTURES + QUIET_CHECKS));
+
+  ExtMove* begin = moveList;
+
   Color us = pos.sideToMove;
   Bitboard dc = pos.discovered_check_candidates();
 
@@ -337,8 +589,8 @@ ExtMove* generate<QUIET_CHECKS>(const Position& pos, ExtMove* moveList) {
          *moveList++ = make_move(from, pop_lsb(&b));
   }
 
-  return us == WHITE ? generate_all<WHITE, QUIET_CHECKS>(pos, moveList, ~pos.pieces())
-                     : generate_all<BLACK, QUIET_CHECKS>(pos, moveList, ~pos.pieces());
+  return generated<QUIET_CHECKS>(begin, us == WHITE ? generate_all<WHITE, QUIET_CHECKS>(pos, moveList, ~pos.pieces())
+                                                    : generate_all<BLACK, QUIET_CHECKS>(pos, moveList, ~pos.pieces()));
 }
 
 
@@ -349,6 +601,10 @@ ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList) {
 
   assert(pos.checkers());
 
+  Instrument::Timer timer(Instrument::Section(Instrument::SEC_GENERATE_CAPTURES + EVASIONS));
+
+  ExtMove* begin = moveList;
+
   Color us = pos.sideToMove;
   Square ksq = pos.square<KING>(us);
   Bitboard sliderAttacks = 0;
@@ -369,14 +625,14 @@ ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList) {
       *moveList++ = make_move(ksq, pop_lsb(&b));
 
   if (more_than_one(pos.checkers()))
-      return moveList; // Double check, only a king move can save the day
+      return generated<EVASIONS>(begin, moveList); // Double check, only a king move can save the day
 
   // Generate blocking evasions or captures of the checking piece
   Square checksq = lsb(pos.checkers());
   Bitboard target = between_bb(checksq, ksq) | checksq;
 
-  return us == WHITE ? generate_all<WHITE, EVASIONS>(pos, moveList, target)
-                     : generate_all<BLACK, EVASIONS>(pos, moveList, target);
+  return generated<EVASIONS>(begin, us == WHITE ? generate_all<WHITE, EVASIONS>(pos, moveList, target)
+                                                : generate_all<BLACK, EVASIONS>(pos, moveList, target));
 }
 
 
@@ -385,18 +641,45 @@ ExtMove* generate<EVASIONS>(const Position& pos, ExtMove* moveList) {
 template<>
 ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
 
-  Bitboard pinned = pos.pinned_pieces(pos.sideToMove);
-  Square ksq = pos.square<KING>(pos.sideToMove);
-  ExtMove* cur = moveList;
+  Instrument::Timer timer(Instrument::Section(Instrument::SEC_GENERATE_CAPTURES + LEGAL));
+
+  MoveSink sink(moveList);
+  legal_moves(pos, sink);
+  return generated<LEGAL>(moveList, sink.moveList);
+}
+
+
+/// count<LEGAL> returns the number of legal moves, as MoveList<LEGAL>(pos).size()
+/// but without writing any move: targets are popcounted straight from the
+/// generator bitboards.
+
+template<>
+int count<LEGAL>(const Position& pos) {
+
+  CountSink<false> sink;
+  legal_moves(pos, sink);
+  return sink.counts[ALL_PIECES];
+}
+
+
+/// mobility() writes to 'counts' the number of legal moves of each moving
+/// piece type, castling being a king move, and their total to ALL_PIECES.
+
+void mobility(const Position& pos, int counts[PIECE_TYPE_NB]) {
+
+  CountSink<false> sink;
+  legal_moves(pos, sink);
+  std::copy(sink.counts, sink.counts + PIECE_TYPE_NB, counts);
+}
+
+
+/// has_legal_move() tells whether the side to move has any legal move, giving
+/// up generation at the first one found. Without one the game is over: mate
+/// if in check, stalemate otherwise.
 
-  moveList = pos.checkers() ? generate<EVASIONS    >(pos, moveList)
-                            : generate<NON_EVASIONS>(pos, moveList);
-  while (cur != moveList)
-      if (   (pinned || from_sq(*cur) == ksq || type_of(*cur) == ENPASSANT)
-          && !pos.legal(*cur))
-          *cur = (--moveList)->move;
-      else
-          ++cur;
+bool has_legal_move(const Position& pos) {
 
-  return moveList;
+  CountSink<true> sink;
+  legal_moves(pos, sink);
+  return sink.counts[ALL_PIECES];
 }
@@ -33,14 +33,25 @@ enum GenType {
 
 struct ExtMove {
   Move move;
+  int value;
 
   operator Move() const { return move; }
   void operator=(Move m) { move = m; }
 };
 
+inline bool operator<(const ExtMove& f, const ExtMove& s) {
+  return f.value < s.value;
+}
+
 template<GenType>
 ExtMove* generate(const Position& pos, ExtMove* moveList);
 
+template<GenType>
+int count(const Position& pos);
+
+void mobility(const Position& pos, int counts[PIECE_TYPE_NB]);
+bool has_legal_move(const Position& pos);
+
 /// The MoveList struct is a simple wrapper around generate(). It sometimes comes
 /// in handy to use this class instead of the low level generate() function.
 template<GenType T>
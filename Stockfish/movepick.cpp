@@ -0,0 +1,183 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <cassert>
+
+#include "movepick.h"
+#include "position.h"
+
+namespace {
+
+  enum Stages {
+    MAIN, GOOD_CAPTURES, QUIET_INIT, QUIET, BAD_CAPTURES,
+    EVASION, ALL_EVASIONS,
+    QSEARCH, QCAPTURES,
+    STOP
+  };
+
+  // pick_best() finds the best move in the range (begin, end) and moves it to
+  // the front. It's faster than sorting all the moves in advance when there
+  // are few moves, e.g. the possible captures.
+  ExtMove pick_best(ExtMove* begin, ExtMove* end) {
+
+    std::swap(*begin, *std::max_element(begin, end));
+    return *begin;
+  }
+
+  // The piece type captured by a move, if any. En passant captures land on an
+  // empty square.
+  PieceType captured_type(const Position& pos, Move m) {
+
+    return type_of(m) == ENPASSANT ? PAWN : type_of(pos.piece_on(to_sq(m)));
+  }
+
+} // namespace
+
+
+/// MovePicker constructor. Only the stage is set here, the first generation
+/// happens on the first call to next_move().
+
+MovePicker::MovePicker(const Position& p, bool capturesOnly, int th)
+  : pos(p), threshold(th), cur(moves), endMoves(moves), endBadCaptures(moves) {
+
+  stage = pos.checkers() ? EVASION : capturesOnly ? QSEARCH : MAIN;
+}
+
+
+/// score() assigns a numerical value to each move in the list. Captures are
+/// ordered by Most Valuable Victim, then by Least Valuable Attacker. Among the
+/// evasions the captures come first, with the same order, then promotions and
+/// then the other moves.
+
+template<>
+void MovePicker::score<CAPTURES>() {
+
+  for (auto& m : *this)
+      m.value =  8 * PieceValue[captured_type(pos, m)]
+               - int(type_of(pos.moved_piece(m)));
+}
+
+template<>
+void MovePicker::score<EVASIONS>() {
+
+  for (auto& m : *this)
+      if (pos.empty(to_sq(m)) && type_of(m) != ENPASSANT)
+          m.value = type_of(m) == PROMOTION ? PieceValue[promotion_type(m)] : 0;
+      else
+          m.value =  8 * PieceValue[captured_type(pos, m)] + 8 * PieceValue[QUEEN]
+                   - int(type_of(pos.moved_piece(m)));
+}
+
+
+/// next_move() is the most important method of the MovePicker class. It
+/// returns a new legal move every time it is called, until there are no more
+/// moves left. Moves are picked from the current stage, which is refilled
+/// from the next generation stage only when exhausted.
+
+Move MovePicker::next_move() {
+
+  Move move;
+
+  switch (stage) {
+
+  case MAIN: case QSEARCH:
+      endMoves = generate<CAPTURES>(pos, cur);
+      score<CAPTURES>();
+      ++stage;
+      /* fallthrough */
+
+  case GOOD_CAPTURES: case QCAPTURES:
+      while (cur < endMoves)
+      {
+          move = pick_best(cur++, endMoves);
+
+          if (pos.see_ge(move, threshold))
+          {
+              if (pos.legal(move))
+                  return move;
+          }
+          else if (stage == GOOD_CAPTURES)
+              // Losing capture, move it to the tail of the array
+              *endBadCaptures++ = move;
+      }
+
+      if (stage == QCAPTURES)
+          break;
+
+      ++stage;
+      /* fallthrough */
+
+  case QUIET_INIT:
+      cur = endBadCaptures;
+      endMoves = generate<QUIETS>(pos, cur);
+      ++stage;
+      /* fallthrough */
+
+  case QUIET:
+      while (cur < endMoves)
+      {
+          move = *cur++;
+
+          if (pos.legal(move))
+              return move;
+      }
+
+      // Hand out the losing captures, kept at the front of the array
+      cur = moves;
+      endMoves = endBadCaptures;
+      ++stage;
+      /* fallthrough */
+
+  case BAD_CAPTURES:
+      while (cur < endMoves)
+      {
+          move = *cur++;
+
+          if (pos.legal(move))
+              return move;
+      }
+      break;
+
+  case EVASION:
+      endMoves = generate<EVASIONS>(pos, cur);
+      score<EVASIONS>();
+      ++stage;
+      /* fallthrough */
+
+  case ALL_EVASIONS:
+      while (cur < endMoves)
+      {
+          move = pick_best(cur++, endMoves);
+
+          if (pos.legal(move))
+              return move;
+      }
+      break;
+
+  case STOP:
+      break;
+
+  default:
+      assert(false);
+  }
+
+  stage = STOP;
+  return MOVE_NONE;
+}
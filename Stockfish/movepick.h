@@ -0,0 +1,57 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef MOVEPICK_H_INCLUDED
+#define MOVEPICK_H_INCLUDED
+
+#include "movegen.h"
+#include "types.h"
+
+struct Position;
+
+/// MovePicker hands out the legal moves of a position one at a time, roughly
+/// best first. Moves are generated in stages, so that a consumer that stops
+/// after the first few moves does not pay for the others: the captures and
+/// queen promotions whose static exchange evaluation reaches the threshold,
+/// by MVV-LVA, then, only if asked for, the quiet moves, then the remaining
+/// captures. When in check all the evasions are scored and returned instead.
+/// A quiescence picker stops after the good captures, but for evasions.
+
+class MovePicker {
+public:
+  MovePicker(const MovePicker&) = delete;
+  MovePicker& operator=(const MovePicker&) = delete;
+
+  explicit MovePicker(const Position& pos, bool capturesOnly = false, int threshold = 0);
+
+  /// next_move() returns the next legal move, MOVE_NONE when there are none left
+  Move next_move();
+
+private:
+  template<GenType> void score();
+  ExtMove* begin() { return cur; }
+  ExtMove* end() { return endMoves; }
+
+  const Position& pos;
+  int stage, threshold;
+  ExtMove *cur, *endMoves, *endBadCaptures;
+  ExtMove moves[MAX_MOVES];
+};
+
+#endif // #ifndef MOVEPICK_H_INCLUDED
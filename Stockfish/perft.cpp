@@ -0,0 +1,235 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "movegen.h"
+#include "perft.h"
+#include "position.h"
+#include "tt.h"
+
+namespace {
+
+  typedef std::chrono::milliseconds::rep TimePoint; // A value in milliseconds
+
+  TimePoint now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>
+          (std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Perft counts from the usual test positions. Cutoff depths are chosen so
+  // that the whole suite runs in a few seconds on a single core.
+  struct BenchEntry {
+    const char* fen;
+    int depth;
+    uint64_t nodes;
+  };
+
+  const BenchEntry Suite[] = {
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609 },
+    { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603 },
+    { "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 674624 },
+    { "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333 },
+    { "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 4, 422333 },
+    { "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487 },
+    { "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594 },
+    { "8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1", 6, 1440467 },
+    { "3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1", 6, 1134888 },
+    { "8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1", 6, 1015133 },
+    { "r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1", 4, 1274206 },
+    { "2K2r2/4P3/8/8/8/8/8/3k4 w - - 0 1", 6, 3821001 },
+    { "8/P1k5/K7/8/8/8/8/8 w - - 0 1", 6, 92683 }
+  };
+
+  // FEN strings the parser must reject, checked along with the suite
+  const char* Rejected[] = {
+    "4k3/8/4n3/3Pp3/8/8/8/4K3 w - e6 0 1", // En passant square occupied
+    "4k3/4n3/8/3Pp3/8/8/8/4K3 w - e6 0 1", // Square behind it occupied
+    "4k3/8/8/3P4/8/8/8/4K3 w - e6 0 1",    // No pawn in front of it
+    "4k3/8/8/8/8/8/8/4K3 w - - x 1",       // Halfmove clock not a number
+    "4k3/8/8/8/8/8/8/4K3 w - - -1 1",
+    "4k3/pppppppp/pppppppp/8/8/8/8/4K3 w - - 0 1", // Sixteen pawns
+    "4k3/8/8/8/8/8/NNNN4/NNNNKNNN w - - 0 1",      // Eleven knights
+    "4k3/8/8/8/8/QQQQQQQQ/QQQQQQQQ/4K3 w - - 0 1"  // Seventeen pieces
+  };
+
+  // Perft results depend on the remaining depth, so the key used for the
+  // table is the position key scrambled by the depth.
+  Key perft_key(Key key, int depth) {
+    return key ^ (Key(depth) * 0x9E3779B97F4A7C15ULL);
+  }
+
+} // namespace
+
+
+/// Perft::move() converts a Move to a string in coordinate notation (g1f3,
+/// a7a8q). Castling moves are encoded as 'king captures rook' internally and
+/// are printed with the king destination square of standard chess.
+
+const std::string Perft::move(Move m) {
+
+  Square from = from_sq(m);
+  Square to = to_sq(m);
+
+  if (m == MOVE_NONE)
+      return "(none)";
+
+  if (m == MOVE_NULL)
+      return "0000";
+
+  if (type_of(m) == CASTLING)
+      to = make_square(to > from ? FILE_G : FILE_C, rank_of(from));
+
+  std::string s;
+  s += char('a' + file_of(from));
+  s += char('1' + rank_of(from));
+  s += char('a' + file_of(to));
+  s += char('1' + rank_of(to));
+
+  if (type_of(m) == PROMOTION)
+      s += " pnbrqk"[promotion_type(m)];
+
+  return s;
+}
+
+
+uint64_t Perft::perft(const Position& pos, int depth, TranspositionTable* tt) {
+
+  if (depth <= 1)
+      return depth == 1 ? count<LEGAL>(pos) : 1;
+
+  Key key = perft_key(pos.key(), depth);
+  uint64_t nodes;
+
+  if (tt && tt->probe(key, nodes))
+      return nodes;
+
+  nodes = 0;
+
+  for (const auto& m : MoveList<LEGAL>(pos))
+      nodes += perft(Position(pos, m), depth - 1, tt);
+
+  if (tt)
+      tt->store(key, nodes, depth);
+
+  return nodes;
+}
+
+
+uint64_t Perft::divide(const Position& pos, int depth, int threads,
+                       TranspositionTable* tt, bool verbose) {
+
+  if (depth < 1)
+      return 1;
+
+  MoveList<LEGAL> rootMoves(pos);
+  std::vector<uint64_t> counts(rootMoves.size());
+  std::atomic<size_t> next(0);
+
+  // Root moves are not split statically because subtree sizes differ a lot:
+  // each worker grabs the next unsearched root move until none is left.
+  auto worker = [&]() {
+      for (size_t i; (i = next++) < rootMoves.size(); )
+          counts[i] = perft(Position(pos, *(rootMoves.begin() + i)), depth - 1, tt);
+  };
+
+  std::vector<std::thread> workers;
+
+  for (int i = 1; i < threads; ++i)
+      workers.emplace_back(worker);
+
+  worker();
+
+  for (std::thread& th : workers)
+      th.join();
+
+  uint64_t nodes = 0;
+
+  for (size_t i = 0; i < rootMoves.size(); ++i)
+  {
+      nodes += counts[i];
+
+      if (verbose)
+          std::cout << move(*(rootMoves.begin() + i)) << ": " << counts[i] << std::endl;
+  }
+
+  return nodes;
+}
+
+
+bool Perft::bench(int threads, size_t hashMb) {
+
+  TranspositionTable tt;
+  uint64_t totalNodes = 0;
+  TimePoint totalTime = 0;
+  bool ok = true;
+  int idx = 0;
+
+  if (hashMb)
+      tt.resize(hashMb);
+
+  for (const BenchEntry& e : Suite)
+  {
+      Position pos(e.fen);
+
+      if (hashMb)
+          tt.clear();
+
+      TimePoint elapsed = now();
+      uint64_t nodes = divide(pos, e.depth, threads, hashMb ? &tt : nullptr, false);
+      elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+
+      totalNodes += nodes;
+      totalTime += elapsed;
+      ok &= nodes == e.nodes;
+
+      std::cout << "Position " << std::setw(2) << ++idx
+                << " depth " << e.depth
+                << " nodes " << std::setw(10) << nodes
+                << (nodes == e.nodes ? "  ok    " : "  FAILED")
+                << " nps " << 1000 * nodes / elapsed
+                << "  " << e.fen << std::endl;
+  }
+
+  for (const char* fen : Rejected)
+  {
+      Position pos;
+      bool rejected = pos.fen(fen) != FEN_OK;
+
+      ok &= rejected;
+
+      std::cout << "Invalid FEN " << (rejected ? "rejected  " : "FAILED    ") << fen << std::endl;
+  }
+
+  std::cerr << "\n==========================="
+            << "\nThreads        : " << threads
+            << "\nHash (MB)      : " << hashMb
+            << "\nTotal time (ms): " << totalTime
+            << "\nNodes searched : " << totalNodes
+            << "\nNodes/second   : " << 1000 * totalNodes / totalTime
+            << "\nResult         : " << (ok ? "ok" : "FAILED") << std::endl;
+
+  return ok;
+}
@@ -0,0 +1,53 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PERFT_H_INCLUDED
+#define PERFT_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+#include "types.h"
+
+struct Position;
+class TranspositionTable;
+
+namespace Perft {
+
+/// perft() counts the leaf nodes of the legal move tree of the given depth.
+/// Leaves are bulk counted with MoveList<LEGAL>::size(), and when a table is
+/// given, subtree counts are cached in it keyed on the position hash.
+uint64_t perft(const Position& pos, int depth, TranspositionTable* tt = nullptr);
+
+/// divide() is perft() split at the root: the root moves are handed out to
+/// 'threads' workers and, if 'verbose' is set, the count below each root move
+/// is printed in UCI notation.
+uint64_t divide(const Position& pos, int depth, int threads,
+                TranspositionTable* tt = nullptr, bool verbose = true);
+
+/// bench() runs perft on a fixed suite of positions with known node counts,
+/// reports nodes per second and returns false if any count is wrong.
+bool bench(int threads, size_t hashMb);
+
+const std::string move(Move m);
+
+} // namespace Perft
+
+#endif // #ifndef PERFT_H_INCLUDED
@@ -0,0 +1,639 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "bitboard.h"
+#include "movegen.h"
+#include "pgn.h"
+#include "position.h"
+#include "record.h"
+
+namespace {
+
+  // parse_result() values for "*" and for a token that is not a termination
+  // marker at all, besides the 1, 0 and -1 of the game results.
+  const int NoResult = 2;
+  const int NotMarker = 3;
+
+  bool is_space(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v'; }
+  bool is_digit(char c) { return c >= '0' && c <= '9'; }
+  bool is_file(char c) { return c >= 'a' && c <= 'h'; }
+  bool is_rank(char c) { return c >= '1' && c <= '8'; }
+
+  Square square(const char* s) { return make_square(File(s[0] - 'a'), Rank(s[1] - '1')); }
+
+  PieceType piece_type(char c) {
+
+    switch (c) {
+    case 'N': return KNIGHT;
+    case 'B': return BISHOP;
+    case 'R': return ROOK;
+    case 'Q': return QUEEN;
+    case 'K': return KING;
+    default : return NO_PIECE_TYPE;
+    }
+  }
+
+  // promotion_type() accepts both cases, as SAN uses "=Q" and UCI "q"
+  PieceType promotion_type(char c) {
+
+    switch (c) {
+    case 'N': case 'n': return KNIGHT;
+    case 'B': case 'b': return BISHOP;
+    case 'R': case 'r': return ROOK;
+    case 'Q': case 'q': return QUEEN;
+    default : return NO_PIECE_TYPE;
+    }
+  }
+
+  int parse_result(const char* s, size_t len) {
+
+    return len == 1 && *s == '*'                  ? NoResult
+         : len == 3 && !std::memcmp(s, "1-0", 3)     ? 1
+         : len == 3 && !std::memcmp(s, "0-1", 3)     ? -1
+         : len == 7 && !std::memcmp(s, "1/2-1/2", 7) ? 0 : NotMarker;
+  }
+
+  // is_legal() tells whether a pseudo-legal move, castling aside, is legal.
+  // Position::legal() expects evasions to have been generated as such, which
+  // a move read from a game was not, so checks are dealt with first.
+  bool is_legal(const Position& pos, Move m) {
+
+    Color us = pos.sideToMove;
+    Square from = from_sq(m), to = to_sq(m);
+    Bitboard checkers = pos.checkers();
+
+    if (type_of(pos.piece_on(from)) == KING)
+        return !(pos.attackers_to(to, pos.pieces() ^ from) & pos.pieces(~us));
+
+    if (checkers)
+    {
+        // A single checker must be captured, or blocked, by the move
+        Bitboard target = more_than_one(checkers) ? 0
+                        : between_bb(pos.square<KING>(us), lsb(checkers)) | checkers;
+
+        if (type_of(m) == ENPASSANT && (checkers & (to - pawn_push(us))))
+            target |= to;
+
+        if (!(target & to))
+            return false;
+    }
+
+    return pos.legal(m);
+  }
+
+  // The castling move of the side to move towards the given wing, if legal
+  Move castling(const Position& pos, bool kingside) {
+
+    if (pos.can_castle(pos.sideToMove))
+        for (const ExtMove& m : MoveList<LEGAL>(pos))
+            if (type_of(m) == CASTLING && (to_sq(m) > from_sq(m)) == kingside)
+                return m;
+
+    return MOVE_NONE;
+  }
+
+
+  // Game boundaries. A game starts at a tag line that follows movetext, or
+  // at any line after one that ends with a termination marker.
+
+  const char* line_start(const char* begin, const char* p) {
+
+    while (p > begin && p[-1] != '\n')
+        --p;
+
+    return p;
+  }
+
+  bool blank(const char* p, const char* end) {
+
+    for ( ; p < end && *p != '\n'; ++p)
+        if (!is_space(*p))
+            return false;
+
+    return true;
+  }
+
+  bool ends_with_marker(const char* line, const char* end) {
+
+    const char* eol = std::find(line, end, '\n');
+
+    while (eol > line && is_space(eol[-1]))
+        --eol;
+
+    const char* token = eol;
+
+    while (token > line && !is_space(token[-1]))
+        --token;
+
+    // A marker in a comment does not count. Comments spanning lines are not
+    // seen, they would only cost the game they start in.
+    bool comment = false;
+
+    for (const char* p = line; p < token; ++p)
+        if (*p == ';' && !comment)
+            return false;
+        else if (*p == '{' || *p == '}')
+            comment = *p == '{';
+
+    return !comment && parse_result(token, eol - token) != NotMarker;
+  }
+
+  // game_start() returns the last start of a game in [begin, end), not
+  // counting 'begin' itself, or 'begin' if there is none.
+  const char* game_start(const char* begin, const char* end) {
+
+    for (const char* ls = line_start(begin, end); ls > begin; ls = line_start(begin, ls - 1))
+    {
+        const char* prev = line_start(begin, ls - 1);
+
+        while (prev > begin && blank(prev, end))
+            prev = line_start(begin, prev - 1);
+
+        if (blank(prev, end))
+            continue;
+
+        if (ends_with_marker(prev, end) || (ls < end && *ls == '[' && *prev != '['))
+            return ls;
+    }
+
+    return begin;
+  }
+
+
+  // A Decoder turns PGN text into game records. Each thread has its own and
+  // keeps the records of its share of a chunk until they are written, in
+  // order, by the reading thread.
+  struct Decoder {
+
+    void decode(const char* p, const char* end);
+    void tag(const char* p, const char* end);
+    void token(const char* s, size_t len);
+    void begin_game();
+    void end_game();
+
+    Position root, pos;
+    std::vector<PackedGameRecord> records, game;
+    Pgn::Stats stats = {};
+    int result = NoResult;
+    bool inGame = false, inMoves = false, failed = false;
+  };
+
+  void Decoder::begin_game() {
+
+    pos = root;
+    game.clear();
+    result = NoResult;
+    inGame = true;
+    inMoves = failed = false;
+  }
+
+  void Decoder::end_game() {
+
+    if (failed || result == NoResult)
+        stats.skipped++;
+    else
+    {
+        for (PackedGameRecord& r : game)
+            r.result = int8_t(result);
+
+        records.insert(records.end(), game.begin(), game.end());
+
+        stats.games++;
+        stats.positions += game.size();
+        stats.whiteWins += result > 0;
+        stats.draws     += result == 0;
+        stats.blackWins += result < 0;
+    }
+
+    inGame = inMoves = false;
+  }
+
+  // A tag pair, [Name "Value"], from just after the bracket
+  void Decoder::tag(const char* p, const char* end) {
+
+    const char* name = p;
+
+    while (p < end && !is_space(*p) && *p != '"' && *p != ']')
+        ++p;
+
+    size_t nameLen = p - name;
+    const char* value = std::find(p, end, '"');
+
+    if (value == end)
+        return;
+
+    const char* valueEnd = std::find(++value, end, '"');
+
+    if (nameLen == 3 && !std::memcmp(name, "FEN", 3))
+        failed |= pos.fen_parse(value, valueEnd - value) != FEN_OK;
+
+    else if (nameLen == 6 && !std::memcmp(name, "Result", 6))
+    {
+        int r = parse_result(value, valueEnd - value);
+        result = r == NotMarker ? NoResult : r;
+    }
+  }
+
+  void Decoder::token(const char* s, size_t len) {
+
+    if (*s == '$' || (len == 4 && !std::memcmp(s, "e.p.", 4))) // NAG or en passant mark
+        return;
+
+    int r = parse_result(s, len);
+
+    if (r != NotMarker)
+    {
+        if (!inGame)
+            begin_game();
+
+        result = r;
+        end_game();
+        return;
+    }
+
+    // Move numbers, "12.", "12..." or "...", possibly glued to the move
+    size_t digits = 0, dots;
+
+    while (digits < len && is_digit(s[digits]))
+        ++digits;
+
+    for (dots = digits; dots < len && s[dots] == '.'; ++dots) {}
+
+    if (dots > digits || digits == len)
+        s += dots, len -= dots;
+
+    if (!len)
+        return;
+
+    if (!inGame)
+        begin_game();
+
+    inMoves = true;
+
+    if (failed)
+        return;
+
+    Move m = Pgn::parse_move(pos, s, len);
+
+    if (m == MOVE_NONE)
+    {
+        failed = true;
+        return;
+    }
+
+    PackedGameRecord rec = {};
+    rec.pos = PackedPosition::pack(pos);
+    rec.move = uint16_t(m);
+    game.push_back(rec);
+
+    pos.move(m);
+  }
+
+  void Decoder::decode(const char* p, const char* end) {
+
+    const char* begin = p;
+    int depth = 0; // Nesting of the variation being skipped
+
+    while (p < end)
+    {
+        char c = *p;
+
+        if (is_space(c))
+            ++p;
+
+        else if (c == '{')
+            p = std::min(std::find(p, end, '}') + 1, end);
+
+        else if (c == ';' || (c == '%' && (p == begin || p[-1] == '\n')))
+            p = std::find(p, end, '\n');
+
+        else if (c == '(')
+            depth++, p++;
+
+        else if (c == ')')
+            depth -= depth > 0, p++;
+
+        else if (c == '[' && !depth)
+        {
+            if (inMoves)
+                end_game();
+
+            if (!inGame)
+                begin_game();
+
+            const char* eol = std::find(p, end, '\n');
+            tag(p + 1, eol);
+            p = eol;
+        }
+        else
+        {
+            const char* s = p;
+
+            while (p < end && !is_space(*p) && !std::strchr("{}();[", *p))
+                ++p;
+
+            if (p == s) // A stray delimiter
+                ++p;
+
+            else if (!depth)
+                token(s, p - s);
+        }
+    }
+
+    if (inGame)
+        end_game();
+  }
+
+  // Appends up to 'n' bytes of the file to 'buf', clearing 'more' at its end
+  bool read_chunk(FILE* f, std::vector<char>& buf, size_t n, bool& more, uint64_t& bytes) {
+
+    size_t size = buf.size();
+
+    buf.resize(size + n);
+    n = fread(buf.data() + size, 1, n, f);
+    buf.resize(size + n);
+    bytes += n;
+    more = n && !feof(f);
+
+    return !ferror(f);
+  }
+
+} // namespace
+
+
+Move Pgn::parse_san(const Position& pos, const char* s, size_t len) {
+
+  while (len && std::strchr("+#!?", s[len - 1]))
+      len--;
+
+  Color us = pos.sideToMove;
+
+  // Castling: O-O or O-O-O, with letters or zeros, hyphens optional
+  if (len >= 2 && (s[0] == 'O' || s[0] == '0'))
+  {
+      size_t os = std::count(s, s + len, s[0]);
+
+      if (size_t(std::count(s, s + len, '-')) + os != len || os < 2 || os > 3)
+          return MOVE_NONE;
+
+      return castling(pos, os == 2);
+  }
+
+  PieceType pt = len ? piece_type(s[0]) : NO_PIECE_TYPE;
+  PieceType promotion = NO_PIECE_TYPE;
+
+  if (pt != NO_PIECE_TYPE)
+      s++, len--;
+  else
+      pt = PAWN;
+
+  // Promotion suffix, "=Q" or "Q", after the rank of the destination
+  if (   pt == PAWN && len >= 3 && is_rank(s[len - 2 - (s[len - 2] == '=')])
+      && promotion_type(s[len - 1]) != NO_PIECE_TYPE)
+  {
+      promotion = promotion_type(s[len - 1]);
+      len -= 1 + (s[len - 2] == '=');
+  }
+
+  if (len < 2 || !is_file(s[len - 2]) || !is_rank(s[len - 1]))
+      return MOVE_NONE;
+
+  Square to = square(s + len - 2);
+  Bitboard from = pos.pieces(us, pt);
+
+  if (pos.pieces(us) & to)
+      return MOVE_NONE;
+
+  // Whatever is between the piece and the destination narrows the origin
+  for (size_t i = 0; i < len - 2; ++i)
+      if (is_file(s[i]))
+          from &= file_bb(File(s[i] - 'a'));
+      else if (is_rank(s[i]))
+          from &= rank_bb(Rank(s[i] - '1'));
+      else if (s[i] != 'x' && s[i] != ':' && s[i] != '-')
+          return MOVE_NONE;
+
+  if (pt == PAWN)
+  {
+      if ((promotion != NO_PIECE_TYPE) != (relative_rank(us, to) == RANK_8))
+          return MOVE_NONE;
+
+      Bitboard origins = 0;
+
+      if (pos.pieces(~us) & to || to == pos.epSquare)
+          origins = pos.attacks_from<PAWN>(to, ~us);
+
+      else
+      {
+          Square s1 = to - pawn_push(us);
+
+          origins |= s1;
+
+          if (relative_rank(us, to) == RANK_4 && pos.empty(s1))
+              origins |= s1 - pawn_push(us);
+      }
+
+      from &= origins;
+  }
+  else
+      from &= pos.attacks_from(make_piece(us, pt), to);
+
+  // Usually a single candidate is left at this point, and with several the
+  // text is ambiguous unless only one of them is not pinned.
+  Move found = MOVE_NONE;
+
+  while (from)
+  {
+      Square f = pop_lsb(&from);
+      Move m = promotion != NO_PIECE_TYPE            ? make<PROMOTION>(f, to, promotion)
+             : pt == PAWN && to == pos.epSquare     ? make<ENPASSANT>(f, to)
+                                                     : make_move(f, to);
+      if (is_legal(pos, m))
+      {
+          if (found)
+              return MOVE_NONE;
+
+          found = m;
+      }
+  }
+
+  return found;
+}
+
+
+Move Pgn::parse_uci(const Position& pos, const char* s, size_t len) {
+
+  if (   (len != 4 && len != 5)
+      || !is_file(s[0]) || !is_rank(s[1]) || !is_file(s[2]) || !is_rank(s[3]))
+      return MOVE_NONE;
+
+  PieceType promotion = len == 5 ? promotion_type(s[4]) : NO_PIECE_TYPE;
+
+  if (len == 5 && promotion == NO_PIECE_TYPE)
+      return MOVE_NONE;
+
+  Color us = pos.sideToMove;
+  Square from = square(s), to = square(s + 2);
+  Piece pc = pos.piece_on(from);
+
+  if (pc == NO_PIECE || color_of(pc) != us)
+      return MOVE_NONE;
+
+  if (   type_of(pc) == KING && len == 4
+      && ((pos.pieces(us, ROOK) & to) || distance<File>(from, to) == 2))
+      for (const ExtMove& m : MoveList<LEGAL>(pos))
+          if (   type_of(m) == CASTLING
+              && (   to_sq(m) == to
+                  || make_square(to_sq(m) > from ? FILE_G : FILE_C, rank_of(from)) == to))
+              return m;
+
+  Bitboard targets;
+
+  if (type_of(pc) == PAWN)
+  {
+      if ((promotion != NO_PIECE_TYPE) != (relative_rank(us, to) == RANK_8))
+          return MOVE_NONE;
+
+      Square s1 = from + pawn_push(us);
+      Bitboard enemies = pos.pieces(~us);
+
+      if (pos.epSquare != SQ_NONE)
+          enemies |= pos.epSquare;
+
+      targets = pos.attacks_from<PAWN>(from, us) & enemies;
+
+      if (pos.empty(s1))
+      {
+          targets |= s1;
+
+          if (relative_rank(us, from) == RANK_2 && pos.empty(s1 + pawn_push(us)))
+              targets |= s1 + pawn_push(us);
+      }
+  }
+  else if (len == 5)
+      return MOVE_NONE;
+  else
+      targets = pos.attacks_from(pc, from) & ~pos.pieces(us);
+
+  if (!(targets & to))
+      return MOVE_NONE;
+
+  Move m = promotion != NO_PIECE_TYPE                   ? make<PROMOTION>(from, to, promotion)
+         : type_of(pc) == PAWN && to == pos.epSquare   ? make<ENPASSANT>(from, to)
+                                                       : make_move(from, to);
+
+  return is_legal(pos, m) ? m : MOVE_NONE;
+}
+
+
+Move Pgn::parse_move(const Position& pos, const char* s, size_t len) {
+
+  bool uci =   (len == 4 || len == 5)
+            && is_file(s[0]) && is_rank(s[1]) && is_file(s[2]) && is_rank(s[3]);
+
+  return uci ? parse_uci(pos, s, len) : parse_san(pos, s, len);
+}
+
+
+bool Pgn::convert(const std::vector<std::string>& inputs, const std::string& path,
+                  const Options& options, Stats& stats) {
+
+  RecordWriter<PackedGameRecord> writer;
+  int threads = std::max(options.threads, 1);
+  size_t chunk = std::max(options.chunkMb, size_t(1)) << 20;
+  std::vector<Decoder> decoders(threads);
+  std::vector<char> text, next;
+  bool ok = writer.open(path);
+
+  stats = Stats();
+
+  for (const std::string& input : inputs)
+  {
+      FILE* f = ok ? fopen(input.c_str(), "rb") : nullptr;
+      bool more = true;
+
+      if (!(ok = f != nullptr))
+          break;
+
+      text.clear();
+      ok = read_chunk(f, text, chunk, more, stats.bytes);
+
+      while (ok && !text.empty())
+      {
+          // Decode up to the last game start, the rest goes with the next
+          // chunk. A game longer than the buffer makes it grow.
+          const char* base = text.data();
+          const char* cut = more ? game_start(base, base + text.size()) : base + text.size();
+
+          if (cut == base)
+          {
+              ok = read_chunk(f, text, chunk, more, stats.bytes);
+              continue;
+          }
+
+          next.assign(cut, base + text.size());
+
+          std::vector<const char*> bounds(threads + 1, base);
+          bounds[threads] = cut;
+
+          for (int t = 1; t < threads; ++t)
+              bounds[t] = game_start(bounds[t - 1], base + (cut - base) * t / threads);
+
+          std::vector<std::thread> pool;
+
+          for (int t = 0; t < threads; ++t)
+              pool.emplace_back([&, t]() {
+                  decoders[t].records.clear();
+                  decoders[t].decode(bounds[t], bounds[t + 1]);
+              });
+
+          // Reading the next chunk overlaps with the decoding of this one
+          if (more)
+              ok = read_chunk(f, next, chunk, more, stats.bytes);
+
+          for (std::thread& th : pool)
+              th.join();
+
+          for (const Decoder& d : decoders)
+              writer.write(d.records.data(), d.records.size());
+
+          std::swap(text, next);
+      }
+
+      fclose(f);
+  }
+
+  for (Decoder& d : decoders)
+  {
+      stats.games     += d.stats.games;
+      stats.positions += d.stats.positions;
+      stats.skipped   += d.stats.skipped;
+      stats.whiteWins += d.stats.whiteWins;
+      stats.draws     += d.stats.draws;
+      stats.blackWins += d.stats.blackWins;
+  }
+
+  return writer.close() && ok;
+}
@@ -0,0 +1,79 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PGN_H_INCLUDED
+#define PGN_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+struct Position;
+
+namespace Pgn {
+
+/// parse_san() returns the legal move of 'pos' written in standard algebraic
+/// notation, or MOVE_NONE. The candidate origin squares are found with
+/// bitboards, from the attacks onto the destination and the file or rank the
+/// text gives, so no move list is generated but for castling. Check and
+/// annotation marks are ignored, a missing capture sign is accepted, and "0"
+/// is accepted for "O" in castling.
+Move parse_san(const Position& pos, const char* s, size_t len);
+
+/// parse_uci() returns the legal move of 'pos' in UCI long algebraic notation,
+/// or MOVE_NONE. Castling is accepted both as the king move by two squares and
+/// as the king taking its own rook, as written for Chess960.
+Move parse_uci(const Position& pos, const char* s, size_t len);
+
+/// parse_move() reads a move in either notation, telling them apart by shape
+Move parse_move(const Position& pos, const char* s, size_t len);
+
+struct Options {
+  int    threads = 1;
+  size_t chunkMb = 16; // Input read at once, split among the threads
+};
+
+struct Stats {
+  uint64_t games;     // Games decoded and written
+  uint64_t positions; // Records written, one per move played
+  uint64_t skipped;   // Games with an illegal move, a bad FEN or no result
+  uint64_t whiteWins, draws, blackWins;
+  uint64_t bytes;     // Input read
+};
+
+/// convert() reads PGN files and appends, for each game with a known result,
+/// a PackedGameRecord per move to the record file at 'path', in input order.
+/// Movetext may be in SAN or in UCI notation, even mixed; comments, variations
+/// and annotation glyphs are skipped. Games start from their "FEN" tag, if
+/// any, and a result is taken from the termination marker or else from the
+/// "Result" tag. Games without tags are split at their termination markers.
+///
+/// Files are read in chunks cut at game boundaries. Each chunk is divided
+/// among the threads at game boundaries, and the next chunk is read while
+/// the threads decode the current one. Returns false on an I/O error.
+bool convert(const std::vector<std::string>& inputs, const std::string& path,
+             const Options& options, Stats& stats);
+
+} // namespace Pgn
+
+#endif // #ifndef PGN_H_INCLUDED
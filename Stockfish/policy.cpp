@@ -0,0 +1,117 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <vector>
+
+#include "batch.h"
+#include "policy.h"
+#include "position.h"
+
+/// Policy::index() returns the policy index of a move of side 'us'
+
+int Policy::index(Move m, Color us, bool stmPerspective) {
+
+  Square from = from_sq(m);
+  Square to = to_sq(m);
+
+  if (stmPerspective && us == BLACK)
+      from = ~from, to = ~to;
+
+  return index(from, to, type_of(m) == PROMOTION ? promotion_type(m) : NO_PIECE_TYPE);
+}
+
+
+/// Policy::move() is the inverse of Policy::index(). The policy index alone
+/// does not tell a castling, promotion or en passant move from a normal one,
+/// so the position is used to rebuild the full move. The result is not
+/// checked for legality; MOVE_NONE is returned if the index points off the
+/// board or is an underpromotion of a piece that is not a promoting pawn.
+
+Move Policy::move(const Position& pos, int idx, bool stmPerspective) {
+
+  assert(idx >= 0 && idx < PolicySize);
+
+  Color us = pos.sideToMove;
+  bool flipped = stmPerspective && us == BLACK;
+  int p = idx / SQUARE_NB;
+  Square from = Square(idx % SQUARE_NB);
+  int dx = plane_dx(p);
+  int dy = plane_dy(p) * (p >= 64 && us == BLACK && !flipped ? -1 : 1);
+  int f = file_of(from) + dx, r = rank_of(from) + dy;
+
+  if (f < FILE_A || f > FILE_H || r < RANK_1 || r > RANK_8)
+      return MOVE_NONE;
+
+  Square to = make_square(File(f), Rank(r));
+
+  if (flipped)
+      from = ~from, to = ~to;
+
+  PieceType pt = type_of(pos.piece_on(from));
+
+  if (pt == KING && pos.piece_on(to) == make_piece(us, ROOK))
+      return make<CASTLING>(from, to);
+
+  if (pt == PAWN && relative_rank(us, to) == RANK_8)
+      return make<PROMOTION>(from, to, p >= 64 ? PieceType(KNIGHT + (p - 64) / 3) : QUEEN);
+
+  if (p >= 64)
+      return MOVE_NONE;
+
+  if (pt == PAWN && to == pos.epSquare)
+      return make<ENPASSANT>(from, to);
+
+  return make_move(from, to);
+}
+
+
+void Policy::legal_mask(const Position* positions, size_t count, uint8_t* out,
+                        bool stmPerspective, int* counts) {
+
+  // Scratch bitsets reused across calls, so a call allocates only when a
+  // thread sees a bigger batch than before.
+  static thread_local std::vector<uint64_t> bits;
+
+  bits.resize(count * MaskWords);
+  legal_bits(positions, count, bits.data(), stmPerspective, counts);
+  std::memset(out, 0, count * PolicySize);
+
+  for (size_t i = 0; i < count * MaskWords; ++i)
+      for (Bitboard b = bits[i]; b; )
+          out[i * 64 + pop_lsb(&b)] = 1;
+}
+
+
+void Policy::legal_bits(const Position* positions, size_t count, uint64_t* out,
+                        bool stmPerspective, int* counts) {
+
+  // PositionBatch::load() reuses the storage of the previous load
+  static thread_local PositionBatch batch;
+
+  batch.load(positions, count);
+  batch.legal_bits(out, stmPerspective, counts);
+}
+
+
+void Policy::legal_bits(const PositionBatch& batch, uint64_t* out, bool stmPerspective, int* counts) {
+
+  batch.legal_bits(out, stmPerspective, counts);
+}
@@ -0,0 +1,117 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POLICY_H_INCLUDED
+#define POLICY_H_INCLUDED
+
+#include <cstddef>
+
+#include "types.h"
+
+struct Position;
+class PositionBatch;
+
+namespace Policy {
+
+/// Moves are mapped to the 73x64 policy layout of AlphaZero. The index of a
+/// move is plane * 64 + from, where the plane depends only on the move vector
+/// and on the promotion piece:
+///
+/// 0-55  : queen-like moves, 8 directions (N, NE, E, SE, S, SW, W, NW) times
+///         distances 1 to 7. Queen promotions and king moves are in these
+///         planes too, as is castling, encoded as in Move: the king moves to
+///         the square of its rook. Unlike the two-square king move this is
+///         unambiguous in Chess960 setups as well.
+/// 56-63 : knight moves
+/// 64-72 : underpromotions to knight, bishop and rook, each capturing to the
+///         west, pushing or capturing to the east
+///
+/// Squares can be taken from the side to move perspective, in which case black
+/// moves are flipped vertically so that pawns always move north.
+
+const int PlaneNb    = 73;
+const int PolicySize = PlaneNb * int(SQUARE_NB);
+const int MaskWords  = (PolicySize + 63) / 64;
+
+constexpr int DirIndex[3][3] = { { 5, 4, 3 }, { 6, -1, 2 }, { 7, 0, 1 } }; // [dy + 1][dx + 1]
+constexpr int DirDx[8] = { 0, 1, 1,  1,  0, -1, -1, -1 };
+constexpr int DirDy[8] = { 1, 1, 0, -1, -1, -1,  0,  1 };
+
+constexpr int KnightIndex[5][5] = { { -1,  4, -1,  3, -1 },  // [dy + 2][dx + 2]
+                                    {  5, -1, -1, -1,  2 },
+                                    { -1, -1, -1, -1, -1 },
+                                    {  6, -1, -1, -1,  1 },
+                                    { -1,  7, -1,  0, -1 } };
+constexpr int KnightDx[8] = { 1, 2,  2,  1, -1, -2, -2, -1 };
+constexpr int KnightDy[8] = { 2, 1, -1, -2, -2, -1,  1,  2 };
+
+constexpr int sign(int x) { return (x > 0) - (x < 0); }
+constexpr int absolute(int x) { return x < 0 ? -x : x; }
+
+/// plane() returns the policy plane of a move given its file and rank deltas
+/// and its promotion piece type (NO_PIECE_TYPE if not a promotion).
+constexpr int plane(int dx, int dy, PieceType promotion) {
+  return  promotion == KNIGHT || promotion == BISHOP || promotion == ROOK
+        ? 64 + 3 * (int(promotion) - int(KNIGHT)) + dx + 1
+        : dx * dx + dy * dy == 5 ? 56 + KnightIndex[dy + 2][dx + 2]
+        : 7 * DirIndex[sign(dy) + 1][sign(dx) + 1] + (absolute(dx) > absolute(dy) ? absolute(dx) : absolute(dy)) - 1;
+}
+
+/// index() returns the policy index of a move from 'from' to 'to', squares
+/// already expressed in the perspective of the policy.
+constexpr int index(Square from, Square to, PieceType promotion = NO_PIECE_TYPE) {
+  return plane((to & 7) - (from & 7), (to >> 3) - (from >> 3), promotion) * int(SQUARE_NB) + int(from);
+}
+
+/// plane_dx() and plane_dy() give back the move vector of a plane. For
+/// underpromotion planes the rank delta is the one of a white pawn.
+constexpr int plane_dx(int p) {
+  return p < 56 ? DirDx[p / 7] * (p % 7 + 1) : p < 64 ? KnightDx[p - 56] : (p - 64) % 3 - 1;
+}
+
+constexpr int plane_dy(int p) {
+  return p < 56 ? DirDy[p / 7] * (p % 7 + 1) : p < 64 ? KnightDy[p - 56] : 1;
+}
+
+static_assert(index(SQ_E2, SQ_E4) == 1 * 64 + int(SQ_E2), "Wrong queen-like plane");
+static_assert(index(SQ_G1, SQ_F3) == 63 * 64 + int(SQ_G1), "Wrong knight plane");
+static_assert(index(SQ_B7, SQ_A8, ROOK) == 70 * 64 + int(SQ_B7), "Wrong underpromotion plane");
+static_assert(plane_dx(plane(-3, -3, NO_PIECE_TYPE)) == -3 && plane_dy(plane(-3, -3, NO_PIECE_TYPE)) == -3,
+              "Queen-like planes are not invertible");
+
+int index(Move m, Color us, bool stmPerspective = false);
+Move move(const Position& pos, int idx, bool stmPerspective = false);
+
+/// legal_mask() writes for each of 'count' positions a PolicySize vector set
+/// to 1 at the index of every legal move. legal_bits() does the same as a
+/// bitset of MaskWords 64-bit words per position, word p being the origin
+/// squares of the moves of plane p. Both generate the moves of several
+/// positions at once through PositionBatch, and if 'counts' is given they
+/// also store there the number of legal moves of each position.
+void legal_mask(const Position* positions, size_t count, uint8_t* out,
+                bool stmPerspective = false, int* counts = nullptr);
+void legal_bits(const Position* positions, size_t count, uint64_t* out,
+                bool stmPerspective = false, int* counts = nullptr);
+void legal_bits(const PositionBatch& batch, uint64_t* out,
+                bool stmPerspective = false, int* counts = nullptr);
+
+} // namespace Policy
+
+#endif // #ifndef POLICY_H_INCLUDED
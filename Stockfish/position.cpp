@@ -1,15 +1,102 @@
 #include <algorithm>
+#include <atomic>
 #include <cstring>
-#include <iomanip>
-#include <sstream>
+#include <deque>
+#include <mutex>
 
+#include "instrument.h"
+#include "misc.h"
 #include "position.h"
 
+namespace Zobrist {
+
+  Key psq[PIECE_NB][SQUARE_NB];
+  Key enpassant[FILE_NB];
+  Key castling[CASTLING_RIGHT_NB];
+  Key side;
+}
+
 const std::string StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
 namespace {
 
   const std::string PieceToChar(" PNBRQK  pnbrqk");
+  const char PieceChars[] = "PNBRQKpnbrqk";
+
+  // tally() returns the answer 'b' unchanged, counting it in the given
+  // instrumentation counter when it is equal to 'When'.
+  template<bool When>
+  bool tally(bool b, Instrument::Counter c) {
+
+    if (b == When)
+        Instrument::count(c);
+
+    return b;
+  }
+
+  // Helpers of the FEN parser and writer. They work on raw chars so that
+  // neither the locale nor any stream state is ever involved.
+
+  bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  bool is_digit(char c) { return c >= '0' && c <= '9'; }
+  bool is_lower(char c) { return c >= 'a' && c <= 'z'; }
+  char to_lower(char c) { return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c; }
+  char to_upper(char c) { return is_lower(c) ? char(c - 'a' + 'A') : c; }
+
+  const char* skip_spaces(const char* p, const char* end) {
+    while (p < end && is_space(*p))
+        ++p;
+    return p;
+  }
+
+  // is_epd_operation() tells whether the text at 'p' starts an EPD operation,
+  // an opcode that begins with a letter and operations ended by semicolons.
+  bool is_epd_operation(const char* p, const char* end) {
+    return    ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))
+           && std::memchr(p, ';', size_t(end - p));
+  }
+
+  // read_int() parses a non-negative decimal number that must be followed by a
+  // space or the end of input. Returns nullptr on a malformed number, a sign
+  // or an empty field included.
+  const char* read_int(const char* p, const char* end, int& value) {
+
+    const char* start = p;
+    value = 0;
+
+    for ( ; p < end && is_digit(*p); ++p)
+        if ((value = value * 10 + (*p - '0')) > 1000000)
+            return nullptr;
+
+    return p == start || (p < end && !is_space(*p)) ? nullptr : p;
+  }
+
+  char* write_int(char* p, char sep, int value) {
+
+    char digits[12];
+    int n = 0;
+
+    *p++ = sep;
+
+    do digits[n++] = char('0' + value % 10); while (value /= 10);
+
+    while (n)
+        *p++ = digits[--n];
+
+    return p;
+  }
+
+  // Castling data is shared by all the positions of a game. Standard chess
+  // needs one instance per set of castling rights, these are built at startup
+  // so that the common case never takes the lock. Other setups (Chess960) are
+  // registered on first use and live until the end of the program; a deque
+  // never moves its elements, so the handed out pointers stay valid.
+  CastlingInfo StandardCastling[CASTLING_RIGHT_NB];
+  std::deque<CastlingInfo> OtherCastling;
+  std::mutex OtherCastlingMutex;
   
   // min_attacker() is a helper function used by see_ge() to locate the least
   // valuable attacker for the side to move, remove the attacker we just found
@@ -42,12 +129,104 @@ namespace {
     return KING; // No need to update bitboards: it is the last cycle
   }
 
+
+  // MaterialTable caches the class of the material configurations met so far,
+  // indexed by a hash of the material key. An entry packs the key, 56 bits at
+  // most, a valid flag and the class in a single word, so that all threads can
+  // share the table with plain relaxed loads and stores.
+  const int MaterialTableBits = 10;
+  std::atomic<uint64_t> MaterialTable[1 << MaterialTableBits];
+
+  // classify() computes the class of a material configuration from its key
+  MaterialClass classify(Key materialKey) {
+
+    int counts[16];
+
+    for (int i = 0; i < 16; ++i)
+        counts[i] = int(materialKey >> (4 * i)) & 0xF;
+
+    auto count = [&](Color c, int nibble) { return counts[8 * c + nibble]; };
+
+    int minors[COLOR_NB], knights = 0, light = 0, dark = 0;
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        if (count(c, PAWN - 1) || count(c, ROOK - 1) || count(c, QUEEN - 1))
+            return MATERIAL_NORMAL;
+
+        knights += count(c, KNIGHT - 1);
+        light   += count(c, BISHOP - 1);
+        dark    += count(c, BISHOP + 2);
+        minors[c] = count(c, KNIGHT - 1) + count(c, BISHOP - 1) + count(c, BISHOP + 2);
+    }
+
+    if (!knights && (!light || !dark))
+        return MATERIAL_DRAW; // Bishops on one color only, also KK
+
+    if (minors[WHITE] + minors[BLACK] <= 1 || (minors[WHITE] == 1 && minors[BLACK] == 1))
+        return MATERIAL_DRAW;
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+        if (!minors[~c] && minors[c] == 2)
+        {
+            if (count(c, KNIGHT - 1) == 2)
+                return MATERIAL_DRAW; // KNNK
+
+            if (count(c, KNIGHT - 1) == 1)
+                return MATERIAL_KBNK;
+        }
+
+    return MATERIAL_NORMAL;
+  }
+
 } // namespace
 
 
 ////////////////////////////
 /* Postion Initialisation */
 ////////////////////////////
+
+/// Position::init() initializes at startup the various arrays used to compute
+/// hash keys and the shared castling data of standard chess. It must be called
+/// once, after Bitboards::init() and before any Position is built from a FEN.
+void Position::init()
+{
+  PRNG rng(1070372);
+
+  for (Piece pc : Pieces)
+      for (Square s = SQ_A1; s <= SQ_H8; ++s)
+          Zobrist::psq[pc][s] = rng.rand<Key>();
+
+  for (File f = FILE_A; f <= FILE_H; ++f)
+      Zobrist::enpassant[f] = rng.rand<Key>();
+
+  for (int cr = NO_CASTLING; cr <= ANY_CASTLING; ++cr)
+  {
+      Zobrist::castling[cr] = 0;
+      Bitboard b = cr;
+      while (b)
+      {
+          Key k = Zobrist::castling[1ULL << pop_lsb(&b)];
+          Zobrist::castling[cr] ^= k ? k : rng.rand<Key>();
+      }
+  }
+
+  Zobrist::side = rng.rand<Key>();
+
+  const Square RookSquares[] = { SQ_H1, SQ_A1, SQ_H8, SQ_A8 }; // Indexed by lsb(right)
+
+  for (int cr = NO_CASTLING; cr <= ANY_CASTLING; ++cr)
+  {
+      Position pos("4k3/8/8/8/8/8/8/4K3 w - - 0 1");
+
+      for (Bitboard b = cr; b; )
+      {
+          Square rsq = RookSquares[pop_lsb(&b)];
+          pos.set_castling_right(StandardCastling[cr], rank_of(rsq) == RANK_1 ? WHITE : BLACK, rsq);
+      }
+  }
+}
+
 Position::Position(const Position& pos, Move m)
 {
   *this = pos;
@@ -66,16 +245,9 @@ Position::Position() : Position(StartFEN) {}
 ///////////////////////////////////
 /* Position Operator Overloading */
 ///////////////////////////////////
-Position& Position::operator=  (const Position& pos)
+bool Position::operator== (const Position& pos) const
 {
-  *this = pos;
-}
-
-bool Position::operator== (const Position& pos)
-{
-  for (int i=0; i<SQUARE_NB; i++)
-      if (board[i] == pos.board[i]) return false;
-  return true;
+  return hashKey == pos.hashKey;
 }
 
 
@@ -84,119 +256,297 @@ bool Position::operator== (const Position& pos)
 ////////////////////
 const std::string Position::fen() const
 {
-    int emptyCnt;
-    std::ostringstream ss;
+    char buf[FEN_MAX_LENGTH];
+    return std::string(buf, fen_write(buf));
+}
+
+FenError Position::fen(const std::string& FEN)
+{
+    return fen_parse(FEN.c_str(), FEN.size());
+}
+
+/// Position::fen_write() writes the FEN of the position to 'out', which must
+/// have room for FEN_MAX_LENGTH chars, and returns its length. The string is
+/// null terminated. Castling rights use the X-FEN convention: the rook file
+/// is given only when the right is not with the outermost rook, which can
+/// happen in Chess960 setups.
+size_t Position::fen_write(char* out) const
+{
+    char* p = out;
     
     for (Rank r = RANK_8; r >= RANK_1; --r)
     {
         for (File f = FILE_A; f <= FILE_H; ++f)
         {
+            int emptyCnt;
+            
             for (emptyCnt = 0; f <= FILE_H && empty(make_square(f, r)); ++f)
                 ++emptyCnt;
             
             if (emptyCnt)
-                ss << emptyCnt;
+                *p++ = char('0' + emptyCnt);
             
             if (f <= FILE_H)
-                ss << PieceToChar[piece_on(make_square(f, r))];
+                *p++ = PieceToChar[piece_on(make_square(f, r))];
         }
         
         if (r > RANK_1)
-            ss << '/';
+            *p++ = '/';
     }
     
-    ss << (sideToMove == WHITE ? " w " : " b ");
-
-    if (can_castle(WHITE_OO))
-        ss << 'K';
-    
-    if (can_castle(WHITE_OOO))
-        ss << 'Q';
+    *p++ = ' ';
+    *p++ = sideToMove == WHITE ? 'w' : 'b';
+    *p++ = ' ';
     
-    if (can_castle(BLACK_OO))
-        ss << 'k';
+    for (CastlingRight cr = WHITE_OO; cr <= BLACK_OOO; cr = CastlingRight(cr << 1))
+    {
+        if (!can_castle(cr))
+            continue;
+        
+        Color c = cr & (WHITE_OO | WHITE_OOO) ? WHITE : BLACK;
+        bool kingSide = cr & (WHITE_OO | BLACK_OO);
+        Square rsq = castling_rook_square(cr);
+        Bitboard outer = 0;
+        
+        // Is there another rook of ours beyond the castling one?
+        for (Square s = rsq; file_of(s) != (kingSide ? FILE_H : FILE_A); )
+        {
+            s += kingSide ? EAST : WEST;
+            outer |= pieces(c, ROOK) & s;
+        }
+        
+        char ch = outer ? char('A' + file_of(rsq)) : kingSide ? 'K' : 'Q';
+        *p++ = c == WHITE ? ch : to_lower(ch);
+    }
     
-    if (can_castle(BLACK_OOO))
-        ss << 'q';
-
     if (!can_castle(WHITE) && !can_castle(BLACK))
-      ss << '-';
+        *p++ = '-';
     
-    ss << (epSquare == SQ_NONE ? " - " : " " + to_string(epSquare) + " ")
-       << rule50 << " " << 1 + (turn - (sideToMove == BLACK)) / 2;
-
-    return ss.str();
+    *p++ = ' ';
+    
+    if (epSquare == SQ_NONE)
+        *p++ = '-';
+    else
+    {
+        *p++ = char('a' + file_of(epSquare));
+        *p++ = char('1' + rank_of(epSquare));
+    }
+    
+    p = write_int(write_int(p, ' ', rule50), ' ', 1 + (turn - (sideToMove == BLACK)) / 2);
+    *p = 0;
+    
+    return size_t(p - out);
 }
 
-void Position::fen(const std::string& FEN)
+/// Position::fen_parse() sets up the position described by the FEN string of
+/// 'len' chars at 'fen'. It does not allocate and does not use streams. The
+/// input is validated and an error is returned if it is malformed, in which
+/// case the position is left in an unspecified state. The halfmove and
+/// fullmove counters may be missing, as in EPD, and EPD operations after the
+/// last field present are skipped. Anything else there is an error.
+FenError Position::fen_parse(const char* fen, size_t len)
 {
-    unsigned char col, row, token;
-    size_t idx;
-    Square sq = SQ_A8;
-    std::istringstream ss(FEN);
+    const char* p = fen;
+    const char* end = fen + len;
     
     clear();
-    ss >> std::noskipws;
     
     // PIECE PLACEMENT
-    while ((ss >> token) && !isspace(token))
+    int file = FILE_A, rank = RANK_8;
+    
+    for (p = skip_spaces(p, end); p < end && !is_space(*p); ++p)
     {
-        if (isdigit(token))
-            sq += Square(token - '0');
-        
-        else if (token == '/')
-            sq -= Square(16);
-        
-        else if ((idx = PieceToChar.find(token)) != std::string::npos)
+        if (*p >= '1' && *p <= '8')
         {
-            put_piece(Piece(idx), sq);
-            ++sq;
+            if ((file += *p - '0') > FILE_NB)
+                return FEN_BAD_PLACEMENT;
+        }
+        else if (*p == '/')
+        {
+            if (file != FILE_NB || rank == RANK_1)
+                return FEN_BAD_PLACEMENT;
+            
+            file = FILE_A, --rank;
+        }
+        else
+        {
+            const char* pc = std::strchr(PieceChars, *p);
+            
+            if (!*p || !pc || file >= FILE_NB)
+                return FEN_BAD_PLACEMENT;
+            
+            put_piece(Piece(pc - PieceChars + (pc - PieceChars > 5 ? 3 : 1)), make_square(File(file++), Rank(rank)));
         }
     }
-
+    
+    if (   file != FILE_NB || rank != RANK_1
+        || popcount(pieces(WHITE, KING)) != 1
+        || popcount(pieces(BLACK, KING)) != 1
+        || (pieces(PAWN) & (Rank1BB | Rank8BB))
+        || !material_ok())
+        return FEN_BAD_PLACEMENT;
+    
     // ACTIVE COLOR
-    ss >> token;
-    sideToMove = (token == 'w' ? WHITE : BLACK);
-    ss >> token;
+    p = skip_spaces(p, end);
+    
+    if (p == end || (*p != 'w' && *p != 'b') || (p + 1 < end && !is_space(p[1])))
+        return FEN_BAD_SIDE;
+    
+    sideToMove = *p++ == 'w' ? WHITE : BLACK;
     
     // CASTLING AVAILABILITY
-    while ((ss >> token) && !isspace(token))
+    CastlingInfo ci = {};
+    p = skip_spaces(p, end);
+    
+    if (p == end)
+        return FEN_BAD_CASTLING;
+    
+    if (*p == '-')
+        ++p;
+    
+    else for ( ; p < end && !is_space(*p); ++p)
     {
+        Color c = is_lower(*p) ? BLACK : WHITE;
+        Piece rook = make_piece(c, ROOK);
+        Square ksq = square<KING>(c);
+        char token = to_upper(*p);
         Square rsq;
-        Color c = islower(token) ? BLACK : WHITE;
         
-        token = char(toupper(token));
+        if (relative_rank(c, ksq) != RANK_1)
+            return FEN_BAD_CASTLING;
         
         if (token == 'K')
-            for (rsq = relative_square(c, SQ_H1); type_of(piece_on(rsq)) != ROOK; --rsq) {}
+            for (rsq = relative_square(c, SQ_H1); rsq > ksq && piece_on(rsq) != rook; --rsq) {}
         
         else if (token == 'Q')
-            for (rsq = relative_square(c, SQ_A1); type_of(piece_on(rsq)) != ROOK; ++rsq) {}
+            for (rsq = relative_square(c, SQ_A1); rsq < ksq && piece_on(rsq) != rook; ++rsq) {}
         
         else if (token >= 'A' && token <= 'H')
             rsq = make_square(File(token - 'A'), relative_rank(c, RANK_1));
         
         else
-            continue;
+            return FEN_BAD_CASTLING;
         
-        set_castling_right(c, rsq);
+        if (   piece_on(rsq) != rook
+            || can_castle(c | (rsq > ksq ? KING_SIDE : QUEEN_SIDE)))
+            return FEN_BAD_CASTLING;
+        
+        set_castling_right(ci, c, rsq);
     }
     
+    if (p < end && !is_space(*p))
+        return FEN_BAD_CASTLING;
+    
+    set_castling_info(ci);
+    
     // EN PASSANTE SQUARE
-    if (   ((ss >> col) && (col >= 'a' && col <= 'h'))
-        && ((ss >> row) && (row == '3' || row == '6')))
+    p = skip_spaces(p, end);
+    
+    if (p == end)
+        return FEN_BAD_EP;
+    
+    if (*p == '-')
+        ++p;
+    
+    else
     {
-        epSquare = make_square(File(col - 'a'), Rank(row - '1'));
+        if (   p + 1 >= end
+            || *p < 'a' || *p > 'h'
+            || p[1] != (sideToMove == WHITE ? '6' : '3'))
+            return FEN_BAD_EP;
+        
+        epSquare = make_square(File(p[0] - 'a'), Rank(p[1] - '1'));
+        p += 2;
         
-        if (   !(attackers_to(epSquare) & pieces(sideToMove, PAWN))
+        // The square must be one a double push could have left: it and the
+        // square behind it empty, the pushed pawn in front of it. It is then
+        // kept only if a pawn of the side to move can capture there.
+        if (   !empty(epSquare)
+            || !empty(epSquare + pawn_push(sideToMove))
             || !(pieces(~sideToMove, PAWN) & (epSquare + pawn_push(~sideToMove))))
+            return FEN_BAD_EP;
+        
+        if (!(attackers_to(epSquare) & pieces(sideToMove, PAWN)))
             epSquare = SQ_NONE;
     }
-    else
-        epSquare = SQ_NONE;
+    
+    if (p < end && !is_space(*p))
+        return FEN_BAD_EP;
     
     // TURN NUMBER
-    ss >> std::skipws >> rule50 >> turn;
+    int fullmove = 1;
+    p = skip_spaces(p, end);
+    
+    if (p < end && !is_epd_operation(p, end))
+    {
+        if (!(p = read_int(p, end, rule50)))
+            return FEN_BAD_COUNTERS;
+        
+        p = skip_spaces(p, end);
+        
+        if (p < end && !is_epd_operation(p, end))
+        {
+            if (!(p = read_int(p, end, fullmove)))
+                return FEN_BAD_COUNTERS;
+            
+            p = skip_spaces(p, end);
+            
+            if (p < end && !is_epd_operation(p, end))
+                return FEN_BAD_COUNTERS;
+        }
+    }
+    
+    turn = std::max(2 * (fullmove - 1), 0) + (sideToMove == BLACK);
+    
+    // The side not to move cannot be in check
+    if (attackers_to(square<KING>(~sideToMove)) & pieces(sideToMove))
+        return FEN_ILLEGAL;
+    
+    set_state();
+    return FEN_OK;
+}
+
+
+/////////////
+/* Hashing */
+/////////////
+
+/// Position::compute_key() computes the hash key of the position from scratch.
+/// It is used once when a position is set up, afterwards the key is updated
+/// incrementally and this only serves to verify it in pos_is_ok().
+Key Position::compute_key() const
+{
+  Key k = Zobrist::castling[castlingRights];
+
+  for (Bitboard b = pieces(); b; )
+  {
+      Square s = pop_lsb(&b);
+      k ^= Zobrist::psq[piece_on(s)][s];
+  }
+
+  if (epSquare != SQ_NONE)
+      k ^= Zobrist::enpassant[file_of(epSquare)];
+
+  if (sideToMove == BLACK)
+      k ^= Zobrist::side;
+
+  return k;
+}
+
+
+/// Position::compute_material_key() computes the material key from scratch, to
+/// verify the incremental one in pos_is_ok().
+Key Position::compute_material_key() const
+{
+  Key k = 0;
+
+  for (Bitboard b = pieces(); b; )
+  {
+      Square s = pop_lsb(&b);
+      k += material_weight(piece_on(s), s);
+  }
+
+  return k;
 }
 
 
@@ -221,28 +571,53 @@ void Position::do_castling(Square from, Square& to, Square& rfrom, Square& rto)
 }
 
 /// Position::set_castling_right() is a helper function used to set castling
-/// rights given the corresponding color and the rook starting square.
-void Position::set_castling_right(Color c, Square rfrom)
+/// rights given the corresponding color and the rook starting square. The
+/// castling data is accumulated in 'ci', which set_castling_info() then
+/// publishes once all the rights of the position are known.
+void Position::set_castling_right(CastlingInfo& ci, Color c, Square rfrom)
 {
   Square kfrom = square<KING>(c);
   CastlingSide cs = kfrom < rfrom ? KING_SIDE : QUEEN_SIDE;
   CastlingRight cr = (c | cs);
 
   castlingRights |= cr;
-  castlingRightsMask[kfrom] |= cr;
-  castlingRightsMask[rfrom] |= cr;
-  castlingRookSquare[cr] = rfrom;
+  ci.castlingRightsMask[kfrom] |= cr;
+  ci.castlingRightsMask[rfrom] |= cr;
+  ci.castlingRookSquare[cr] = rfrom;
 
   Square kto = relative_square(c, cs == KING_SIDE ? SQ_G1 : SQ_C1);
   Square rto = relative_square(c, cs == KING_SIDE ? SQ_F1 : SQ_D1);
 
   for (Square s = std::min(rfrom, rto); s <= std::max(rfrom, rto); ++s)
       if (s != kfrom && s != rfrom)
-          castlingPath[cr] |= s;
+          ci.castlingPath[cr] |= s;
 
   for (Square s = std::min(kfrom, kto); s <= std::max(kfrom, kto); ++s)
       if (s != kfrom && s != rfrom)
-          castlingPath[cr] |= s;
+          ci.castlingPath[cr] |= s;
+}
+
+/// Position::set_castling_info() points the position to the shared copy of
+/// the given castling data, registering a new one if none matches.
+void Position::set_castling_info(const CastlingInfo& ci)
+{
+  if (!std::memcmp(&ci, &StandardCastling[castlingRights], sizeof(CastlingInfo)))
+  {
+      castlingInfo = &StandardCastling[castlingRights];
+      return;
+  }
+
+  std::lock_guard<std::mutex> lk(OtherCastlingMutex);
+
+  for (const CastlingInfo& other : OtherCastling)
+      if (!std::memcmp(&ci, &other, sizeof(CastlingInfo)))
+      {
+          castlingInfo = &other;
+          return;
+      }
+
+  OtherCastling.push_back(ci);
+  castlingInfo = &OtherCastling.back();
 }
 
 
@@ -273,7 +648,61 @@ Bitboard Position::slider_blockers(Bitboard sliders, Square s, Bitboard& pinners
   return result;
 }
 
+/// Position::set_check_info() computes from scratch the pinned pieces of both
+/// sides and the squares from which each piece type of the side to move would
+/// give check. It is called once after the position is set up, move() then
+/// keeps the info up to date through update_check_info().
+void Position::set_check_info()
+{
+  blockersForKing[WHITE] = slider_blockers(pieces(BLACK), square<KING>(WHITE), pinnersForKing[WHITE]);
+  blockersForKing[BLACK] = slider_blockers(pieces(WHITE), square<KING>(BLACK), pinnersForKing[BLACK]);
+
+  set_check_squares();
+}
+
+/// Position::update_check_info() refreshes the check info after a move, given
+/// the squares whose occupancy the move changed. Pins against a king can only
+/// change if one of these squares is on a line through that king, so in most
+/// positions at most one of the two slider_blockers() scans has to be redone.
+/// Check squares are relative to the king of the side not to move and so are
+/// always recomputed, which costs just a couple of attack lookups.
+void Position::update_check_info(Bitboard touched)
+{
+  for (Color c = WHITE; c <= BLACK; ++c)
+  {
+      Square ksq = square<KING>(c);
+
+      if (touched & (PseudoAttacks[QUEEN][ksq] | ksq))
+          blockersForKing[c] = slider_blockers(pieces(~c), ksq, pinnersForKing[c]);
+  }
+
+  set_check_squares();
+}
+
+void Position::set_check_squares()
+{
+  Square ksq = square<KING>(~sideToMove);
+
+  checkSquares[PAWN]   = attacks_from<PAWN>(ksq, ~sideToMove);
+  checkSquares[KNIGHT] = attacks_from<KNIGHT>(ksq);
+  checkSquares[BISHOP] = attacks_from<BISHOP>(ksq);
+  checkSquares[ROOK]   = attacks_from<ROOK>(ksq);
+  checkSquares[QUEEN]  = checkSquares[BISHOP] | checkSquares[ROOK];
+  checkSquares[KING]   = 0;
+}
+
+/// Position::gives_check() tells whether a pseudo legal move gives check.
+/// The instrumentation counts and times only the calls from outside, the
+/// ones move() makes go through compute_gives_check() directly.
 bool Position::gives_check(Move m) const
+{
+  Instrument::Timer timer(Instrument::SEC_GIVES_CHECK);
+  Instrument::count(Instrument::GIVES_CHECK_CALLS);
+
+  return tally<true>(compute_gives_check(m), Instrument::GIVES_CHECK_HITS);
+}
+
+bool Position::compute_gives_check(Move m) const
 {
   assert(color_of(moved_piece(m)) == sideToMove);
 
@@ -306,8 +735,8 @@ bool Position::gives_check(Move m) const
       Square capsq = make_square(file_of(to), rank_of(from));
       Bitboard b = (pieces() ^ from ^ capsq) | to;
 
-      return  (attacks_bb<  ROOK>(square<KING>(~sideToMove), b) & pieces(sideToMove, QUEEN, ROOK))
-            | (attacks_bb<BISHOP>(square<KING>(~sideToMove), b) & pieces(sideToMove, QUEEN, BISHOP));
+      return   (attacks_bb<  ROOK>(square<KING>(~sideToMove), b) & pieces(sideToMove, QUEEN, ROOK))
+             | (attacks_bb<BISHOP>(square<KING>(~sideToMove), b) & pieces(sideToMove, QUEEN, BISHOP));
   }
   case CASTLING:
   {
@@ -339,6 +768,23 @@ Bitboard Position::attackers_to(Square s, Bitboard occ) const
         | (attacks_from<KING>(s)        & pieces(KING));
 }
 
+/// Position::compute_attacks() computes the map cached by attacks_by(), with
+/// bishops and rooks merged with the queens so that each slider is looked up
+/// only once per direction set.
+Bitboard Position::compute_attacks(Color c) const
+{
+  Bitboard attacks = attacks_by<PAWN>(c) | attacks_by<KNIGHT>(c)
+                   | attacks_from<KING>(square<KING>(c));
+
+  for (Bitboard b = pieces(c, BISHOP, QUEEN); b; )
+      attacks |= attacks_from<BISHOP>(pop_lsb(&b));
+
+  for (Bitboard b = pieces(c, ROOK, QUEEN); b; )
+      attacks |= attacks_from<ROOK>(pop_lsb(&b));
+
+  return attacks;
+}
+
 
 /////////////////////
 /* Move Evaluation */
@@ -353,6 +799,9 @@ bool Position::legal(Move m) const
   assert(color_of(moved_piece(m)) == us);
   assert(piece_on(square<KING>(us)) == make_piece(us, KING));
 
+  Instrument::Timer timer(Instrument::SEC_LEGAL);
+  Instrument::count(Instrument::LEGAL_CALLS);
+
   // En passant captures are a tricky special case. Because they are rather
   // uncommon, we do it simply by testing whether the king is attacked after
   // the move is made.
@@ -368,33 +817,124 @@ bool Position::legal(Move m) const
       assert(piece_on(capsq) == make_piece(~us, PAWN));
       assert(piece_on(to) == NO_PIECE);
 
-      return   !(attacks_bb<  ROOK>(ksq, occupied) & pieces(~us, QUEEN, ROOK))
-            && !(attacks_bb<BISHOP>(ksq, occupied) & pieces(~us, QUEEN, BISHOP));
+      return tally<false>(   !(attacks_bb<  ROOK>(ksq, occupied) & pieces(~us, QUEEN, ROOK))
+                          && !(attacks_bb<BISHOP>(ksq, occupied) & pieces(~us, QUEEN, BISHOP)), Instrument::LEGAL_REJECTED);
   }
 
   // If the moving piece is a king, check whether the destination
   // square is attacked by the opponent. Castling moves are checked
   // for legality during move generation.
   if (type_of(piece_on(from)) == KING)
-      return type_of(m) == CASTLING || !(attackers_to(to_sq(m)) & pieces(~us));
+      return tally<false>(type_of(m) == CASTLING || !(attacks_by(~us) & to_sq(m)), Instrument::LEGAL_REJECTED);
 
   // A non-king move is legal if and only if it is not pinned or it
   // is moving along the ray towards or away from the king.
-  return   !(pinned_pieces(us) & from)
-        ||  aligned(from, to_sq(m), square<KING>(us));
+  return tally<false>(   !(pinned_pieces(us) & from)
+                      ||  aligned(from, to_sq(m), square<KING>(us)), Instrument::LEGAL_REJECTED);
+}
+
+
+/// Position::see_ge() tests whether the static exchange evaluation of a move
+/// is at least the given threshold: the balance, in PieceValue[] units, of the
+/// sequence of captures on the destination square where each side always
+/// recaptures with its least valuable piece and may stop at any time. Pinned
+/// pieces take no part while their pinners are still on the board, and moves
+/// are assumed not to promote.
+
+bool Position::see_ge(Move m, int threshold) const
+{
+  assert(is_ok(m));
+
+  // Castling moves are encoded as king captures rook, so cannot be handled
+  // by the loop. Simply assume a balance of zero, always right unless in the
+  // rare case the rook ends up attacked.
+  if (type_of(m) == CASTLING)
+      return 0 >= threshold;
+
+  Square from = from_sq(m), to = to_sq(m);
+  PieceType nextVictim = type_of(piece_on(from));
+  Color stm = ~color_of(piece_on(from)); // First consider opponent's move
+  int balance; // Values of the pieces taken by us minus the opponent's ones
+  Bitboard occupied, stmAttackers;
+
+  if (type_of(m) == ENPASSANT)
+  {
+      occupied = SquareBB[to - pawn_push(~stm)]; // Remove the captured pawn
+      balance = PieceValue[PAWN];
+  }
+  else
+  {
+      occupied = 0;
+      balance = PieceValue[type_of(piece_on(to))];
+  }
+
+  if (balance < threshold)
+      return false;
+
+  if (nextVictim == KING)
+      return true;
+
+  balance -= PieceValue[nextVictim];
+
+  if (balance >= threshold)
+      return true;
+
+  bool relativeStm = true; // True if the opponent is to move
+  occupied ^= pieces() ^ from ^ to;
+
+  // Find all attackers to the destination square, with the moving piece
+  // removed, but possibly an X-ray attacker added behind it.
+  Bitboard attackers = attackers_to(to, occupied) & occupied;
+
+  while (true)
+  {
+      stmAttackers = attackers & pieces(stm);
+
+      // Don't allow pinned pieces to attack pieces except the king as long as
+      // all the pinners are on their original square.
+      if (!(pinnersForKing[stm] & ~occupied))
+          stmAttackers &= ~blockersForKing[stm];
+
+      if (!stmAttackers)
+          return relativeStm;
+
+      // Locate and remove the next least valuable attacker
+      nextVictim = min_attacker<PAWN>(byTypeBB, to, stmAttackers, occupied, attackers);
+
+      if (nextVictim == KING)
+          return relativeStm == bool(attackers & pieces(~stm));
+
+      balance += relativeStm ?  PieceValue[nextVictim]
+                             : -PieceValue[nextVictim];
+
+      relativeStm = !relativeStm;
+
+      if (relativeStm == (balance >= threshold))
+          return relativeStm;
+
+      stm = ~stm;
+  }
 }
 
 
 ////////////////////
 /* Move Execution */
 ////////////////////
-void Position::move(Move m)
+
+/// Position::move() makes a move on the position. If 'dp' is given it also
+/// gets the pieces the move changed, filled in by the branches that change
+/// them.
+void Position::move(Move m, DirtyPiece* dp)
 {
+  Instrument::Timer timer(Instrument::SEC_MOVE);
+  Instrument::count(Instrument::Counter(Instrument::MOVE_NORMAL + (type_of(m) >> 14)));
+
   // Increment ply counters. In particular, rule50 will be reset to zero later on
   // in case of a capture or a pawn move.
   turn++;
   rule50++;
   pliesFromNull++;
+  attacksBB[WHITE] = attacksBB[BLACK] = 0;
   
   Color us   = sideToMove;
   Color them = ~us;
@@ -405,12 +945,26 @@ void Position::move(Move m)
   Piece pc = piece_on(from);
   Piece captured = type_of(m) == ENPASSANT ? make_piece(them, PAWN) : piece_on(to);
   
+  // Check info of the current position is still valid here, so this is the
+  // last point where gives_check() can be asked.
+  bool givesCheck = compute_gives_check(m);
+  
+  // Squares whose occupancy changes, used to decide which pins to update
+  Bitboard touched = SquareBB[from] | to;
+
+  if (dp)
+      dp->count = 0, dp->add(pc, from, to);
+  
   // CASTLING
   if (type_of(m) == CASTLING)
   {
       Square rfrom, rto;
       do_castling(from, to, rfrom, rto);
+      touched |= SquareBB[to] | rto;
       captured = NO_PIECE;
+
+      if (dp)
+          dp->to[0] = to, dp->add(make_piece(us, ROOK), rfrom, rto);
   }
   
   // CAPTURES
@@ -422,19 +976,30 @@ void Position::move(Move m)
       {
           cap -= pawn_push(us);
           board[cap] = NO_PIECE; // Not done by remove_piece()
+          touched |= cap;
       }
       
       remove_piece(captured, cap);
       rule50 = 0;
+
+      if (dp)
+          dp->add(captured, cap, SQ_NONE);
   }
   
   // RESET EN PASSANT
   if (epSquare != SQ_NONE)
+  {
+      hashKey ^= Zobrist::enpassant[file_of(epSquare)];
       epSquare  = SQ_NONE;
+  }
   
   // CASTLING RIGHTS
-  if (castlingRights &&  (castlingRightsMask[from] | castlingRightsMask[to]))
-      castlingRights &= ~(castlingRightsMask[from] | castlingRightsMask[to]);
+  if (castlingRights &&  (castlingInfo->castlingRightsMask[from] | castlingInfo->castlingRightsMask[to]))
+  {
+      hashKey ^= Zobrist::castling[castlingRights];
+      castlingRights &= ~(castlingInfo->castlingRightsMask[from] | castlingInfo->castlingRightsMask[to]);
+      hashKey ^= Zobrist::castling[castlingRights];
+  }
   // MOVE
   if (type_of(m) != CASTLING)
       move_piece(pc, from, to);
@@ -445,7 +1010,10 @@ void Position::move(Move m)
       // SET EN PASSANTE
       if (  ((int(to) ^ int(from)) == 16)
           && (attacks_from<PAWN>(to - pawn_push(us), us) & pieces(them, PAWN)))
+      {
           epSquare = (from + to) / 2;
+          hashKey ^= Zobrist::enpassant[file_of(epSquare)];
+      }
       
       // DO PROMOTION
       if (type_of(m) == PROMOTION)
@@ -454,45 +1022,274 @@ void Position::move(Move m)
           
           remove_piece(pc, to);
           put_piece(promotion, to);
+
+          if (dp)
+              dp->to[0] = SQ_NONE, dp->add(promotion, SQ_NONE, to);
       }
       
       rule50 = 0;
   }
   
-  checkersBB = gives_check(m) ? attackers_to(square<KING>(them)) & pieces(us) : 0;
+  checkersBB = givesCheck ? attackers_to(square<KING>(them)) & pieces(us) : 0;
   
   // UPDATE TURN COLOR
   sideToMove = ~sideToMove;
+  hashKey ^= Zobrist::side;
+
+  if (history)
+      history->keys[turn & (KeyHistory::Size - 1)] = hashKey;
+  
+  // UPDATE CHECK INFO
+  update_check_info(touched);
+}
+
+
+/// Position::do_move() makes a move like move() does, but first saves in 'st'
+/// what is needed to take it back with undo_move(). This lets depth-first
+/// consumers walk the tree on a single Position instead of copying one per
+/// node. The StateInfo must outlive the move, typically it lives on the stack
+/// frame that makes and unmakes it.
+void Position::do_move(Move m, StateInfo& st, DirtyPiece* dp)
+{
+  assert(is_ok(m));
+
+  st.key            = hashKey;
+  st.epSquare       = epSquare;
+  st.castlingRights = castlingRights;
+  st.rule50         = rule50;
+  st.pliesFromNull  = pliesFromNull;
+  st.checkersBB     = checkersBB;
+  st.capturedPiece  =  type_of(m) == ENPASSANT ? make_piece(~sideToMove, PAWN)
+                     : type_of(m) == CASTLING  ? NO_PIECE : piece_on(to_sq(m));
+
+  std::memcpy(st.blockersForKing, blockersForKing, sizeof(blockersForKing));
+  std::memcpy(st.pinnersForKing, pinnersForKing, sizeof(pinnersForKing));
+  std::memcpy(st.checkSquares, checkSquares, sizeof(checkSquares));
+
+  move(m, dp);
+}
+
+/// Position::undo_move() unmakes a move made with do_move(), given the same
+/// StateInfo. When it returns, the position is back exactly as it was before
+/// do_move(). No piece list order has to be preserved since pieces are only
+/// tracked by the bitboards and board[].
+void Position::undo_move(Move m, const StateInfo& st)
+{
+  assert(is_ok(m));
+
+  sideToMove = ~sideToMove;
+  attacksBB[WHITE] = attacksBB[BLACK] = 0;
+
+  Color us = sideToMove;
+  Square from = from_sq(m);
+  Square to = to_sq(m);
+
+  if (type_of(m) == CASTLING)
+  {
+      bool kingSide = to > from;
+      Square rfrom = to; // Castling is encoded as 'King captures the rook'
+      Square kto = relative_square(us, kingSide ? SQ_G1 : SQ_C1);
+      Square rto = relative_square(us, kingSide ? SQ_F1 : SQ_D1);
+
+      remove_piece(make_piece(us, KING), kto);
+      remove_piece(make_piece(us, ROOK), rto);
+
+      board[kto] = board[rto] = NO_PIECE;
+
+      put_piece(make_piece(us, KING), from);
+      put_piece(make_piece(us, ROOK), rfrom);
+  }
+  else
+  {
+      Piece pc = piece_on(to);
+
+      if (type_of(m) == PROMOTION)
+      {
+          assert(relative_rank(us, to) == RANK_8);
+          assert(type_of(pc) == promotion_type(m));
+
+          remove_piece(pc, to);
+          pc = make_piece(us, PAWN);
+          put_piece(pc, to);
+      }
+
+      move_piece(pc, to, from);
+
+      if (st.capturedPiece)
+      {
+          Square capsq = type_of(m) == ENPASSANT ? to - pawn_push(us) : to;
+          put_piece(st.capturedPiece, capsq);
+      }
+  }
+
+  // Restore the irreversible state. This also overwrites the key, which the
+  // piece updates above have already brought back.
+  hashKey        = st.key;
+  epSquare       = st.epSquare;
+  castlingRights = st.castlingRights;
+  rule50         = st.rule50;
+  pliesFromNull  = st.pliesFromNull;
+  checkersBB     = st.checkersBB;
+  turn--;
+
+  std::memcpy(blockersForKing, st.blockersForKing, sizeof(blockersForKing));
+  std::memcpy(pinnersForKing, st.pinnersForKing, sizeof(pinnersForKing));
+  std::memcpy(checkSquares, st.checkSquares, sizeof(checkSquares));
 }
 
 
 //////////////////////
 /* Draw Information */
 //////////////////////
+/// Position::is_draw() tests for a draw by the 50 moves rule, threefold
+/// repetition or lack of material. Repetitions are seen only with a history.
 bool Position::is_draw() const
 {
-  return rule50 > 99 || endgame();
+  return rule50 > 99 || endgame() || is_repetition(2);
+}
+
+/// Position::is_repetition() tests whether the position occurred at least
+/// 'count' times before in the history. Only every second ply is looked at,
+/// back to the last capture, pawn move or null move, as nothing before can
+/// be the same position.
+bool Position::is_repetition(int count) const
+{
+  if (!history)
+      return false;
+
+  int end = std::min(std::min(rule50, pliesFromNull), turn - history->start);
+  end = std::min(end, KeyHistory::Size - 1);
+
+  for (int i = 4; i <= end; i += 2)
+      if (   history->keys[(turn - i) & (KeyHistory::Size - 1)] == hashKey
+          && --count == 0)
+          return true;
+
+  return false;
 }
 
+/// Position::endgame() tests whether the material is insufficient to mate
 bool Position::endgame() const
 {
-    switch (pieceCount[0]+pieceCount[8])
-    {
-        case 2: return true;                                            // K K
-        
-        case 3: return pieceCount[W_KNIGHT]                             // KK K
-                    || pieceCount[B_KNIGHT]                             // K KK
-                    || pieceCount[W_BISHOP]                             // KB K
-                    || pieceCount[B_BISHOP];                            // K KB
-        
-        case 4: return (pieceCount[W_KNIGHT] == 2)                      // KKK K
-                    || (pieceCount[B_KNIGHT] == 2)                      // K KKK
-                    || (pieceCount[W_KNIGHT]+pieceCount[B_KNIGHT] == 2) // KK KK
-                    || (pieceCount[W_BISHOP]+pieceCount[B_BISHOP] == 2) // KB KB
-                    || (pieceCount[W_BISHOP]+pieceCount[B_KNIGHT] == 2) // KB KK
-                    || (pieceCount[W_KNIGHT]+pieceCount[B_BISHOP] == 2);// KK KB
-    }
-    return false;
+  return material() == MATERIAL_DRAW;
+}
+
+/// Position::material() returns the class of the material on the board. It is
+/// a single lookup in a table shared by all threads, only configurations not
+/// met before are classified.
+MaterialClass Position::material() const
+{
+  std::atomic<uint64_t>& e = MaterialTable[(materialKey * 0x9E3779B97F4A7C15ULL) >> (64 - MaterialTableBits)];
+  uint64_t v = e.load(std::memory_order_relaxed);
+
+  if ((v >> 8) == materialKey && (v & 0x80))
+      return MaterialClass(v & 0x7F);
+
+  MaterialClass mc = classify(materialKey);
+  e.store(materialKey << 8 | 0x80 | mc, std::memory_order_relaxed);
+  return mc;
+}
+
+
+////////////////
+/* Symmetries */
+////////////////
+
+/// Position::symmetric() tells whether transforming the position by 'sym'
+/// keeps its game value for the side to move. Pawns must keep moving forward,
+/// which leaves only the color flip and the mirror if there are any, and
+/// castling rights are tied to the files, which leaves only the color flip.
+bool Position::symmetric(Symmetry sym) const
+{
+  bool forward = !(sym & TRANSPOSE) && !(sym & FLIP) == !(sym & SWAP_COLORS);
+
+  return   (forward || !pieces(PAWN))
+        && ((forward && !(sym & MIRROR)) || !castlingRights);
+}
+
+/// Position::transform() applies a symmetry to the position. The bitboards are
+/// transformed directly, and board[], the piece counts, the material key and
+/// the state, hash key included, are rebuilt from them. Castling rights and
+/// the en passant square are kept by the transforms that keep their meaning,
+/// as for symmetric(), and dropped by the others. The position is detached
+/// from its key history, whose keys are not those of the transformed line.
+void Position::transform(Symmetry sym)
+{
+  bool forward = !(sym & TRANSPOSE) && !(sym & FLIP) == !(sym & SWAP_COLORS);
+  bool swap = sym & SWAP_COLORS;
+
+  for (PieceType pt = ALL_PIECES; pt <= KING; ++pt)
+      byTypeBB[pt] = ::transform(byTypeBB[pt], sym);
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+      byColorBB[c] = ::transform(byColorBB[c], sym);
+
+  if (swap)
+      std::swap(byColorBB[WHITE], byColorBB[BLACK]);
+
+  std::memset(board, NO_PIECE, sizeof(board));
+  std::memset(pieceCount, 0, sizeof(pieceCount));
+  materialKey = 0;
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+      for (PieceType pt = PAWN; pt <= KING; ++pt)
+          for (Bitboard b = pieces(c, pt); b; )
+          {
+              Square s = pop_lsb(&b);
+              Piece pc = make_piece(c, pt);
+
+              board[s] = uint8_t(pc);
+              materialKey += material_weight(pc, s);
+              pieceCount[pc]++;
+              pieceCount[make_piece(c, ALL_PIECES)]++;
+          }
+
+  // The rook squares are read from the old castling info until it is replaced
+  int rights = forward && !(sym & MIRROR) ? castlingRights : NO_CASTLING;
+  CastlingInfo ci = {};
+
+  castlingRights = NO_CASTLING;
+
+  for (CastlingRight cr = WHITE_OO; cr <= BLACK_OOO; cr = CastlingRight(cr << 1))
+      if (rights & cr)
+      {
+          Color c = cr & (WHITE_OO | WHITE_OOO) ? WHITE : BLACK;
+          set_castling_right(ci, swap ? ~c : c, ::transform(castling_rook_square(cr), sym));
+      }
+
+  set_castling_info(ci);
+
+  if (epSquare != SQ_NONE)
+      epSquare = forward ? ::transform(epSquare, sym) : SQ_NONE;
+
+  // The move number stays, the ply follows the side to move
+  if (swap)
+  {
+      turn += sideToMove == WHITE ? 1 : -1;
+      sideToMove = ~sideToMove;
+  }
+
+  history = nullptr;
+  set_state();
+}
+
+/// Position::canonical_key() returns the smallest hash key among the positions
+/// this one is equivalent to under symmetric() transforms, so that all of them
+/// get the same one. Color swapping transforms count, a position and its color
+/// flipped twin share their canonical key.
+Key Position::canonical_key() const
+{
+  Key k = hashKey;
+
+  for (int sym = IDENTITY + 1; sym < SYMMETRY_NB; ++sym)
+      if (symmetric(Symmetry(sym)))
+      {
+          Position p = *this;
+          p.transform(Symmetry(sym));
+          k = std::min(k, p.hashKey);
+      }
+
+  return k;
 }
 
 
@@ -503,10 +1300,19 @@ void Position::clear()
 {
     std::memset(this, 0, sizeof(Position));
     epSquare = SQ_NONE;
-    
-    for (int i = 0; i < PIECE_NB; ++i)
-        for (int j = 0; j < 16; ++j)
-            pieceList[i][j] = SQ_NONE;
+    castlingInfo = &StandardCastling[NO_CASTLING];
+}
+
+/// Position::set_state() completes the setup of a position whose pieces, side
+/// to move, castling rights and en passant square have been set directly, as
+/// done by fen() and by the binary record decoder. It computes the hash key,
+/// the checkers and the check info.
+void Position::set_state()
+{
+    hashKey = compute_key();
+    attacksBB[WHITE] = attacksBB[BLACK] = 0;
+    checkersBB = attackers_to(square<KING>(sideToMove)) & pieces(~sideToMove);
+    set_check_info();
 }
 
 bool Position::pos_is_ok()
@@ -531,6 +1337,25 @@ bool Position::pos_is_ok()
               || attackers_to(square<KING>(~sideToMove)) & pieces(sideToMove))
               return false;
 
+      if (step == State)
+      {
+          if (hashKey != compute_key() || materialKey != compute_material_key())
+              return false;
+
+          for (Color c = WHITE; c <= BLACK; ++c)
+              if (attacksBB[c] && attacksBB[c] != compute_attacks(c))
+                  return false;
+
+          Position fresh = *this;
+          fresh.set_check_info();
+
+          if (   checkersBB != (attackers_to(square<KING>(sideToMove)) & pieces(~sideToMove))
+              || std::memcmp(fresh.blockersForKing, blockersForKing, sizeof(blockersForKing))
+              || std::memcmp(fresh.pinnersForKing, pinnersForKing, sizeof(pinnersForKing))
+              || std::memcmp(fresh.checkSquares, checkSquares, sizeof(checkSquares)))
+              return false;
+      }
+
       if (step == Bitboards)
       {
           if (  (pieces(WHITE) & pieces(BLACK))
@@ -549,8 +1374,8 @@ bool Position::pos_is_ok()
               if (pieceCount[pc] != popcount(pieces(color_of(pc), type_of(pc))))
                   return false;
 
-              for (int i = 0; i < pieceCount[pc]; ++i)
-                  if (board[pieceList[pc][i]] != pc || index[pieceList[pc][i]] != i)
+              for (Bitboard b = pieces(color_of(pc), type_of(pc)); b; )
+                  if (piece_on(pop_lsb(&b)) != pc)
                       return false;
           }
 
@@ -561,9 +1386,11 @@ bool Position::pos_is_ok()
                   if (!can_castle(c | s))
                       continue;
 
-                  if (   piece_on(castlingRookSquare[c | s]) != make_piece(c, ROOK)
-                      || castlingRightsMask[castlingRookSquare[c | s]] != (c | s)
-                      ||(castlingRightsMask[square<KING>(c)] & (c | s)) != (c | s))
+                  const CastlingInfo* ci = castlingInfo;
+
+                  if (   piece_on(ci->castlingRookSquare[c | s]) != make_piece(c, ROOK)
+                      || ci->castlingRightsMask[ci->castlingRookSquare[c | s]] != (c | s)
+                      ||(ci->castlingRightsMask[square<KING>(c)] & (c | s)) != (c | s))
                       return false;
               }
   }
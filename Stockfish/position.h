@@ -25,6 +25,100 @@
 #include "bitboard.h"
 #include "types.h"
 
+/// CastlingInfo holds the castling data that depends only on the initial
+/// placement of the kings and rooks: which rights a move from or to a square
+/// clears, the rook squares and the squares that must be empty to castle. It
+/// never changes during a game, so all the positions of a game share a single
+/// read-only instance and only a pointer to it is copied from node to node.
+
+struct CastlingInfo
+{
+  int      castlingRightsMask[SQUARE_NB];
+  Square   castlingRookSquare[CASTLING_RIGHT_NB];
+  Bitboard castlingPath[CASTLING_RIGHT_NB];
+};
+
+
+/// StateInfo struct stores the information needed to restore a Position object
+/// to its previous state when we retract a move. It holds only what cannot be
+/// recomputed from the move itself, plus the check info which could be but is
+/// cheaper to copy back than to rebuild.
+
+struct StateInfo
+{
+  Key      key;
+  Square   epSquare;
+  Piece    capturedPiece;
+  int      castlingRights, rule50, pliesFromNull;
+  Bitboard checkersBB;
+  Bitboard blockersForKing[COLOR_NB];
+  Bitboard pinnersForKing[COLOR_NB];
+  Bitboard checkSquares[KING + 1];
+};
+
+
+/// DirtyPiece lists the pieces a move changed, for evaluators that update
+/// their state incrementally instead of reading the whole board. Each entry
+/// moves 'piece' from 'from' to 'to', with SQ_NONE as 'to' for a piece taken
+/// off the board, a capture or a promoting pawn, and SQ_NONE as 'from' for a
+/// piece put on it, the promoted one. The moving piece always comes first and
+/// castling gives the king and then the rook, so at most 3 entries are used.
+
+struct DirtyPiece
+{
+  void add(Piece pc, Square f, Square t) { piece[count] = pc; from[count] = f; to[count] = t; ++count; }
+
+  int    count;
+  Piece  piece[3];
+  Square from[3], to[3];
+};
+
+
+/// KeyHistory holds the hash keys of the last positions of a game, indexed by
+/// game ply, for repetition detection. Only positions since the last capture
+/// or pawn move can repeat, and after 100 such plies the game is drawn anyway,
+/// so a small ring is enough and nothing is ever allocated. A Position given
+/// a history with set_history() records its key there at every move, and so
+/// do its copies: a history follows one line of play, in one thread.
+
+struct KeyHistory
+{
+  static const int Size = 128;
+  Key keys[Size];
+  int start; // Game ply of the first recorded key
+};
+
+
+/// MaterialClass tells what the material alone implies for the game result.
+/// MATERIAL_DRAW is for the configurations where neither side can force mate:
+/// bishops all on squares of one color and nothing else, a single minor piece,
+/// two knights against a bare king, or a minor piece each. MATERIAL_KBNK is the
+/// bishop and knight mate, which needs a technique but is forced.
+
+enum MaterialClass {
+  MATERIAL_NORMAL,
+  MATERIAL_DRAW,
+  MATERIAL_KBNK
+};
+
+
+/// FenError is the result of parsing a FEN string. Everything but FEN_OK
+/// names the first field found to be malformed.
+
+enum FenError {
+  FEN_OK,
+  FEN_BAD_PLACEMENT,
+  FEN_BAD_SIDE,
+  FEN_BAD_CASTLING,
+  FEN_BAD_EP,
+  FEN_BAD_COUNTERS,
+  FEN_ILLEGAL // The side not to move is in check
+};
+
+/// Longest FEN written by Position::fen_write(), including the terminating null
+const size_t FEN_MAX_LENGTH = 128;
+
+
 /// Position class stores information regarding the board representation as
 /// pieces, side to move, hash keys, castling info, etc. Important methods are
 /// do_move() and undo_move(), used by the search to update node info when
@@ -40,17 +134,19 @@ struct Position
   
   
   // Position Initialisation
+  static void init();
   Position(const Position& pos, Move m);
   Position(const std::string& FEN);
   Position();
   
   // Position Operator Overloading
-  Position& operator=  (const Position& pos);
-      bool  operator== (const Position& pos);
+  bool operator== (const Position& pos)                 const;
   
   // FEN String I/O
   const std::string fen()                                const;
-  void fen(const std::string& FEN);
+  FenError fen(const std::string& FEN);
+  size_t fen_write(char* out)                            const;
+  FenError fen_parse(const char* fen, size_t len);
   char to_char(File f, bool tolower = true)              const;
   char to_char(Rank r)                                   const;
   const std::string to_string(Square s)                  const;
@@ -63,6 +159,14 @@ struct Position
   Bitboard pieces(Color c, PieceType pt)                 const;
   Bitboard pieces(Color c, PieceType pt1, PieceType pt2) const;
   
+  // Hashing
+  Key key()                                              const;
+  Key compute_key()                                      const;
+  void set_history(KeyHistory* h);
+  Key material_key()                                     const;
+  Key compute_material_key()                             const;
+  bool material_ok()                                     const;
+
   // Pieces
   Piece piece_on(Square s)                               const;
   Piece moved_piece(Move m)                              const;
@@ -74,7 +178,6 @@ struct Position
   // Squares
   bool empty(Square s)                                   const;
   template<PieceType Pt> int count(Color c)              const;
-  template<PieceType Pt> const Square* squares(Color c)  const;
   template<PieceType Pt> Square square(Color c)          const;
   
   // Castling
@@ -83,13 +186,17 @@ struct Position
   bool castling_impeded(CastlingRight cr)                const;
   Square castling_rook_square(CastlingRight cr)          const;
   void do_castling(Square from, Square& to, Square& rfrom, Square& rto);
-  void set_castling_right(Color c, Square rfrom);
+  void set_castling_right(CastlingInfo& ci, Color c, Square rfrom);
+  void set_castling_info(const CastlingInfo& ci);
     
   // Checking
   Bitboard checkers()                                    const;
   Bitboard discovered_check_candidates()                 const;
   Bitboard pinned_pieces(Color c)                        const;
   Bitboard check_squares(PieceType pt)                   const;
+  void set_check_info();
+  void update_check_info(Bitboard touched);
+  void set_check_squares();
 
   // Attacking
   Bitboard attackers_to(Square s)                        const;
@@ -100,20 +207,36 @@ struct Position
   template<PieceType>
   Bitboard attacks_from(Square s, Color c)               const;
   Bitboard slider_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;
+  Bitboard attacks_by(Color c)                           const;
+  template<PieceType Pt>
+  Bitboard attacks_by(Color c)                           const;
+  Bitboard compute_attacks(Color c)                      const;
     
   // Move Evalution
   bool legal(Move m)                                     const;
   bool gives_check(Move m)                               const;
+  bool compute_gives_check(Move m)                       const;
+  bool see_ge(Move m, int threshold = 0)                 const;
     
   // Move Execution
-  void move(Move m);
+  void move(Move m, DirtyPiece* dp = nullptr);
+  void do_move(Move m, StateInfo& st, DirtyPiece* dp = nullptr);
+  void undo_move(Move m, const StateInfo& st);
   
   // Draw Information
   bool is_draw()                                         const;
+  bool is_repetition(int count)                          const;
   bool endgame()                                         const;
+  MaterialClass material()                               const;
+
+  // Symmetries
+  bool symmetric(Symmetry sym)                           const;
+  void transform(Symmetry sym);
+  Key canonical_key()                                    const;
 
   // Other
   void clear();
+  void set_state();
   bool pos_is_ok();
   
   
@@ -122,37 +245,47 @@ struct Position
   //////////////////
   
   
-  // Board
-  Piece board[SQUARE_NB];
-  Bitboard byTypeBB[PIECE_TYPE_NB];
+  // Board. Pieces are located through the bitboards, board[] is a byte per
+  // square mailbox used only to answer piece_on().
+  Bitboard byTypeBB[KING + 1];
   Bitboard byColorBB[COLOR_NB];
+  uint8_t  board[SQUARE_NB];
   
-  // En Passante Square
-  Square epSquare;
+  // Zobrist Hash Key, and the keys of the previous positions if tracked
+  Key hashKey;
+  KeyHistory* history;
+
+  // Material Key, the piece counts by type and for bishops by square color
+  Key materialKey;
 
   // Piece Info
-  int pieceCount[PIECE_NB];
-  int index[SQUARE_NB];
-  
-  Square pieceList[PIECE_NB][16];
+  uint8_t pieceCount[PIECE_NB];
   
-  // Castling Info
-  int      castlingRightsMask[SQUARE_NB];
-  Square   castlingRookSquare[CASTLING_RIGHT_NB];
-  Bitboard castlingPath[CASTLING_RIGHT_NB];
+  // Castling Info, shared by all the positions of a game
+  const CastlingInfo* castlingInfo;
   
   // Checking Info
   Bitboard checkersBB;
   Bitboard blockersForKing[COLOR_NB];
   Bitboard pinnersForKing[COLOR_NB];
-  Bitboard checkSquares[PIECE_TYPE_NB];
+  Bitboard checkSquares[KING + 1];
+
+  // Squares attacked by each side, computed by the first attacks_by() call
+  // and cleared by every move. Zero means not computed yet: a king always
+  // attacks some square.
+  mutable Bitboard attacksBB[COLOR_NB];
     
   // Other Info
+  Square epSquare;
   Color sideToMove;
   int castlingRights, rule50, pliesFromNull, turn;
   
 };
 
+// Copy-make trees hold millions of positions and copy one per node, so the
+// layout must stay within a handful of cache lines.
+static_assert(sizeof(Position) <= 5 * 64, "Position does not fit in five cache lines");
+
 
 ////////////////////
 /* FEN String I/O */
@@ -173,6 +306,70 @@ inline const std::string Position::to_string(Square s) const {
 }
 
 
+/////////////
+/* Hashing */
+/////////////
+namespace Zobrist {
+
+  extern Key psq[PIECE_NB][SQUARE_NB];
+  extern Key enpassant[FILE_NB];
+  extern Key castling[CASTLING_RIGHT_NB];
+  extern Key side;
+}
+
+inline Key Position::key() const
+{
+    return hashKey;
+}
+
+/// material_weight() is what a piece adds to the material key. The key packs a
+/// 4 bit count in each nibble: pawns, knights, light square bishops, rooks,
+/// queens and dark square bishops of white in the first six, of black from
+/// the ninth on. Kings are not counted. A count never carries over as long as
+/// material_ok() holds, which fen_parse() and the loaders of the C API check.
+inline Key material_weight(Piece pc, Square s)
+{
+    PieceType pt = type_of(pc);
+    int nibble = 8 * color_of(pc) + pt - 1 + 3 * (pt == BISHOP && (DarkSquares & s));
+
+    return pt == KING ? 0 : Key(1) << (4 * nibble);
+}
+
+inline Key Position::material_key() const
+{
+    return materialKey;
+}
+
+/// Position::material_ok() tells whether the piece counts are those of a
+/// legal game: at most 8 pawns, 10 pieces of a kind and 16 in all per side.
+/// They then fit the nibbles of the material key.
+inline bool Position::material_ok() const
+{
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        if (count<PAWN>(c) > 8 || count<ALL_PIECES>(c) > 16)
+            return false;
+
+        for (PieceType pt = KNIGHT; pt <= QUEEN; ++pt)
+            if (pieceCount[make_piece(c, pt)] > 10)
+                return false;
+    }
+
+    return true;
+}
+
+inline void Position::set_history(KeyHistory* h)
+{
+    history = h;
+
+    if (history)
+    {
+        history->start = turn;
+        history->keys[turn & (KeyHistory::Size - 1)] = hashKey;
+    }
+}
+
+
 //////////////////////////
 /* Board Representation */
 //////////////////////////
@@ -212,53 +409,47 @@ inline Bitboard Position::pieces(Color c, PieceType pt1, PieceType pt2) const
 ////////////
 inline Piece Position::piece_on(Square s) const
 {
-    return board[s];
+    return Piece(board[s]);
 }
 
 inline Piece Position::moved_piece(Move m) const
 {
-    return board[from_sq(m)];
+    return Piece(board[from_sq(m)]);
 }
 
 inline void Position::put_piece(Piece pc, Square s)
 {
-    board[s] = pc;
+    board[s] = uint8_t(pc);
+    hashKey ^= Zobrist::psq[pc][s];
     byTypeBB[ALL_PIECES] |= s;
     byTypeBB[type_of(pc)] |= s;
     byColorBB[color_of(pc)] |= s;
-    index[s] = pieceCount[pc]++;
-    pieceList[pc][index[s]] = s;
+    materialKey += material_weight(pc, s);
+    pieceCount[pc]++;
     pieceCount[make_piece(color_of(pc), ALL_PIECES)]++;
 }
 
 inline void Position::remove_piece(Piece pc, Square s)
 {
-  // WARNING: This is not a reversible operation. If we remove a piece in
-  // do_move() and then replace it in undo_move() we will put it at the end of
-  // the list and not in its original place, it means index[] and pieceList[]
-  // are not invariant to a do_move() + undo_move() sequence.
+  // board[s] is left untouched, callers overwrite it or clear it themselves
+  hashKey ^= Zobrist::psq[pc][s];
   byTypeBB[ALL_PIECES] ^= s;
   byTypeBB[type_of(pc)] ^= s;
   byColorBB[color_of(pc)] ^= s;
-  Square lastSquare = pieceList[pc][--pieceCount[pc]];
-  index[lastSquare] = index[s];
-  pieceList[pc][index[lastSquare]] = lastSquare;
-  pieceList[pc][pieceCount[pc]] = SQ_NONE;
+  materialKey -= material_weight(pc, s);
+  pieceCount[pc]--;
   pieceCount[make_piece(color_of(pc), ALL_PIECES)]--;
 }
 
 inline void Position::move_piece(Piece pc, Square from, Square to)
 {
-  // index[from] is not updated and becomes stale. This works as long as index[]
-  // is accessed just by known occupied squares.
   Bitboard from_to_bb = SquareBB[from] ^ SquareBB[to];
+  hashKey ^= Zobrist::psq[pc][from] ^ Zobrist::psq[pc][to];
   byTypeBB[ALL_PIECES] ^= from_to_bb;
   byTypeBB[type_of(pc)] ^= from_to_bb;
   byColorBB[color_of(pc)] ^= from_to_bb;
   board[from] = NO_PIECE;
-  board[to] = pc;
-  index[to] = index[from];
-  pieceList[pc][index[to]] = to;
+  board[to] = uint8_t(pc);
 }
 
 
@@ -276,17 +467,11 @@ inline int Position::count(Color c) const
     return pieceCount[make_piece(c, Pt)];
 }
 
-template<PieceType Pt>
-inline const Square* Position::squares(Color c) const
-{
-    return pieceList[make_piece(c, Pt)];
-}
-
 template<PieceType Pt>
 inline Square Position::square(Color c) const
 {
     assert(pieceCount[make_piece(c, Pt)] == 1);
-    return pieceList[make_piece(c, Pt)][0];
+    return lsb(pieces(c, Pt));
 }
 
 
@@ -305,12 +490,12 @@ inline int Position::can_castle(Color c) const
 
 inline bool Position::castling_impeded(CastlingRight cr) const
 {
-    return byTypeBB[ALL_PIECES] & castlingPath[cr];
+    return byTypeBB[ALL_PIECES] & castlingInfo->castlingPath[cr];
 }
 
 inline Square Position::castling_rook_square(CastlingRight cr) const
 {
-    return castlingRookSquare[cr];
+    return castlingInfo->castlingRookSquare[cr];
 }
 
 
@@ -360,6 +545,33 @@ inline Bitboard Position::attacks_from<PAWN>(Square s, Color c) const
     return StepAttacksBB[make_piece(c, PAWN)][s];
 }
 
+/// Position::attacks_by() returns the squares attacked by the pieces of color
+/// c. The map is computed once per position, and only if asked for, so that
+/// the generator, legal() and the feature extractors all share it. Filling
+/// the cache writes to the position, so threads must not share one.
+inline Bitboard Position::attacks_by(Color c) const
+{
+    return attacksBB[c] ? attacksBB[c] : (attacksBB[c] = compute_attacks(c));
+}
+
+/// The piece type variant returns the squares attacked by the pieces of type
+/// Pt and color c, queens not included in bishops or rooks. These maps are not
+/// cached: pawns take two shifts and the others a few table lookups each.
+template<PieceType Pt>
+inline Bitboard Position::attacks_by(Color c) const
+{
+    if (Pt == PAWN)
+        return  c == WHITE ? shift<NORTH_WEST>(pieces(c, PAWN)) | shift<NORTH_EAST>(pieces(c, PAWN))
+                           : shift<SOUTH_WEST>(pieces(c, PAWN)) | shift<SOUTH_EAST>(pieces(c, PAWN));
+
+    Bitboard attacks = 0;
+
+    for (Bitboard b = pieces(c, Pt); b; )
+        attacks |= attacks_from<Pt>(pop_lsb(&b));
+
+    return attacks;
+}
+
 inline Bitboard Position::attacks_from(Piece pc, Square s) const
 {
     return attacks_bb(pc, s, byTypeBB[ALL_PIECES]);
@@ -0,0 +1,285 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#include "position.h"
+#include "record.h"
+
+namespace {
+
+  const char Magic[4] = { 'S', 'F', 'B', 'R' };
+
+  const int CastlingRookCode = 7; // Unused piece code, xor 8 for black
+
+} // namespace
+
+
+/// PackedPosition::pack() encodes a position. It takes a single pass over
+/// the occupied squares.
+
+PackedPosition PackedPosition::pack(const Position& pos) {
+
+  PackedPosition pp;
+  std::memset(&pp, 0, sizeof(pp));
+
+  Bitboard castlingRooks = 0;
+
+  for (CastlingRight cr = WHITE_OO; cr <= BLACK_OOO; cr = CastlingRight(cr << 1))
+      if (pos.can_castle(cr))
+          castlingRooks |= pos.castling_rook_square(cr);
+
+  int n = 0;
+
+  for (Bitboard b = pp.occupied = pos.pieces(); b; ++n)
+  {
+      Square s = pop_lsb(&b);
+      int code = pos.piece_on(s);
+
+      if (castlingRooks & s)
+          code = CastlingRookCode | (code & 8);
+
+      pp.pieces[n / 2] |= uint8_t(code << (4 * (n & 1)));
+  }
+
+  pp.flags    = uint8_t(pos.sideToMove);
+  pp.epSquare = uint8_t(pos.epSquare);
+  pp.rule50   = uint16_t(std::min(pos.rule50, 0xFFFF));
+  pp.turn     = uint16_t(std::min(pos.turn, 0xFFFF));
+
+  return pp;
+}
+
+
+/// PackedPosition::unpack() decodes straight into a Position, leaving it in
+/// the same state as if it had been set up from the equivalent FEN.
+
+void PackedPosition::unpack(Position& pos) const {
+
+  pos.clear();
+
+  Bitboard castlingRooks = 0;
+  int n = 0;
+
+  for (Bitboard b = occupied; b; ++n)
+  {
+      Square s = pop_lsb(&b);
+      int code = (pieces[n / 2] >> (4 * (n & 1))) & 0xF;
+
+      if ((code & 7) == CastlingRookCode)
+      {
+          castlingRooks |= s;
+          code = make_piece(Color(code >> 3), ROOK);
+      }
+
+      assert(type_of(Piece(code)) != NO_PIECE_TYPE);
+
+      pos.put_piece(Piece(code), s);
+  }
+
+  pos.sideToMove = Color(flags & 1);
+
+  CastlingInfo ci = {};
+
+  while (castlingRooks)
+  {
+      Square rsq = pop_lsb(&castlingRooks);
+      pos.set_castling_right(ci, color_of(pos.piece_on(rsq)), rsq);
+  }
+
+  pos.set_castling_info(ci);
+  pos.epSquare = Square(epSquare);
+  pos.rule50   = rule50;
+  pos.turn     = turn;
+  pos.set_state();
+}
+
+
+template<typename Record>
+bool RecordWriter<Record>::open(const std::string& path, size_t bufferRecords) {
+
+  close();
+
+  if (!(file = fopen(path.c_str(), "wb")))
+      return false;
+
+  RecordHeader header = {};
+  std::memcpy(header.magic, Magic, sizeof(Magic));
+  header.recordSize = sizeof(Record);
+
+  buffer.clear();
+  buffer.reserve(std::max(bufferRecords, size_t(1)));
+  count = 0;
+  error = fwrite(&header, sizeof(header), 1, file) != 1;
+
+  return !error;
+}
+
+
+/// RecordWriter::flush() writes out the buffered records. Only the records
+/// fully written are counted, and nothing more is written after a failure.
+
+template<typename Record>
+bool RecordWriter<Record>::flush() {
+
+  if (!file || buffer.empty() || error)
+  {
+      buffer.clear();
+      return !error;
+  }
+
+  size_t written = fwrite(buffer.data(), sizeof(Record), buffer.size(), file);
+  count += written;
+  error = written != buffer.size();
+  buffer.clear();
+  return !error;
+}
+
+
+/// RecordWriter::close() flushes the buffer and updates the record count in
+/// the file header.
+
+template<typename Record>
+bool RecordWriter<Record>::close() {
+
+  if (!file)
+      return true;
+
+  bool ok = flush();
+
+  // The header is updated even after a failure, so it never claims records
+  // that are not in the file.
+  ok &=   !fseek(file, offsetof(RecordHeader, recordCount), SEEK_SET)
+       && fwrite(&count, sizeof(count), 1, file) == 1;
+
+  ok &= !fclose(file);
+  file = nullptr;
+  return ok;
+}
+
+
+/// RecordReader::open() maps the whole file read-only. It fails if the file
+/// does not exist, is not a record file or holds records of another type.
+
+template<typename Record>
+bool RecordReader<Record>::open(const std::string& path) {
+
+  close();
+
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+
+  if (fd == -1)
+      return false;
+
+  struct stat statbuf;
+  fstat(fd, &statbuf);
+  mapSize = size_t(statbuf.st_size);
+  base = mapSize ? mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  ::close(fd);
+
+  if (base == MAP_FAILED)
+  {
+      base = nullptr;
+      return false;
+  }
+
+  madvise(base, mapSize, MADV_SEQUENTIAL);
+#else
+  HANDLE fd = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+  if (fd == INVALID_HANDLE_VALUE)
+      return false;
+
+  DWORD size_high;
+  DWORD size_low = GetFileSize(fd, &size_high);
+  mapSize = (uint64_t(size_high) << 32) | size_low;
+  HANDLE mmap = mapSize ? CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high, size_low, nullptr) : nullptr;
+  CloseHandle(fd);
+
+  if (!mmap)
+      return false;
+
+  mapping = uint64_t(mmap);
+  base = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
+
+  if (!base)
+  {
+      close();
+      return false;
+  }
+#endif
+
+  const RecordHeader* header = (const RecordHeader*)base;
+
+  if (   mapSize < sizeof(RecordHeader)
+      || std::memcmp(header->magic, Magic, sizeof(Magic))
+      || header->recordSize != sizeof(Record))
+  {
+      close();
+      return false;
+  }
+
+  records = (const Record*)(header + 1);
+  count = (mapSize - sizeof(RecordHeader)) / sizeof(Record);
+  return true;
+}
+
+
+template<typename Record>
+void RecordReader<Record>::close() {
+
+#ifndef _WIN32
+  if (base)
+      munmap(base, mapSize);
+#else
+  if (base)
+      UnmapViewOfFile(base);
+
+  if (mapping)
+      CloseHandle((HANDLE)mapping);
+#endif
+
+  records = nullptr;
+  count = mapSize = 0;
+  base = nullptr;
+  mapping = 0;
+}
+
+// Explicit template instantiations
+template class RecordWriter<PackedPosition>;
+template class RecordWriter<PackedGameRecord>;
+template class RecordWriter<CountedPosition>;
+template class RecordReader<PackedPosition>;
+template class RecordReader<PackedGameRecord>;
+template class RecordReader<CountedPosition>;
@@ -0,0 +1,168 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RECORD_H_INCLUDED
+#define RECORD_H_INCLUDED
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+struct Position;
+
+/// PackedPosition is the fixed-size binary form of a Position, 32 bytes:
+///
+/// occupied   64 bit: bitboard of all the pieces
+/// pieces    128 bit: a 4-bit code per set bit of 'occupied', in square order,
+///                    the first piece in the low nibble of pieces[0]. Codes are
+///                    the Piece values, with the unused 7 and 15 standing for a
+///                    white or black rook that still has its castling right.
+/// flags       8 bit: side to move in bit 0
+/// epSquare    8 bit: en passant square, SQ_NONE if none
+/// rule50     16 bit
+/// turn       16 bit
+/// reserved   16 bit: always zero
+///
+/// Marking castling rooks in the piece codes describes Chess960 setups
+/// without extra fields. Multi-byte fields are stored little-endian: records
+/// are written and memory mapped as raw structs, so big-endian hosts are
+/// refused at compile time rather than swapping bytes on every access.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#  error "Record files are mapped as raw structs and need a little-endian host"
+#endif
+
+struct PackedPosition {
+
+  static PackedPosition pack(const Position& pos);
+  void unpack(Position& pos) const;
+
+  uint64_t occupied;
+  uint8_t  pieces[16];
+  uint8_t  flags;
+  uint8_t  epSquare;
+  uint16_t rule50;
+  uint16_t turn;
+  uint16_t reserved;
+};
+
+static_assert(sizeof(PackedPosition) == 32, "PackedPosition must be 32 bytes");
+
+
+/// PackedGameRecord is a PackedPosition followed by the move played in it and
+/// the final result of the game: 1 if white won, 0 for a draw, -1 if black won.
+
+struct PackedGameRecord {
+
+  PackedPosition pos;
+  uint16_t move;
+  int8_t   result;
+  uint8_t  reserved[5];
+};
+
+static_assert(sizeof(PackedGameRecord) == 40, "PackedGameRecord must be 40 bytes");
+
+
+/// CountedPosition is a PackedPosition with the number of times it occurred
+/// in a corpus, as written by the aggregating mode of Dedup.
+
+struct CountedPosition {
+
+  PackedPosition pos;
+  uint64_t count;
+};
+
+static_assert(sizeof(CountedPosition) == 40, "CountedPosition must be 40 bytes");
+
+
+/// A record file is a RecordHeader followed by a flat array of records of a
+/// single type. The header is 32 bytes so that records stay 8-byte aligned
+/// when the file is memory mapped.
+
+struct RecordHeader {
+
+  char     magic[4];
+  uint32_t recordSize;
+  uint64_t recordCount; // Informative, the reader trusts the file size
+  uint64_t reserved[2];
+};
+
+static_assert(sizeof(RecordHeader) == 32, "RecordHeader must be 32 bytes");
+
+
+/// RecordWriter appends records to a file through a large buffer, so the file
+/// is written with few big sequential writes. A failed write is sticky: the
+/// records after it are dropped and close() reports the failure.
+
+template<typename Record>
+class RecordWriter {
+
+public:
+  RecordWriter() : file(nullptr), count(0), error(false) {}
+  RecordWriter(const RecordWriter&) = delete;
+  RecordWriter& operator=(const RecordWriter&) = delete;
+ ~RecordWriter() { close(); }
+
+  bool open(const std::string& path, size_t bufferRecords = 1 << 16);
+  void write(const Record& r) { buffer.push_back(r); if (buffer.size() == buffer.capacity()) flush(); }
+  void write(const Record* r, size_t n) { for (size_t i = 0; i < n; ++i) write(r[i]); }
+  bool flush();
+  bool close();
+
+private:
+  FILE* file;
+  uint64_t count;
+  bool error;
+  std::vector<Record> buffer;
+};
+
+
+/// RecordReader memory maps a record file and gives direct read-only access
+/// to its records, so decoding a record does not go through any copy or
+/// stream layer. The mapping is shared by all the threads reading it.
+
+template<typename Record>
+class RecordReader {
+
+public:
+  RecordReader() : records(nullptr), count(0), base(nullptr), mapSize(0), mapping(0) {}
+  RecordReader(const RecordReader&) = delete;
+  RecordReader& operator=(const RecordReader&) = delete;
+ ~RecordReader() { close(); }
+
+  bool open(const std::string& path);
+  void close();
+  size_t size() const { return count; }
+  const Record& operator[](size_t i) const { return records[i]; }
+  const Record* begin() const { return records; }
+  const Record* end() const { return records + count; }
+
+private:
+  const Record* records;
+  size_t count;
+  void* base;
+  size_t mapSize;
+  uint64_t mapping; // OS specific handle of the mapping, if any
+};
+
+#endif // #ifndef RECORD_H_INCLUDED
@@ -0,0 +1,241 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "misc.h"
+#include "movegen.h"
+#include "position.h"
+#include "record.h"
+#include "selfplay.h"
+#include "tbprobe.h"
+
+namespace {
+
+  // A WorkQueue holds the indices of the games not yet started by a worker.
+  // The owner pops from the front while thieves take from the back, so the
+  // two ends are only contended when the queue is nearly empty. Tasks are
+  // whole games, milliseconds of work each, so a lock per queue costs
+  // nothing measurable and keeps the code simple. The padding keeps the
+  // queues of different workers on different cache lines.
+  struct WorkQueue {
+
+    bool pop(uint64_t& game) {
+      std::lock_guard<std::mutex> lk(mutex);
+      if (games.empty())
+          return false;
+      game = games.front(), games.pop_front();
+      return true;
+    }
+
+    bool steal(uint64_t& game) {
+      std::lock_guard<std::mutex> lk(mutex);
+      if (games.empty())
+          return false;
+      game = games.back(), games.pop_back();
+      return true;
+    }
+
+    char padding1[64];
+    std::mutex mutex;
+    std::deque<uint64_t> games;
+    char padding2[64];
+  };
+
+  // Worker runs on its own thread. It plays games from its own queue, steals
+  // from the others when it runs dry, and appends each finished game to the
+  // shared writer in one locked batch. Its members are written on every
+  // move, so it is padded as WorkQueue is: the workers sit next to each other
+  // in a vector, whose storage is not cache line aligned before C++17.
+  struct Worker {
+
+    Worker(int i, uint64_t seed) : idx(i), rng(seed) {}
+
+    char padding1[64];
+    int idx;
+    PRNG rng;
+    SelfPlay::Stats stats = {};
+    std::vector<PackedGameRecord> game;
+    char padding2[64];
+  };
+
+  // A spread out, never zero, seed for each worker so that their PRNG
+  // streams are distinct even for consecutive base seeds.
+  uint64_t worker_seed(uint64_t seed, int idx) {
+    uint64_t s = (seed + uint64_t(idx + 1) * 0x9E3779B97F4A7C15ULL) ^ 0xD1B54A32D192ED03ULL;
+    s = (s ^ (s >> 31)) * 0xBF58476D1CE4E5B9ULL;
+    return (s ^ (s >> 29)) | 1;
+  }
+
+  // Plays a single game from 'root', leaving its records in w.game
+  void play_game(Worker& w, const Position& root, int maxPlies, const SelfPlay::Policy& policy) {
+
+    Position pos = root;
+    KeyHistory history;
+    int result = 0;
+
+    pos.set_history(&history);
+
+    w.game.clear();
+
+    for (int ply = 0; ply < maxPlies && !pos.is_draw(); ++ply)
+    {
+        if (Tablebases::adjudicate(pos, result))
+            break;
+
+        MoveList<LEGAL> moves(pos);
+
+        if (!moves.size())
+        {
+            if (pos.checkers())
+                result = pos.sideToMove == WHITE ? -1 : 1;
+            break;
+        }
+
+        Move m = policy(pos, moves.begin(), moves.size(), w.rng);
+
+        assert(moves.contains(m));
+
+        PackedGameRecord r = {};
+        r.pos = PackedPosition::pack(pos);
+        r.move = uint16_t(m);
+        w.game.push_back(r);
+
+        pos.move(m);
+    }
+
+    for (PackedGameRecord& r : w.game)
+        r.result = int8_t(result);
+
+    w.stats.games++;
+    w.stats.positions += w.game.size();
+    w.stats.whiteWins += result > 0;
+    w.stats.draws     += result == 0;
+    w.stats.blackWins += result < 0;
+  }
+
+} // namespace
+
+
+Move SelfPlay::uniform(const Position&, const ExtMove* moves, size_t count, PRNG& rng) {
+
+  return moves[rng.rand<uint64_t>() % count];
+}
+
+
+SelfPlay::Policy SelfPlay::sample(Evaluator eval) {
+
+  return [eval](const Position& pos, const ExtMove* moves, size_t count, PRNG& rng) {
+
+      float weights[MAX_MOVES];
+      float sum = 0;
+
+      eval(pos, moves, count, weights);
+
+      for (size_t i = 0; i < count; ++i)
+          sum += weights[i] = std::max(weights[i], 0.0f);
+
+      if (sum <= 0)
+          return uniform(pos, moves, count, rng);
+
+      // 24 random bits give a uniform float in [0, sum)
+      float x = float(rng.rand<uint64_t>() >> 40) / float(1 << 24) * sum;
+
+      for (size_t i = 0; i < count; ++i)
+          if ((x -= weights[i]) < 0)
+              return Move(moves[i]);
+
+      return Move(moves[count - 1]); // Rounding left x just above zero
+  };
+}
+
+
+bool SelfPlay::play(const std::string& path, const Position& root, const Limits& limits,
+                    const Policy& policy, Stats& stats) {
+
+  RecordWriter<PackedGameRecord> writer;
+  std::mutex writerMutex;
+  bool ok = writer.open(path);
+  int threads = std::max(limits.threads, 1);
+
+  stats = Stats();
+
+  if (!ok)
+      return false;
+
+  std::unique_ptr<WorkQueue[]> queues(new WorkQueue[threads]);
+  std::vector<Worker> workers;
+
+  // Deal the games round robin, stealing evens out whatever lengths they
+  // turn out to have.
+  for (uint64_t g = 0; g < limits.games; ++g)
+      queues[g % threads].games.push_back(g);
+
+  for (int i = 0; i < threads; ++i)
+      workers.emplace_back(i, worker_seed(limits.seed, i));
+
+  auto run = [&](Worker& w) {
+
+      for (uint64_t g; ; )
+      {
+          bool found = queues[w.idx].pop(g);
+
+          // Steal starting from the next worker, so the thieves spread out
+          for (int i = 1; !found && i < threads; ++i)
+              found = queues[(w.idx + i) % threads].steal(g);
+
+          // No queue is ever refilled, so once all are empty we are done
+          if (!found)
+              break;
+
+          play_game(w, root, limits.maxPlies, policy);
+
+          std::lock_guard<std::mutex> lk(writerMutex);
+          writer.write(w.game.data(), w.game.size());
+      }
+  };
+
+  std::vector<std::thread> pool;
+
+  for (int i = 1; i < threads; ++i)
+      pool.emplace_back(run, std::ref(workers[i]));
+
+  run(workers[0]);
+
+  for (std::thread& th : pool)
+      th.join();
+
+  for (const Worker& w : workers)
+  {
+      stats.games     += w.stats.games;
+      stats.positions += w.stats.positions;
+      stats.whiteWins += w.stats.whiteWins;
+      stats.draws     += w.stats.draws;
+      stats.blackWins += w.stats.blackWins;
+  }
+
+  return writer.close();
+}
@@ -0,0 +1,77 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SELFPLAY_H_INCLUDED
+#define SELFPLAY_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "movegen.h"
+
+struct Position;
+class PRNG;
+
+namespace SelfPlay {
+
+/// A Policy picks the move to play among the 'count' legal moves of 'pos'.
+/// It is called concurrently by all the workers, each passing its own PRNG,
+/// so it must not touch shared state without its own synchronization.
+typedef std::function<Move(const Position& pos, const ExtMove* moves, size_t count, PRNG& rng)> Policy;
+
+/// An Evaluator fills 'weights' with a non-negative, not necessarily
+/// normalized, probability for each of the 'count' legal moves of 'pos'.
+/// This is where an external network plugs in.
+typedef std::function<void(const Position& pos, const ExtMove* moves, size_t count, float* weights)> Evaluator;
+
+/// uniform() plays a legal move picked uniformly at random
+Move uniform(const Position& pos, const ExtMove* moves, size_t count, PRNG& rng);
+
+/// sample() returns a Policy that samples moves in proportion to the weights
+/// given by 'eval', falling back to uniform() if all the weights are zero.
+Policy sample(Evaluator eval);
+
+struct Limits {
+  uint64_t games    = 1;
+  int      threads  = 1;
+  uint64_t seed     = 1;
+  int      maxPlies = 512; // Games still running at this ply are adjudicated a draw
+};
+
+struct Stats {
+  uint64_t games, positions, whiteWins, draws, blackWins;
+};
+
+/// play() plays 'limits.games' games from 'root' on 'limits.threads'
+/// workers and appends every position of each finished game, with the move
+/// played and the game result, as PackedGameRecord to the file at 'path'.
+/// Games are scheduled on per-worker deques and idle workers steal from the
+/// others, so long games do not leave threads idle at the end of a run.
+/// Games that reach a position of the tablebases found by Tablebases::init()
+/// end there with the tablebase result.
+/// Returns false if the file could not be written.
+bool play(const std::string& path, const Position& root, const Limits& limits,
+          const Policy& policy, Stats& stats);
+
+} // namespace SelfPlay
+
+#endif // #ifndef SELFPLAY_H_INCLUDED
@@ -0,0 +1,69 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TBPROBE_H_INCLUDED
+#define TBPROBE_H_INCLUDED
+
+#include <string>
+
+struct Position;
+
+namespace Tablebases {
+
+enum WDLScore {
+  WDLLoss        = -2, // Loss
+  WDLBlessedLoss = -1, // Loss, but draw under 50-move rule
+  WDLDraw        =  0, // Draw
+  WDLCursedWin   =  1, // Win, but draw under 50-move rule
+  WDLWin         =  2  // Win
+};
+
+// Possible states after a probing operation
+enum ProbeState {
+  FAIL              =  0, // Probe failed (missing file table)
+  OK                =  1, // Probe succesful
+  CHANGE_STM        = -1, // DTZ should check the other side
+  ZEROING_BEST_MOVE =  2  // Best move zeroes DTZ (capture or pawn move)
+};
+
+/// Largest number of pieces, kings included, of the tables found by init()
+extern int MaxCardinality;
+
+/// init() looks for the Syzygy files in the given directories, separated by
+/// ':', or ';' on Windows, and returns the number of tables found. Files are
+/// only memory mapped at their first probe, and the mappings are shared by
+/// all the threads. Must not be called while other threads are probing.
+int init(const std::string& paths);
+
+/// probe_wdl() and probe_dtz() return the WDL or DTZ value of the position,
+/// from the point of view of the side to move, and set 'result' to FAIL if
+/// some table is missing. The position must have no castling rights. It is
+/// modified during the probe but always given back unchanged.
+WDLScore probe_wdl(Position& pos, ProbeState* result);
+int probe_dtz(Position& pos, ProbeState* result);
+
+/// adjudicate() is the game termination hook that goes with Position::is_draw():
+/// it returns true if the position is in the tablebases and sets 'result' to
+/// the result of the game, 1 if white wins, -1 if black wins, 0 if drawn.
+/// Wins that the 50 moves rule turns into draws count as draws.
+bool adjudicate(Position& pos, int& result);
+
+} // namespace Tablebases
+
+#endif // #ifndef TBPROBE_H_INCLUDED
@@ -0,0 +1,139 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm> // For std::min and std::max
+#include <cstring>   // For std::memset
+#include <iostream>
+
+#include "bitboard.h"
+#include "tt.h"
+
+namespace {
+
+  const std::memory_order Relaxed = std::memory_order_relaxed;
+
+}
+
+
+/// TranspositionTable::resize() sets the size of the transposition table,
+/// measured in megabytes. Transposition table consists of a power of 2 number
+/// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// A size too small to hold a single cluster, 0 included, gives one cluster.
+
+void TranspositionTable::resize(size_t mbSize) {
+
+  size_t clusters = std::max((mbSize * 1024 * 1024) / sizeof(Cluster), size_t(1));
+  size_t newClusterCount = size_t(1) << msb(clusters);
+
+  if (newClusterCount == clusterCount)
+      return;
+
+  clusterCount = newClusterCount;
+
+  free(mem);
+  mem = calloc(clusterCount * sizeof(Cluster) + CacheLineSize - 1, 1);
+
+  if (!mem)
+  {
+      std::cerr << "Failed to allocate " << mbSize
+                << "MB for transposition table." << std::endl;
+      exit(EXIT_FAILURE);
+  }
+
+  table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+}
+
+
+/// TranspositionTable::clear() overwrites the entire transposition table
+/// with zeros. It must not be called while other threads access the table.
+
+void TranspositionTable::clear() {
+
+  std::memset((void*)table, 0, clusterCount * sizeof(Cluster));
+}
+
+
+/// TranspositionTable::probe() looks up the given key in the table. It returns
+/// true and fills 'data' if an entry verifies against the key. Verification is
+/// done on the XOR of both words, so an entry being written concurrently by
+/// another thread is reported as a miss rather than as garbage.
+
+bool TranspositionTable::probe(Key key, uint64_t& data) const {
+
+  const Cluster* c = first_cluster(key);
+
+  for (int i = 0; i < ClusterSize; ++i)
+  {
+      uint64_t d = c->entry[i].data.load(Relaxed);
+
+      if ((c->entry[i].check.load(Relaxed) ^ d) == key)
+      {
+          data = d;
+          return true;
+      }
+  }
+
+  return false;
+}
+
+
+/// TranspositionTable::store() saves a payload for the given key. An existing
+/// entry for the same key is overwritten, otherwise the entry with the lowest
+/// depth in the cluster is replaced. Empty entries have depth 0 and so are
+/// used first.
+
+void TranspositionTable::store(Key key, uint64_t data, int depth) {
+
+  Cluster* c = first_cluster(key);
+  int replace = 0;
+
+  for (int i = 0; i < ClusterSize; ++i)
+  {
+      if ((c->entry[i].check.load(Relaxed) ^ c->entry[i].data.load(Relaxed)) == key)
+      {
+          replace = i;
+          break;
+      }
+
+      if (c->depth[i].load(Relaxed) < c->depth[replace].load(Relaxed))
+          replace = i;
+  }
+
+  c->entry[replace].check.store(key ^ data, Relaxed);
+  c->entry[replace].data.store(data, Relaxed);
+  c->depth[replace].store(uint8_t(std::min(std::max(depth, 0), 255)), Relaxed);
+}
+
+
+/// TranspositionTable::hashfull() returns an approximation of the table
+/// occupation during a search, in permill. It samples the first 1000 clusters
+/// (or fewer if the table is smaller).
+
+int TranspositionTable::hashfull() const {
+
+  size_t samples = std::min(clusterCount, size_t(1000));
+  size_t cnt = 0;
+
+  for (size_t i = 0; i < samples; ++i)
+      for (int j = 0; j < ClusterSize; ++j)
+          cnt += (table[i].entry[j].check.load(Relaxed) | table[i].entry[j].data.load(Relaxed)) != 0;
+
+  return samples ? int(cnt * 1000 / (samples * ClusterSize)) : 0;
+}
@@ -0,0 +1,95 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2016 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TT_H_INCLUDED
+#define TT_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+
+#include "misc.h"
+#include "types.h"
+
+/// TTEntry struct is a single slot of the transposition table. It holds a
+/// 64-bit payload chosen by the caller (a perft node count, a packed network
+/// evaluation...) together with the position key XORed with that payload:
+///
+/// check  64 bit: key ^ data
+/// data   64 bit: user payload
+///
+/// Both words are read and written with relaxed atomics and without locks. If
+/// two threads race on the same slot, the reader sees a torn entry whose check
+/// word does not verify, so a corrupted payload is never returned.
+
+struct TTEntry {
+
+  std::atomic<uint64_t> check;
+  std::atomic<uint64_t> data;
+};
+
+
+/// A TranspositionTable consists of a power of 2 number of clusters and each
+/// cluster consists of ClusterSize number of TTEntry. Each non-empty entry
+/// contains information about exactly one position. The size of a cluster
+/// should divide the size of a cache line so that a probe touches only one
+/// line. A depth byte per entry drives the replacement policy: an entry is
+/// overwritten by a store of the same key or, failing that, the shallowest
+/// entry of the cluster is replaced. Depth bytes are only accessed as hints,
+/// so a racy update can cost a replacement decision but never an answer.
+
+class TranspositionTable {
+
+  static const int CacheLineSize = 64;
+  static const int ClusterSize = 3;
+
+  struct Cluster {
+    TTEntry entry[ClusterSize];
+    std::atomic<uint8_t> depth[ClusterSize];
+    char padding[CacheLineSize - ClusterSize * (sizeof(TTEntry) + 1)];
+  };
+
+  static_assert(CacheLineSize % sizeof(Cluster) == 0, "Cluster size incorrect");
+
+public:
+  TranspositionTable() : clusterCount(0), table(nullptr), mem(nullptr) {}
+  explicit TranspositionTable(size_t mbSize) : TranspositionTable() { resize(mbSize); }
+  TranspositionTable(const TranspositionTable&) = delete;
+  TranspositionTable& operator=(const TranspositionTable&) = delete;
+ ~TranspositionTable() { free(mem); }
+
+  bool probe(Key key, uint64_t& data) const;
+  void store(Key key, uint64_t data, int depth = 0);
+  int hashfull() const;
+  void resize(size_t mbSize);
+  void clear();
+  void prefetch(Key key) const { ::prefetch(first_cluster(key)); }
+
+private:
+  // The lowest order bits of the key are used to get the index of the cluster
+  Cluster* first_cluster(Key key) const {
+    return &table[size_t(key) & (clusterCount - 1)];
+  }
+
+  size_t clusterCount;
+  Cluster* table;
+  void* mem;
+};
+
+#endif // #ifndef TT_H_INCLUDED
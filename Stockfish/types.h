@@ -37,6 +37,12 @@
 ///
 /// -DUSE_PEXT    | Add runtime support for use of pext asm-instruction. Works
 ///               | only in 64-bit mode and requires hardware with pext support.
+///
+/// -DUSE_AVX2    | Add runtime support for use of AVX2 instructions in the batch
+///               | routines. Requires hardware with AVX2 support.
+///
+/// -DUSE_AVX512  | Add runtime support for use of AVX-512 instructions in the
+///               | batch routines. Requires hardware with AVX-512F support.
 
 #include <cassert>
 #include <cctype>
@@ -79,6 +85,10 @@
 #  define pext(b, m) (0)
 #endif
 
+#if defined(USE_AVX2) || defined(USE_AVX512)
+#  include <immintrin.h> // Header for AVX2 and AVX-512 intrinsics
+#endif
+
 #ifdef USE_POPCNT
 const bool HasPopCnt = true;
 #else
@@ -91,6 +101,18 @@ const bool HasPext = true;
 const bool HasPext = false;
 #endif
 
+#ifdef USE_AVX2
+const bool HasAvx2 = true;
+#else
+const bool HasAvx2 = false;
+#endif
+
+#ifdef USE_AVX512
+const bool HasAvx512 = true;
+#else
+const bool HasAvx512 = false;
+#endif
+
 #ifdef IS_64BIT
 const bool Is64Bit = true;
 #else
@@ -145,6 +167,19 @@ enum CastlingRight {
   CASTLING_RIGHT_NB = 16
 };
 
+/// Symmetry is a transform of the board, made of the flags below applied in
+/// the order they are listed. FLIP with SWAP_COLORS is the color flip, which
+/// holds for every position, see Position::symmetric() for the others.
+enum Symmetry {
+  IDENTITY    = 0,
+  TRANSPOSE   = 1, // Reflection in the a1-h8 diagonal, files <-> ranks
+  MIRROR      = 2, // Files a <-> h
+  FLIP        = 4, // Ranks 1 <-> 8
+  SWAP_COLORS = 8, // Colors of the pieces and of the side to move
+  COLOR_FLIP  = FLIP | SWAP_COLORS,
+  SYMMETRY_NB = 16
+};
+
 template<Color C, CastlingSide S> struct MakeCastling {
   static const CastlingRight
   right = C == WHITE ? S == QUEEN_SIDE ? WHITE_OOO : WHITE_OO
@@ -167,6 +202,10 @@ enum Piece {
 const Piece Pieces[] = { W_PAWN, W_KNIGHT, W_BISHOP, W_ROOK, W_QUEEN, W_KING,
                          B_PAWN, B_KNIGHT, B_BISHOP, B_ROOK, B_QUEEN, B_KING };
 
+/// Piece values in centipawns by piece type, for the static exchange evaluation
+/// and the ordering of captures. The king is never exchanged, so it is zero.
+const int PieceValue[PIECE_TYPE_NB] = { 0, 100, 325, 325, 500, 975, 0, 0 };
+
 enum Square {
   SQ_A1, SQ_B1, SQ_C1, SQ_D1, SQ_E1, SQ_F1, SQ_G1, SQ_H1,
   SQ_A2, SQ_B2, SQ_C2, SQ_D2, SQ_E2, SQ_F2, SQ_G2, SQ_H2,
@@ -235,6 +274,12 @@ inline Square operator~(Square s) {
   return Square(s ^ SQ_A8); // Vertical flip SQ_A1 -> SQ_A8
 }
 
+inline Square transform(Square s, Symmetry sym) {
+  if (sym & TRANSPOSE)
+      s = Square(((s & 7) << 3) | (s >> 3));
+  return Square(s ^ (sym & MIRROR ? 7 : 0) ^ (sym & FLIP ? 56 : 0));
+}
+
 inline Piece operator~(Piece pc) {
   return Piece(pc ^ 8); // Swap color of piece B_KNIGHT -> W_KNIGHT
 }